@@ -0,0 +1,131 @@
+/*==============================================================================
+ * file: config.def.h
+ * minimal, suckless-style compile-time configuration (copy to config.h)
+ * License: BSD3
+ *============================================================================*/
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/* Default bind address (host:port) */
+#define DEF_BIND_ADDR     "127.0.0.1:8080"
+
+/* Default backend: "openai" or "trtllm" */
+#define DEF_BACKEND       "openai"
+
+/* OpenAI-compatible settings */
+#define DEF_API_BASE      "https://api.openai.com"
+#define DEF_MODEL         "gpt-4o-mini"
+#define DEF_TEMPERATURE   0.6
+#define DEF_MAX_TOKENS    1024
+#define DEF_CONTEXT_TOKENS 0               /* model window; 0 = no budget  */
+
+/* Upstream replicas (repeat --api-base) */
+#define DEF_LB            "ewma"           /* "least" or "ewma"            */
+#define UP_EWMA_TAU_MS    10000            /* peak-EWMA decay constant     */
+#define UP_EJECT_FAILS    3                /* consecutive failures to eject*/
+#define UP_EJECT_MS       10000            /* ejection time, doubles       */
+#define UP_PROBE_MS       5000             /* TCP health probe; 0 = off    */
+#define UP_PROBE_TIMEOUT_MS 1000
+#define UP_TTFB_SAMPLES   64               /* TTFB window per replica      */
+#define UP_HEDGE_MIN_SAMPLES 16            /* no hedging before this many  */
+#define UP_HEDGE_PCT      10               /* max % of requests hedged     */
+#define UP_RETRIES        3                /* extra attempts per request   */
+#define UP_RETRY_PCT      20               /* retry budget, % of requests  */
+#define UP_RETRY_BURST    10               /* retries banked at most       */
+#define UP_BACKOFF_MS     100              /* first backoff cap, doubles   */
+#define UP_BACKOFF_MAX_MS 5000
+
+/* Model routing (--routes) */
+#define ROUTE_MAX         64               /* entries in the table         */
+#define ROUTE_BUSY_RETRY_MS 1000           /* Retry-After at inflight=     */
+
+/* Offline runs (--batch) */
+#define DEF_CONCURRENCY   8                /* requests in flight           */
+
+/* HTML theme bits; the CSS is served as /static/style.css */
+#define APP_TITLE         "llmserv"
+#define CSS_INLINE \
+"body{max-width:52rem;margin:2rem auto;font:16px/1.35 system-ui,Arial,Helvetica,sans-serif}" \
+"h1{font-weight:600;font-size:1.25rem;margin:0 0 1rem}" \
+"form{margin:0 0 1rem}" \
+"textarea{width:100%;min-height:9rem}" \
+"pre{white-space:pre-wrap;background:#f7f7f7;padding:1rem;border-radius:.25rem}" \
+"label{display:block;margin:.5rem 0 .25rem;color:#333}" \
+"input[type=text],input[type=number]{width:100%;}" \
+".row{display:flex;gap:1rem}" \
+".col{flex:1}" \
+".warn{color:#a00}" \
+".footer{margin-top:1rem;color:#777;font-size:.9rem}"
+
+/* Limits and timeouts */
+#define MAX_REQ_BODY      (256*1024)       /* 256 KiB form body cap        */
+#define MAX_RESP_BODY     (4*1024*1024)    /* 4 MiB upstream HTTP cap      */
+#define RESP_READ_CHUNK   (16*1024)        /* per read of an upstream reply*/
+#define MAX_RENDER        (4*1024*1024)    /* 4 MiB HTML render cap        */
+#define MAX_TRANSCRIPT    (128*1024)       /* cap stateless transcript     */
+#define MAX_TURNS         12               /* last N turns kept            */
+#define IO_TIMEOUT_SEC    60               /* default per-request deadline */
+#define HTTP_POOL_MAX     64               /* idle upstream connections    */
+#define HTTP_POOL_IDLE_MS 30000            /* close pooled ones idle longer*/
+#define H2_CONNS_MAX      16               /* HTTP/2 connections in all    */
+#define H2_MAX_STREAMS    100              /* until the server's SETTINGS  */
+#define H2_WINDOW         (1024*1024)      /* receive window per stream    */
+#define H2_CONN_WINDOW    (16*1024*1024)   /* receive window per connection*/
+
+/* Listener and --procs workers */
+#define DEF_BACKLOG       128              /* listen() queue, --backlog    */
+#define DEF_SOCKET_MODE   0660             /* --bind unix:PATH permissions */
+#define PREFORK_RESTART_MS 1000            /* min gap between restarts     */
+#define LISTEN_POLL_MS    1000             /* accept loop looks at signals */
+#define DRAIN_SEC         90               /* SIGTERM: then SIGALRM ends it*/
+#define RELOAD_WAIT_SEC   30               /* SIGUSR2: new instance starts */
+
+/* Backend workers (--privsep) */
+#define PRIV_INLINE_MAX   (64*1024)        /* larger messages go in a memfd*/
+#define PRIV_GRACE_MS     1000             /* after cancel, then kill it   */
+
+/* Request tracing (--trace) */
+#define TRACE_RING_SPANS  256              /* spans kept per thread        */
+#define TRACE_ONDEMAND_SEC 10              /* SIGUSR1: trace all this long */
+
+/* TRT-LLM prompt preparation */
+#define TRT_PREFIX_CACHE_TOKENS (1u<<20)   /* token ids kept for old turns */
+
+/* History compaction (--compact) */
+#define COMPACT_KEEP      6                /* newest entries kept verbatim */
+#define COMPACT_BLOCK     8                /* entries per summary step     */
+#define COMPACT_SLOTS     256              /* summaries cached             */
+#define COMPACT_QUEUE     16               /* jobs waiting, then dropped   */
+#define COMPACT_MAX_TOKENS 400             /* summary length cap           */
+#define COMPACT_PROMPT "Summarize the conversation below for your own later use. " \
+	"Keep names, facts, numbers, decisions and open questions; drop small talk. " \
+	"Write plain prose, no preamble."
+#define COMPACT_HEADER "Summary of the earlier conversation:\n"
+
+/* Conversation store (--store) */
+#define STORE_INDEX_SLOTS (1u<<20)         /* conversations; fixed at creation */
+#define STORE_SEGMENT_BYTES (64u<<20)      /* a new segment past this size */
+#define STORE_SEGMENTS    8                /* more: compact them (see store.c) */
+#define STORE_IDLE_DAYS   30               /* compaction drops idler ones  */
+#define STORE_SYNC_MS     200              /* appends fdatasync'd this often */
+#define STORE_DIRTY       1024             /* unsynced appends, then sync now */
+
+/* Access log (--access-log); ring size must be a power of two */
+#define ALOG_RING_SLOTS   1024             /* records buffered before drop */
+#define ALOG_FLUSH_MS     50               /* writer idle poll interval    */
+#define ALOG_FLUSH_RECS   64               /* records per write() at most  */
+
+/* Security headers */
+#define CSP_HEADER "Content-Security-Policy: default-src 'none'; form-action 'self'; style-src 'self'\r\n"
+#define XFO_HEADER "X-Frame-Options: DENY\r\n"
+#define REF_HEADER "Referrer-Policy: no-referrer\r\n"
+#define CACHECTL   "Cache-Control: no-store\r\n"
+#define CACHE_STATIC "Cache-Control: public, max-age=31536000, immutable\r\n"
+#define CACHE_REVALIDATE "Cache-Control: no-cache\r\n"   /* index page */
+
+/* Feature toggles (compile-time) */
+#define WITH_CSRF     0   /* keep 0 to avoid pulling crypto */
+#define WITH_PLEDGE   1   /* auto ignored on Linux */
+#define WITH_UNVEIL   1   /* auto ignored on Linux */
+
+#endif
@@ -4,6 +4,7 @@
  *============================================================================*/
 #ifndef LLM_BACKEND_H
 #define LLM_BACKEND_H
+#include <stddef.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -27,6 +28,7 @@ struct llm_req {
 	const char *api_base;  /* e.g. https://api.openai.com */
 	const char *api_key;   /* may be NULL when using HME/TRT */
 	int no_network;        /* strong intent: do not use outbound nets */
+	int http2;             /* multiplex over HTTP/2 where offered */
 
 	/* HME/qrexec-style transport (optional):
 	   If hme_argc>0, write request JSON to argv[0].. stdin and read JSON
@@ -36,12 +38,40 @@ struct llm_req {
 
 	/* TRT-LLM options */
 	const char *trt_engine_path;
+
+	/* limits (all optional; zero/NULL = none) */
+	unsigned long long deadline_us;    /* absolute, now_us() clock: give up
+	                                      on connect/TLS/write/read after it */
+	const int *cancel;                 /* nonzero: abandon the call soon */
+	unsigned long long *first_byte_us; /* set when the first reply byte
+	                                      arrives (now_us() clock) */
+	unsigned long long trace_id;       /* nonzero: record spans under it
+	                                      (src/trace.h) */
+
+	/* streaming (optional): ask the upstream for SSE and pass each content
+	   delta to on_delta as it arrives; llm_resp.content still gets the
+	   whole text. Backends that cannot stream never call it. A nonzero
+	   return abandons the call (LLM_ECANCELED). */
+	int (*on_delta)(void *arg, const char *text, size_t n);
+	void *delta_arg;
 };
 
+/* llm_resp.status */
+#define LLM_OK          0
+#define LLM_ETRANSPORT  1   /* connect, TLS, read or write failed */
+#define LLM_EPROTO      2   /* reply unparseable or without content */
+#define LLM_EBACKEND    3   /* local engine failure */
+#define LLM_ETIMEOUT    4   /* llm_req.deadline_us passed */
+#define LLM_ECANCELED   5   /* llm_req.cancel raised */
+#define LLM_ETHROTTLED  6   /* HTTP 429 */
+#define LLM_EUPSTREAM   7   /* HTTP 5xx */
+#define LLM_EREJECTED   8   /* other HTTP 4xx: retrying will not help */
+
 struct llm_resp {
 	char *content;     /* malloc'd; caller frees */
-	int status;        /* 0 ok, >0 error */
+	int status;        /* LLM_OK or LLM_E* */
 	int http_status;   /* 200..; 0 if not HTTP */
+	int retry_after_ms;/* from Retry-After; 0 if none */
 	char *err;         /* malloc'd error string (nullable) */
 };
 
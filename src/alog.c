@@ -0,0 +1,172 @@
+/*==============================================================================
+ * src/alog.c  —  access log: lock-free MPSC ring drained by one writer thread
+ *
+ * Producers claim a slot with a CAS on the enqueue cursor and publish it by
+ * bumping the slot sequence (bounded MPMC ring after D. Vyukov, used here
+ * with a single consumer). A full ring drops the record and counts it; the
+ * request path never waits on the log file.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "alog.h"
+#include "util.h"
+#include "../config.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define RING_MASK ((size_t)ALOG_RING_SLOTS - 1)
+
+struct slot {
+	size_t seq;
+	struct alog_rec rec;
+};
+
+static struct slot ring[ALOG_RING_SLOTS];
+static size_t enq_pos;           /* shared by producers */
+static size_t deq_pos;           /* writer only */
+static uint64_t dropped, reported;
+static uint64_t sample_ctr;
+static unsigned sample_n;
+static int fmt, running, reopen_req, stop_req;
+static const char *log_path;
+static FILE *log_fp;
+static pthread_t writer;
+
+static void put_escaped(FILE *f, const char *s){
+	for(const unsigned char *p=(const unsigned char*)s; p && *p; ++p){
+		if(*p=='"' || *p=='\\') { fputc('\\', f); fputc(*p, f); }
+		else if(*p < 0x20 || *p==0x7f) fprintf(f, "\\u%04x", (unsigned)*p);
+		else fputc(*p, f);
+	}
+}
+
+static void write_rec(FILE *f, const struct alog_rec *r){
+	if(fmt==ALOG_LOGFMT){
+		fprintf(f, "ts=%llu route=%s status=%d bytes=%zu queue_us=%u"
+		        " backend_us=%u render_us=%u total_us=%u model=\"",
+		        (unsigned long long)r->ts_ms, r->route, r->status, r->bytes,
+		        r->queue_us, r->backend_us, r->render_us, r->total_us);
+		put_escaped(f, r->model);
+		fputs("\"\n", f);
+		return;
+	}
+	fprintf(f, "{\"ts\":%llu,\"route\":\"%s\",\"status\":%d,\"bytes\":%zu,"
+	        "\"queue_us\":%u,\"backend_us\":%u,\"render_us\":%u,\"total_us\":%u,"
+	        "\"model\":\"",
+	        (unsigned long long)r->ts_ms, r->route, r->status, r->bytes,
+	        r->queue_us, r->backend_us, r->render_us, r->total_us);
+	put_escaped(f, r->model);
+	fputs("\"}\n", f);
+}
+
+static int drain(void){
+	int n=0;
+	for(;;){
+		struct slot *s = &ring[deq_pos & RING_MASK];
+		size_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if(seq != deq_pos+1) break;
+		write_rec(log_fp, &s->rec);
+		__atomic_store_n(&s->seq, deq_pos + RING_MASK + 1, __ATOMIC_RELEASE);
+		deq_pos++; n++;
+		/* records are under 1 KiB: the buffer never fills mid-line */
+		if(!(n % ALOG_FLUSH_RECS)) fflush(log_fp);
+	}
+	uint64_t d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+	if(d != reported){
+		if(fmt==ALOG_LOGFMT) fprintf(log_fp, "ts=%llu dropped=%llu\n",
+		        (unsigned long long)time(NULL)*1000ULL, (unsigned long long)d);
+		else fprintf(log_fp, "{\"ts\":%llu,\"dropped\":%llu}\n",
+		        (unsigned long long)time(NULL)*1000ULL, (unsigned long long)d);
+		reported = d; n++;
+	}
+	return n;
+}
+
+/* Whole lines per write(): with O_APPEND, --procs workers sharing the
+   file never interleave inside a record. */
+static FILE *open_target(void){
+	if(!log_path || !strcmp(log_path,"-")) return stderr;
+	FILE *f = fopen(log_path, "a");
+	if(f) setvbuf(f, NULL, _IOFBF, ALOG_FLUSH_RECS*1024);
+	return f;
+}
+
+static void *writer_main(void *arg){
+	(void)arg;
+	struct timespec ts = { 0, ALOG_FLUSH_MS*1000000L };
+	for(;;){
+		int n = drain();
+		if(n) fflush(log_fp);
+		if(__atomic_exchange_n(&reopen_req, 0, __ATOMIC_ACQ_REL) && log_fp!=stderr){
+			FILE *nf = open_target();
+			if(nf){ fclose(log_fp); log_fp = nf; }
+			else warnx("access log: cannot reopen %s", log_path);
+		}
+		if(__atomic_load_n(&stop_req, __ATOMIC_ACQUIRE)){
+			drain(); fflush(log_fp);
+			return NULL;
+		}
+		if(!n) nanosleep(&ts, NULL);
+	}
+}
+
+static void on_hup(int sig){ (void)sig; alog_reopen(); }
+
+int alog_open(const char *path, int format, unsigned sample){
+	log_path = path; fmt = format; sample_n = sample;
+	for(size_t i=0;i<ALOG_RING_SLOTS;i++) ring[i].seq = i;
+	enq_pos = deq_pos = 0;
+	if(!(log_fp = open_target())){ warnx("access log: cannot open %s", path); return -1; }
+	if(log_fp != stderr){
+		struct sigaction sa; memset(&sa,0,sizeof sa);
+		sa.sa_handler = on_hup; sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGHUP, &sa, NULL);
+	}
+	if(pthread_create(&writer, NULL, writer_main, NULL)){
+		if(log_fp != stderr) fclose(log_fp);
+		log_fp = NULL; return -1;
+	}
+	running = 1;
+	return 0;
+}
+
+void alog_submit(const struct alog_rec *r){
+	if(!running) return;
+	if(sample_n > 1 && r->status < 400 &&
+	   __atomic_fetch_add(&sample_ctr, 1, __ATOMIC_RELAXED) % sample_n) return;
+
+	size_t pos = __atomic_load_n(&enq_pos, __ATOMIC_RELAXED);
+	struct slot *s;
+	for(;;){
+		s = &ring[pos & RING_MASK];
+		size_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if(dif == 0){
+			if(__atomic_compare_exchange_n(&enq_pos, &pos, pos+1, 1,
+			                               __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}else if(dif < 0){
+			__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}else pos = __atomic_load_n(&enq_pos, __ATOMIC_RELAXED);
+	}
+	s->rec = *r;
+	__atomic_store_n(&s->seq, pos+1, __ATOMIC_RELEASE);
+}
+
+void alog_reopen(void){ __atomic_store_n(&reopen_req, 1, __ATOMIC_RELEASE); }
+
+void alog_close(void){
+	if(!running) return;
+	running = 0;
+	__atomic_store_n(&stop_req, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+	if(log_fp && log_fp != stderr) fclose(log_fp);
+	log_fp = NULL;
+}
+
+uint64_t alog_dropped(void){ return __atomic_load_n(&dropped, __ATOMIC_RELAXED); }
+int alog_enabled(void){ return running; }
@@ -0,0 +1,35 @@
+/*==============================================================================
+ * src/alog.h  —  asynchronous structured access log
+ * License: BSD3
+ *============================================================================*/
+#ifndef ALOG_H
+#define ALOG_H
+#include <stddef.h>
+#include <stdint.h>
+
+enum { ALOG_JSON, ALOG_LOGFMT };
+
+/* One line per request. Producers fill this on their own stack and hand it
+   to alog_submit(), which copies it into the ring and never blocks. */
+struct alog_rec {
+	uint64_t ts_ms;          /* wall clock, ms since epoch */
+	const char *route;       /* static route name, not the raw path */
+	int status;              /* HTTP status sent to the client */
+	size_t bytes;            /* response bytes written */
+	uint32_t queue_us;       /* accept -> request parsed and dispatched */
+	uint32_t backend_us;     /* time inside llm_fn */
+	uint32_t render_us;      /* time inside render_page */
+	uint32_t total_us;       /* accept -> last byte written */
+	char model[64];          /* truncated copy; escaped by the writer */
+};
+
+/* path NULL or "-" logs to stderr. sample N keeps 1 of N successful
+   requests (errors are always kept); 0 or 1 keeps everything. */
+int  alog_open(const char *path, int fmt, unsigned sample);
+void alog_submit(const struct alog_rec *r);
+void alog_reopen(void);      /* async-signal-safe; applied by the writer */
+void alog_close(void);       /* drain, join writer, close file */
+uint64_t alog_dropped(void);
+int  alog_enabled(void);
+
+#endif
@@ -1,105 +1,214 @@
 /*==============================================================================
  * src/backend_openai.c
- * OpenAI-compatible backend using libtls (if TLS_BACKEND_LIBTLS) or curl(1)
+ * OpenAI-compatible backend: native HTTP for http:// and unix:// bases,
+ * libtls (if TLS_BACKEND_LIBTLS) or curl(1) for https://; with
+ * llm_req.http2 the native client goes over HTTP/2 (src/h2.c) where the
+ * upstream offers it
  * License: BSD3
  *============================================================================*/
 #define _POSIX_C_SOURCE 200809L
 #include "../include/llm_backend.h"
 #include "util.h"
+#include "json.h"
+#include "hconn.h"
+#include "h2.h"
+#include "trace.h"
 #include "../config.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <strings.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <errno.h>
 
-#if defined(TLS_BACKEND_LIBTLS)
-#include <tls.h>
-#include <netdb.h>
-#include <sys/socket.h>
-#endif
+/* fill out->err from errno (saved by the caller) after a failed exchange */
+static int io_fail(struct llm_resp *out, int e, const char *what){
+	out->status = e==ETIMEDOUT? LLM_ETIMEOUT : e==ECANCELED? LLM_ECANCELED
+	            : e==EFBIG? LLM_EPROTO : LLM_ETRANSPORT;
+	out->err=xstrdup(e==ETIMEDOUT? "upstream deadline exceeded"
+	               : e==ECANCELED? "upstream call cancelled"
+	               : e==EFBIG? "upstream reply larger than MAX_RESP_BODY" : what);
+	return -1;
+}
 
-/* --- Minimal JSON builder & string escaper --- */
-static void json_escape_into(struct sbuf *b, const char *s){
-	sb_putc(b,'"');
-	if (s) for(const unsigned char *p=(const unsigned char*)s; *p; ++p){
-		switch(*p){
-			case '\\': sb_puts(b,"\\\\"); break;
-			case '"':  sb_puts(b,"\\\""); break;
-			case '\n': sb_puts(b,"\\n"); break;
-			case '\r': sb_puts(b,"\\r"); break;
-			case '\t': sb_puts(b,"\\t"); break;
-			default:
-				if(*p < 0x20) sb_printf(b,"\\u%04x", (unsigned)*p);
-				else sb_putc(b,*p);
+/* How much the next read of a reply may take: a chunk, but never more than
+   one byte past MAX_RESP_BODY, so an oversized reply is seen as such
+   without being held. 0 (errno EFBIG) once past it. */
+static size_t reply_room(const struct sbuf *out){
+	if(out->len > MAX_RESP_BODY){ errno=EFBIG; return 0; }
+	size_t n=MAX_RESP_BODY+1-out->len;
+	return n<RESP_READ_CHUNK? n : RESP_READ_CHUNK;
+}
+
+/* ------------------------------ SSE streaming -----------------------------
+ * With r->on_delta the reply is parsed while it arrives. Chunk framing is
+ * peeled off where the body sits in the raw reply buffer (curl hands the
+ * body over already decoded), each "data:" line's delta is decoded and
+ * handed to on_delta, and the deltas are collected for out->content. */
+struct sse {
+	const struct llm_req *r;
+	int decoded;              /* body has no chunk framing left (curl) */
+	size_t hdr, body, fed;    /* offsets in the raw reply */
+	int on, chunked, done, stop;
+	struct sbuf line, text;   /* partial line; content so far */
+};
+
+/* The status of a reply head starting at h: "HTTP/1.1 200 OK", or
+   "HTTP/2 200" as curl prints an h2 reply; -1 if h is no status line */
+static int status_code(const char *h){
+	if(strncmp(h, "HTTP/1.", 7) && strncmp(h, "HTTP/2", 6)) return -1;
+	const char *sp=strchr(h, ' '), *nl=strchr(h, '\n');
+	if(!sp || (nl && nl<sp)) return -1;
+	char *end;
+	long st=strtol(sp+1, &end, 10);
+	return end==sp+1 || st<100 || st>999? -1 : (int)st;
+}
+
+/* Offset of the body of the final (non-1xx) reply in raw, 0 while its
+   headers are incomplete; *hdr is where that reply's headers start. */
+static size_t reply_body(const struct sbuf *raw, size_t *hdr){
+	for(;;){
+		char *e = raw->len? strstr(raw->s+*hdr, "\r\n\r\n") : NULL;
+		if(!e) return 0;
+		if(status_code(raw->s+*hdr)/100==1){
+			*hdr=(size_t)(e+4-raw->s);   /* interim 1xx reply */
+			continue;
 		}
+		return (size_t)(e+4-raw->s);
 	}
-	sb_putc(b,'"');
 }
 
-static char *build_openai_json(const struct llm_req *r){
-	struct sbuf b; sb_init(&b);
-	sb_puts(&b, "{");
-	sb_puts(&b, "\"model\":"); json_escape_into(&b, r->model ? r->model : DEF_MODEL);
-	sb_printf(&b, ",\"temperature\":%.3f", r->temperature);
-	if(r->max_tokens>0) sb_printf(&b, ",\"max_tokens\":%d", r->max_tokens);
-	sb_puts(&b, ",\"messages\":[");
-	for(int i=0;i<r->nmsgs;i++){
-		if(i) sb_putc(&b, ',');
-		sb_puts(&b, "{\"role\":"); json_escape_into(&b, r->msgs[i].role);
-		sb_puts(&b, ",\"content\":"); json_escape_into(&b, r->msgs[i].content);
-		sb_puts(&b, "}");
+static void sse_line(struct sse *s, char *l){
+	size_t n=strlen(l);
+	if(n && l[n-1]=='\r') l[--n]=0;
+	if(strncmp(l, "data:", 5)) return;   /* comments, event:, id: */
+	l+=5;
+	if(*l==' ') l++;
+	if(!strcmp(l, "[DONE]")){ s->done=1; return; }
+	char *d=json_delta(l);
+	if(d && *d){
+		size_t k=strlen(d);
+		sb_putn(&s->text, d, k);
+		if(s->r->on_delta(s->r->delta_arg, d, k)) s->stop=1;
 	}
-	sb_puts(&b, "]}");
-	return sb_steal(&b);
+	free(d);
 }
 
-/* Extract first choices[0].message.content via a simple matcher (no full JSON) */
-static char *extract_content(const char *json){
-	if(!json) return NULL;
-	const char *p = strstr(json, "\"content\"");
-	if(!p) return NULL;
+/* body bytes p[0..n), which the parser may scribble on but restores */
+static void sse_bytes(struct sse *s, char *p, size_t n){
+	char *end=p+n, *nl;
+	while(!s->stop && p<end && (nl=memchr(p, '\n', (size_t)(end-p)))){
+		if(s->line.len){
+			sb_putn(&s->line, p, (size_t)(nl-p));
+			sse_line(s, s->line.s);
+			s->line.len=0;
+		}else{
+			*nl=0;
+			sse_line(s, p);
+			*nl='\n';
+		}
+		p=nl+1;
+	}
+	if(p<end) sb_putn(&s->line, p, (size_t)(end-p));
+}
 
-	/* Find the first quote after the colon: "content": " ... " */
-	const char *colon = strchr(p, ':'); if(!colon) return NULL;
-	const char *start = strchr(colon, '"'); if(!start) return NULL;
-	start++;
+/* parse what arrived in raw since the last call */
+static void sse_feed(struct sse *s, struct sbuf *raw){
+	if(!s->body){
+		if(!(s->body=reply_body(raw, &s->hdr))) return;
+		const char *h=raw->s+s->hdr, *v;
+		int st=status_code(h);
+		v=http_header(h, "Content-Type");
+		s->on = st>=200 && st<300 && v && !strncasecmp(v, "text/event-stream", 17);
+		v=http_header(h, "Transfer-Encoding");
+		s->chunked = !s->decoded && v && !strncasecmp(v, "chunked", 7);
+		s->fed=s->body;
+	}
+	while(s->on && !s->stop && s->fed<raw->len){
+		char *p=raw->s+s->fed;
+		if(!s->chunked){
+			sse_bytes(s, p, raw->len-s->fed);
+			s->fed=raw->len;
+			break;
+		}
+		char *nl=strstr(p, "\r\n");
+		if(!nl) break;
+		unsigned long k=strtoul(p, NULL, 16);
+		size_t at=(size_t)(nl+2-raw->s);
+		if(!k){ s->fed=raw->len; break; }   /* last chunk */
+		if(raw->len-at < k+2) break;
+		sse_bytes(s, raw->s+at, k);
+		s->fed=at+k+2;
+	}
+}
 
-	struct sbuf b; sb_init(&b);
-	for(const char *s=start; *s; ++s){
-		if(*s=='"'){ /* if not escaped, it's the end */
-			const char *prev=s-1; int esc=0;
-			while(prev>=start && *prev=='\\'){ esc^=1; prev--; }
-			if(!esc){
-				return sb_steal(&b);
-			}
+static int sse_more(void *arg, struct sbuf *raw){
+	struct sse *s=arg;
+	sse_feed(s, raw);
+	return s->stop;
+}
+
+/* Write in[0..n) to wfd, closing it when done, while reading rfd into out
+   until EOF. Both ends of a child's stdio, so neither side can block the
+   other or outlive the deadline. */
+static int pipe_io(int wfd, const char *in, size_t n, int rfd, struct sbuf *out,
+                   const struct llm_req *r, struct sse *s)
+{
+	fcntl(wfd, F_SETFL, fcntl(wfd, F_GETFL)|O_NONBLOCK);
+	fcntl(rfd, F_SETFL, fcntl(rfd, F_GETFL)|O_NONBLOCK);
+	int rc=-1;
+	uint64_t t0=trace_t0(r->trace_id);   /* curl or HME: spawn to first byte */
+	for(;;){
+		int e=hc_expired(r);
+		if(e){ errno=e; break; }
+		struct pollfd p[2]={ { rfd, POLLIN, 0 }, { wfd, POLLOUT, 0 } };
+		int k=poll(p, wfd>=0? 2 : 1, hc_poll_ms(r));
+		if(k<0 && errno!=EINTR) break;
+		if(k<=0) continue;
+		if(wfd>=0 && p[1].revents){
+			ssize_t w=write(wfd, in, n);
+			if(w>0){ in+=w; n-=(size_t)w; }
+			else if(errno!=EAGAIN && errno!=EINTR) n=0;   /* child closed stdin */
+			if(!n){ close(wfd); wfd=-1; }
 		}
-		if(*s=='\\'){
-			++s;
-			if(!*s){ break; }
-			switch(*s){
-				case 'n': sb_putc(&b,'\n'); break;
-				case 'r': /* ignore */ break;
-				case 't': sb_putc(&b,'\t'); break;
-				case '"': sb_putc(&b,'"'); break;
-				case '\\': sb_putc(&b,'\\'); break;
-				default: sb_putc(&b,'\\'); sb_putc(&b,*s); break;
+		if(p[0].revents){
+			size_t room=reply_room(out);
+			if(!room) break;
+			ssize_t rd=read(rfd, sb_reserve(out, room), room);
+			if(rd==0){ rc=0; break; }
+			if(rd<0){ if(errno==EAGAIN || errno==EINTR) continue; break; }
+			hc_first_byte(r);
+			if(!out->len) trace_span(r->trace_id, "first byte", t0);
+			sb_commit(out, (size_t)rd);
+			if(s){
+				sse_feed(s, out);
+				if(s->stop){ errno=ECANCELED; break; }
 			}
-		}else{
-			sb_putc(&b,*s);
 		}
 	}
-	sb_free(&b);
-	return NULL;
+	int e=errno;
+	if(wfd>=0) close(wfd);
+	errno=e;
+	return rc;
 }
 
 /* ---------- HME transport: exec argv[0..] and speak JSON on stdio ---------- */
 static int call_hme(const struct llm_req *r, struct llm_resp *out){
-	char *json = build_openai_json(r);
+	struct llm_req whole=*r;
+	whole.on_delta=NULL;   /* the mediator answers in one piece */
+	uint64_t t0=trace_t0(r->trace_id);
+	char *json = build_openai_json(&whole);
+	trace_span(r->trace_id, "build_openai_json", t0);
 	int p_in[2], p_out[2];
 	if(pipe(p_in)||pipe(p_out)){ free(json); return -1; }
+	for(int k=0;k<2;k++){ set_cloexec(p_in[k]); set_cloexec(p_out[k]); }
 	pid_t pid=fork();
 	if(pid<0){ free(json); return -1; }
 	if(pid==0){
@@ -109,135 +218,241 @@ static int call_hme(const struct llm_req *r, struct llm_resp *out){
 		_exit(127);
 	}
 	close(p_in[0]); close(p_out[1]);
-	/* write full JSON to child stdin */
-	const char *wp = json; size_t wn = strlen(json);
-	while(wn){
-		ssize_t w = write(p_in[1], wp, wn);
-		if(w < 0){ if(errno==EINTR) continue; break; }
-		wp += (size_t)w; wn -= (size_t)w;
-	}
-	close(p_in[1]);
-	free(json);
-
 	struct sbuf b; sb_init(&b);
-	char tmp[4096]; ssize_t rd;
-	while((rd=read(p_out[0], tmp, sizeof tmp - 1))>0){
-		tmp[rd]=0;
-		sb_puts(&b, tmp);
-	}
+	int rc = pipe_io(p_in[1], json, strlen(json), p_out[0], &b, r, NULL);
+	int e=errno;
+	free(json);
 	close(p_out[0]);
+	if(rc<0) kill(pid, SIGKILL);
 	int status=0; waitpid(pid,&status,0);
+	if(rc<0){ sb_free(&b); return io_fail(out, e, "HME: transport failed"); }
 
 	char *resp = sb_steal(&b);
+	t0=trace_t0(r->trace_id);
 	char *content = extract_content(resp);
+	trace_span(r->trace_id, "extract_content", t0);
 	free(resp);
 	if(!content){
-		out->status=2; out->err=xstrdup("HME: bad JSON or missing content");
+		out->status=LLM_EPROTO; out->err=xstrdup("HME: bad JSON or missing content");
 		return -1;
 	}
-	out->content=content; out->status=0; out->http_status=0;
+	out->content=content; out->status=LLM_OK; out->http_status=0;
 	return 0;
 }
 
-#if defined(TLS_BACKEND_LIBTLS)
-/* --- tiny host:port extractor for api_base like "https://host[:port][/...]" --- */
-static void extract_host_port(const char *api_base, char *host, size_t hsz, char *port, size_t psz){
-	/* Default to 443 */
-	if(psz){ port[0]=0; strncat(port, "443", psz-1); }
-	if(!api_base){ if(hsz) host[0]=0; return; }
-
-	const char *p = strstr(api_base, "://");
-	const char *h = p? p+3 : api_base;
-	/* host[:port] until '/', '?' or '#' */
-	const char *end = strpbrk(h, "/?#");
-	size_t n = end? (size_t)(end - h) : strlen(h);
-
-	/* Handle [ipv6]:port */
-	if(n>0 && h[0]=='['){
-		const char *rb = memchr(h, ']', n);
-		if(rb && rb+1 < h+n && rb[1]==':'){
-			size_t hn = (size_t)(rb - (h+1));
-			if(hsz){ size_t c = (hn<hsz-1)? hn : hsz-1; memcpy(host, h+1, c); host[c]=0; }
-			const char *ps = rb+2;
-			size_t pn = (size_t)((h+n)-ps);
-			if(psz){ size_t c = (pn<psz-1)? pn : psz-1; memcpy(port, ps, c); port[c]=0; }
-			return;
+/* ------------------------- keep-alive connection pool ----------------------
+ * Idle connections keyed by "host port tls". A connection goes back only
+ * after a reply whose end was found by its framing, so the next request on
+ * it starts clean; idle ones older than HTTP_POOL_IDLE_MS are closed. */
+static struct { char key[288]; struct hconn c; uint64_t at; } pool[HTTP_POOL_MAX];
+static int npool;
+static pthread_mutex_t pool_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static int pool_get(const char *key, struct hconn *c){
+	uint64_t now=now_ms();
+	int found=0;
+	pthread_mutex_lock(&pool_mtx);
+	for(int i=npool-1;i>=0;i--){
+		if(now - pool[i].at > HTTP_POOL_IDLE_MS){
+			hc_close(&pool[i].c);
+			pool[i]=pool[--npool];
+		}else if(!found && !strcmp(pool[i].key, key)){
+			const struct llm_req *r=c->r;
+			*c=pool[i].c; c->r=r;
+			pool[i]=pool[--npool];
+			found=1;
 		}
-		/* no port given: copy inside brackets */
-		size_t hn = rb? (size_t)(rb - (h+1)) : (n>2? n-2:0);
-		if(hsz){ size_t c = (hn<hsz-1)? hn : hsz-1; memcpy(host, h+1, c); host[c]=0; }
-		return;
 	}
+	pthread_mutex_unlock(&pool_mtx);
+	return found;
+}
 
-	/* Find ':' for port if present */
-	const char *col = memchr(h, ':', n);
-	if(col){
-		size_t hn = (size_t)(col - h);
-		if(hsz){ size_t c = (hn<hsz-1)? hn : hsz-1; memcpy(host, h, c); host[c]=0; }
-		const char *ps = col+1; size_t pn = (size_t)((h+n) - ps);
-		if(psz){ size_t c = (pn<psz-1)? pn : psz-1; memcpy(port, ps, c); port[c]=0; }
-	}else{
-		/* no port */
-		if(hsz){ size_t c = (n<hsz-1)? n : hsz-1; memcpy(host, h, c); host[c]=0; }
-		/* port already "443" */
+static void pool_put(const char *key, struct hconn *c){
+	pthread_mutex_lock(&pool_mtx);
+	if(npool<HTTP_POOL_MAX){
+		snprintf(pool[npool].key, sizeof pool[npool].key, "%s", key);
+		pool[npool].c=*c; pool[npool].c.r=NULL;
+		pool[npool++].at=now_ms();
+		c=NULL;
 	}
+	pthread_mutex_unlock(&pool_mtx);
+	if(c) hc_close(c);
 }
 
-/* -------------------------- libtls HTTPS client ---------------------------- */
-static int https_post_libtls(const char *host, const char *port,
-                             const char *auth_hdr_value,
-                             const char *path, const char *payload,
-                             struct sbuf *out)
-{
-	int rc=-1;
-	struct addrinfo hints, *res=0, *rp;
-	memset(&hints,0,sizeof hints);
-	hints.ai_family=AF_UNSPEC; hints.ai_socktype=SOCK_STREAM;
-	if(getaddrinfo(host, port, &hints, &res)) return -1;
-
-	int fd=-1; for(rp=res; rp; rp=rp->ai_next){
-		fd=socket(rp->ai_family,rp->ai_socktype,rp->ai_protocol);
-		if(fd<0) continue;
-		if(connect(fd, rp->ai_addr, rp->ai_addrlen)==0) break;
-		close(fd); fd=-1;
+/* 1 once a chunked body in [p,end) has its last chunk */
+static int chunked_done(const char *p, const char *end){
+	while(p<end){
+		char *e; unsigned long n=strtoul(p,&e,16);
+		if(e==p) return 0;
+		const char *nl=strstr(e,"\r\n");
+		if(!nl) return 0;
+		if(!n) return strstr(nl,"\r\n\r\n")!=NULL;   /* optional trailers */
+		if((size_t)(end-(nl+2)) < n+2) return 0;
+		p=nl+2+n+2;
 	}
-	freeaddrinfo(res);
-	if(fd<0) return -1;
-
-	struct tls_config *cfg=tls_config_new();
-	if(!cfg){ close(fd); return -1; }
-	/* For compactness. In production, configure CA roots or pin certs. */
-	tls_config_insecure_noverifycert(cfg);
-
-	struct tls *ctx=tls_client();
-	if(!ctx){ tls_config_free(cfg); close(fd); return -1; }
-	if(tls_configure(ctx,cfg)){ tls_free(ctx); tls_config_free(cfg); close(fd); return -1; }
-	if(tls_connect_socket(ctx, fd, host)){ tls_free(ctx); tls_config_free(cfg); close(fd); return -1; }
+	return 0;
+}
 
+/* POST payload and read the raw reply (status line, headers, body). The
+   reply ends by Content-Length, chunked framing or EOF; a connection whose
+   reply ended by framing is pooled for the next request. */
+static int http_post(const struct llm_req *r, const char *host, const char *port, int use_tls,
+                     const char *auth_hdr_value, const char *path, const char *payload,
+                     struct sbuf *out, struct sse *s)
+{
+	char key[288];
+	snprintf(key, sizeof key, "%s %s %d", host, port, use_tls);
 	struct sbuf req; sb_init(&req);
 	sb_printf(&req,
-"POST %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n"
-"Content-Type: application/json\r\nAccept: application/json\r\nAccept-Encoding: identity\r\n"
-"Authorization: %s\r\nContent-Length: %zu\r\n\r\n",
-	          path, host, auth_hdr_value?auth_hdr_value:"", strlen(payload));
+"POST %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n"
+"Content-Type: application/json\r\nAccept: %s\r\nAccept-Encoding: identity\r\n",
+	          path, *port? host : "localhost", s? "text/event-stream" : "application/json");
+	if(auth_hdr_value) sb_printf(&req, "Authorization: %s\r\n", auth_hdr_value);
+	sb_printf(&req, "Content-Length: %zu\r\n\r\n", strlen(payload));
 	sb_puts(&req, payload);
+	uint64_t t0=0;
 
+	struct hconn c;
+	c.r=r;
+	int rc=-1, reused=pool_get(key, &c);
+	if(!reused && hc_connect(&c, host, port, use_tls, NULL)<0) goto out;
+again:;
 	size_t off=0; while(off<req.len){
-		ssize_t w=tls_write(ctx, req.s+off, req.len-off);
-		if(w<0){ goto out; } off+=(size_t)w;
+		ssize_t w=hc_io(&c, req.s+off, req.len-off, 1);
+		if(w<=0) break;
+		off+=(size_t)w;
 	}
-	char buf[4096]; ssize_t rdsz;
-	while((rdsz=tls_read(ctx, buf, sizeof buf - 1))>0){
-		buf[rdsz]=0;
-		sb_puts(out, buf);
+	t0=trace_t0(r->trace_id);
+	ssize_t rdsz=-1;
+	size_t hdr=0, body=0, room;   /* start of the final header block / of the body */
+	long long clen=-1;
+	int chunked=0, keep=0;
+	if(off==req.len) while((rdsz = (room=reply_room(out))? hc_io(&c, sb_reserve(out, room), room, 0) : -1)>0){
+		hc_first_byte(r);
+		if(!out->len) trace_span(r->trace_id, "first byte", t0);
+		sb_commit(out, (size_t)rdsz);
+		if(!body && (body=reply_body(out, &hdr))){
+			const char *h=out->s+hdr, *v;
+			if((v=http_header(h, "Content-Length"))) clen=strtoll(v, NULL, 10);
+			if((v=http_header(h, "Transfer-Encoding"))) chunked=!strncasecmp(v, "chunked", 7);
+			v=http_header(h, "Connection");
+			keep = !(v && !strncasecmp(v, "close", 5)) && !strncmp(h, "HTTP/1.1", 8);
+			/* a declared length: refuse it now if too long, else make room
+			   for all of it at once */
+			if(!chunked && clen>=0){
+				unsigned long long end=body+(unsigned long long)clen;
+				if(end > MAX_RESP_BODY){ errno=EFBIG; rdsz=-1; break; }
+				if(end > out->len) sb_reserve(out, (size_t)end-out->len);
+			}
+		}
+		if(s){
+			sse_feed(s, out);
+			if(s->stop){ errno=ECANCELED; rdsz=-1; break; }
+		}
+		if(body && chunked && chunked_done(out->s+body, out->s+out->len)) break;
+		if(body && !chunked && clen>=0 && out->len-body >= (size_t)clen) break;
 	}
-	rc=0;
-out:
+	if(reused && !out->len && rdsz<=0 && hc_expired(r)==0){
+		/* the server closed the idle connection first: redo on a new one */
+		hc_close(&c);
+		reused=0;
+		if(hc_connect(&c, host, port, use_tls, NULL)<0) goto out;
+		goto again;
+	}
+	if(rdsz==0 || (rdsz>0 && body)) rc=0;
+	if(rc==0 && rdsz>0 && keep && (chunked || clen>=0)){
+		pool_put(key, &c);
+		c.fd=-1;
+#if defined(TLS_BACKEND_LIBTLS)
+		c.tls=NULL; c.cfg=NULL;
+#endif
+	}
+out:;
+	int e=errno;
 	sb_free(&req);
-	tls_close(ctx); tls_free(ctx); tls_config_free(cfg); close(fd);
+	hc_close(&c);
+	errno=e;
 	return rc;
 }
-#endif /* TLS_BACKEND_LIBTLS */
+
+/* Retry-After as delta-seconds or an IMF-fixdate, in ms from now; 0 if
+   absent, unparseable or past. Capped at a day. */
+static int retry_after_ms(const char *v){
+	static const char mon[]="JanFebMarAprMayJunJulAugSepOctNovDec";
+	long long ms;
+	if(!v) return 0;
+	if(*v>='0' && *v<='9') ms=strtoll(v,NULL,10)*1000;
+	else{
+		/* "Sun, 06 Nov 1994 08:49:37 GMT"; days_from_civil() by H. Hinnant */
+		int d,y,H,M,S; char m[4];
+		if(sscanf(v,"%*3s, %d %3s %d %d:%d:%d",&d,m,&y,&H,&M,&S)!=6) return 0;
+		const char *mp=strstr(mon,m);
+		if(!mp || (mp-mon)%3) return 0;
+		int mo=(int)(mp-mon)/3+1, yy=y-(mo<=2);
+		int era=(yy>=0? yy : yy-399)/400;
+		unsigned yoe=(unsigned)(yy-era*400);
+		unsigned doy=(unsigned)((153*(mo>2? mo-3 : mo+9)+2)/5+d-1);
+		unsigned doe=yoe*365+yoe/4-yoe/100+doy;
+		long long t=((long long)era*146097+doe-719468)*86400+H*3600+M*60+S;
+		ms=t*1000-(long long)now_ms();
+	}
+	return ms<=0? 0 : ms>86400000? 86400000 : (int)ms;
+}
+
+/* undo Transfer-Encoding: chunked in place; body runs to end */
+static void dechunk(char *body, const char *end){
+	char *w=body, *p=body;
+	while(p<end){
+		char *e; unsigned long n=strtoul(p,&e,16);
+		if(e==p || !n) break;
+		if(!(p=strstr(e,"\r\n"))) break;
+		p+=2;
+		if(n > (size_t)(end-p)) n=(size_t)(end-p);
+		memmove(w,p,n); w+=n; p+=n;
+		if(p+1<end && p[0]=='\r' && p[1]=='\n') p+=2;
+	}
+	*w=0;
+}
+
+/* Parse a raw HTTP/1.x or (from curl) HTTP/2 reply into out.
+   Interim 1xx replies (curl may see "100 Continue") are skipped. curl
+   has already undone chunked framing (decoded); a streamed reply's
+   content is what s collected. */
+static int http_reply(struct sbuf *raw, struct llm_resp *out, int decoded, struct sse *s){
+	char *h=raw->s, *eoh=NULL;
+	while(h && status_code(h)>0){
+		out->http_status=status_code(h);
+		if(!(eoh=strstr(h,"\r\n\r\n"))) break;
+		if(out->http_status>=200) break;
+		h=eoh+4; eoh=NULL;
+	}
+	if(!eoh){ out->status=LLM_EPROTO; out->err=xstrdup("malformed HTTP reply"); return -1; }
+	*eoh=0;
+	char *body=eoh+4;
+	const char *te=http_header(h, "Transfer-Encoding");
+	if(!decoded && te && !strncasecmp(te,"chunked",7)) dechunk(body, raw->s+raw->len);
+	int st=out->http_status;
+	if(st<200 || st>299){
+		out->status = st==429? LLM_ETHROTTLED : st>=500? LLM_EUPSTREAM : LLM_EREJECTED;
+		out->retry_after_ms = retry_after_ms(http_header(h, "Retry-After"));
+		struct sbuf m; sb_init(&m);
+		sb_printf(&m, "upstream HTTP %d", st);
+		out->err=sb_steal(&m);
+		return -1;
+	}
+	if(s && s->on){
+		if(!s->done && !s->text.len){
+			out->status=LLM_EPROTO; out->err=xstrdup("event stream ended without content");
+			return -1;
+		}
+		out->content = s->text.s? sb_steal(&s->text) : xstrdup("");
+	}else if(!(out->content=extract_content(body))){
+		out->status=LLM_EPROTO; out->err=xstrdup("bad JSON or missing content");
+		return -1;
+	}
+	out->status=LLM_OK;
+	return 0;
+}
 
 /* Build full URL for curl fallback.
    If api_base ends with "/v1" or "/v1/", append "/chat/completions".
@@ -265,101 +480,130 @@ int llm_openai_complete(const struct llm_req *r, struct llm_resp *out){
 	}
 
 	if(r->no_network){
-		out->status=1; out->err=xstrdup("no-network: OpenAI backend disabled");
+		out->status=LLM_ETRANSPORT; out->err=xstrdup("no-network: OpenAI backend disabled");
 		return -1;
 	}
-	if(!r->api_base || !r->api_key){
-		out->status=1; out->err=xstrdup("api_base/api_key missing"); return -1;
+	/* a local server (unix socket, loopback) may go without a key */
+	int local = url_is_local(r->api_base);
+	if(!r->api_base || (!r->api_key && !local)){
+		out->status=LLM_ETRANSPORT; out->err=xstrdup("api_base/api_key missing"); return -1;
 	}
 
+	uint64_t t0=trace_t0(r->trace_id);
 	char *json = build_openai_json(r);
+	trace_span(r->trace_id, "build_openai_json", t0);
 
 	/* Prepare pieces common to both transports */
 	struct sbuf auth; sb_init(&auth);
-	sb_puts(&auth, "Bearer ");
-	sb_puts(&auth, r->api_key);
+	if(r->api_key){ sb_puts(&auth, "Bearer "); sb_puts(&auth, r->api_key); }
 
 	int rc=-1;
 
+	/* plain http:// and unix:// are spoken natively; https:// needs libtls,
+	   else curl(1) */
 #if defined(TLS_BACKEND_LIBTLS)
-	/* libtls path builds a raw HTTP/1.1 request and reads HTTP response */
-	char host[256], port[16];
-	extract_host_port(r->api_base, host, sizeof host, port, sizeof port);
-
-	const char *path = "/v1/chat/completions";
-	struct sbuf resp; sb_init(&resp);
-
-	rc = https_post_libtls(host, port, auth.s, path, json, &resp);
-
-	/* split headers/body (HTTP/1.1) */
-	if(rc==0){
-		char *p = strstr(resp.s, "\r\n\r\n");
-		const char *body = p? p+4 : resp.s;
-		char *content = extract_content(body);
-		if(!content){ out->status=2; out->err=xstrdup("bad JSON or missing content"); sb_free(&resp); sb_free(&auth); free(json); return -1; }
-		out->content = content; out->status=0; out->http_status=200;
+	int native=1;
+#else
+	int native=local || !strncmp(r->api_base, "http://", 7);
+#endif
+	struct sse sse, *s=NULL;
+	if(r->on_delta){
+		memset(&sse, 0, sizeof sse);
+		sse.r=r; sse.decoded=!native;
+		s=&sse;
+	}
+	if(native){
+		char host[256], port[16];
+		url_host_port(r->api_base, host, sizeof host, port, sizeof port);
+		const char *bp=strstr(r->api_base, "://");
+		bp = bp && !local? strchr(bp+3, '/') : NULL;   /* a unix:// path is the socket */
+		struct sbuf path; sb_init(&path);
+		build_full_url(bp? bp : "", &path);
+		struct sbuf resp; sb_init(&resp);
+
+		int tls=!local && strncmp(r->api_base, "http://", 7)!=0, h2=0;
+		const char *ah = auth.len? auth.s : NULL;
+		if(r->http2){
+			if(s) sse.decoded=1;   /* HTTP/2 has no chunked framing */
+			rc = h2_post(r, host, port, tls, ah, path.s, json, &resp, s? sse_more : NULL, s);
+			h2 = rc==0 || errno!=EPROTONOSUPPORT;
+			if(!h2 && s) sse.decoded=0;
+		}
+		if(!h2) rc = http_post(r, host, port, tls, ah, path.s, json, &resp, s);
+		int e=errno;
+		sb_free(&path);
+		if(rc==0){
+			t0=trace_t0(r->trace_id);
+			rc=http_reply(&resp, out, h2, s);
+			trace_span(r->trace_id, "extract_content", t0);
+		}
 		sb_free(&resp);
+		if(s){ sb_free(&sse.line); sb_free(&sse.text); }
+		sb_free(&auth);
+		free(json);
+		if(rc!=0 && !out->status) return io_fail(out, e, "HTTP request failed");
+		return rc;
 	}
-#else
 	/* Fallback via execvp("curl") with fixed argv (no shell) */
 	struct sbuf url; sb_init(&url);
 	build_full_url(r->api_base, &url);
+	/* curl enforces the deadline itself too, so it can report what stalled */
+	char tmo[32]="0";
+	if(r->deadline_us){
+		uint64_t now=now_us();
+		double left = now<r->deadline_us? (double)(r->deadline_us-now)/1e6 : 0.001;
+		snprintf(tmo, sizeof tmo, "%.3f", left);
+	}
 
 	int in[2], outp[2];
 	if(pipe(in)||pipe(outp)){ sb_free(&url); sb_free(&auth); free(json); return -1; }
+	for(int k=0;k<2;k++){ set_cloexec(in[k]); set_cloexec(outp[k]); }
 	pid_t pid=fork();
 	if(pid==0){
 		dup2(in[0],0); dup2(outp[1],1);
 		close(in[0]); close(in[1]); close(outp[0]); close(outp[1]);
-		char *const argv_curl[] = {
+		char *argv_curl[] = {
 			"curl",
 			"-sS",
-			"--http1.1",
+			"-i",                 /* headers too: status and Retry-After */
+			r->http2? "--http2" : "--http1.1",
 			"-X","POST",
 			"-H","Content-Type: application/json",
-			"-H","Accept: application/json",
+			"-H", s? "Accept: text/event-stream" : "Accept: application/json",
 			"-H","Accept-Encoding: identity",
 			"-H", auth.s,         /* e.g. "Bearer sk-...." */
+			"-N",                 /* pass SSE on as it arrives */
 			"--data-binary","@-",
 			"--url", url.s,
+			"--max-time", tmo,
 			NULL
 		};
+		if(!r->deadline_us)   /* drop the trailing --max-time */
+			argv_curl[sizeof argv_curl/sizeof *argv_curl - 3]=NULL;
 		execvp("curl", argv_curl);
 		_exit(127);
 	}
 	close(in[0]); close(outp[1]);
-	/* write full JSON request to curl stdin */
-	const char *wp = json; size_t wn = strlen(json);
-	while(wn){
-		ssize_t w = write(in[1], wp, wn);
-		if(w < 0){ if(errno==EINTR) continue; break; }
-		wp += (size_t)w; wn -= (size_t)w;
-	}
-	close(in[1]);
-
 	struct sbuf resp; sb_init(&resp);
-	char tmp[4096]; ssize_t rd;
-	while((rd=read(outp[0], tmp, sizeof tmp - 1))>0){
-		tmp[rd]=0;
-		sb_puts(&resp, tmp);
-	}
+	int iorc = pipe_io(in[1], json, strlen(json), outp[0], &resp, r, s);
+	int e = iorc<0? errno : 0;
 	close(outp[0]);
+	if(iorc<0) kill(pid, SIGKILL);
 	int status=0; waitpid(pid,&status,0);
-	rc= (WIFEXITED(status) && WEXITSTATUS(status)==0)? 0 : -1;
+	rc= (iorc==0 && WIFEXITED(status) && WEXITSTATUS(status)==0)? 0 : -1;
+	if(WIFEXITED(status) && WEXITSTATUS(status)==28) e=ETIMEDOUT;   /* curl: timeout */
 
 	if(rc==0){
-		/* curl returns body only (no headers) */
-		char *content = extract_content(resp.s);
-		if(!content){ out->status=2; out->err=xstrdup("bad JSON or missing content"); sb_free(&resp); sb_free(&url); sb_free(&auth); free(json); return -1; }
-		out->content = content; out->status=0; out->http_status=200;
+		t0=trace_t0(r->trace_id);
+		rc=http_reply(&resp, out, 1, s);
+		trace_span(r->trace_id, "extract_content", t0);
 	}
 	sb_free(&resp);
+	if(s){ sb_free(&sse.line); sb_free(&sse.text); }
 	sb_free(&url);
-#endif
-
 	sb_free(&auth);
 	free(json);
 
-	if(rc!=0){ out->status=1; out->err=xstrdup("HTTPS request failed"); return -1; }
-	return 0;
+	if(rc!=0 && !out->status) return io_fail(out, e, "HTTPS request failed");
+	return rc;
 }
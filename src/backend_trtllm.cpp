@@ -0,0 +1,134 @@
+//=============================================================================
+// src/backend_trtllm.cpp  —  TensorRT-LLM backend (HAVE_TRTLLM=1)
+//
+// The engine, SentencePiece model and chat template load once, on the first
+// call. Prompts come from trt_prompt.cpp: llm_req.msgs rendered through the
+// model's template and tokenized there, earlier turns from its cache.
+// Build only when HAVE_TRTLLM=1 with proper includes/libs.
+// License: BSD3
+//=============================================================================
+#include "../include/llm_backend.h"
+#include "trt_prompt.h"
+extern "C" {
+#include "util.h"
+#include "json.h"
+}
+#include <tensorrt_llm/executor/executor.h>
+#include <sentencepiece_processor.h>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+namespace tle = tensorrt_llm::executor;
+namespace fs = std::filesystem;
+
+#define TRT_DEF_MAX_TOKENS 512   /* when llm_req.max_tokens is 0 */
+#define TRT_POLL_MS        100   /* cancel/deadline checks while waiting */
+
+static std::once_flag g_once;
+static tle::Executor *g_exec;
+static sentencepiece::SentencePieceProcessor g_sp;
+static struct trt_prompt *g_prompt;
+static int g_eos=-1, g_pad=-1;
+static std::string g_err;
+
+/* "key": 2 or "key": [2, ...] (generation_config lists several eos ids) */
+static int json_int(const char *cfg, const char *key){
+	const char *v=json_member(cfg, key);
+	if(v && *v=='['){ v++; while(*v==' '||*v=='\n'||*v=='\t'||*v=='\r') v++; }
+	return v && *v>='0' && *v<='9'? atoi(v) : -1;
+}
+
+static int sp_encode(void *arg, const char *text, size_t n, struct trt_ids *out){
+	std::vector<int> ids;
+	if(!static_cast<sentencepiece::SentencePieceProcessor*>(arg)->Encode(std::string(text, n), &ids).ok()) return -1;
+	for(int id: ids) trt_ids_push(out, id);
+	return 0;
+}
+
+static void load(const char *path){
+	fs::path dir(path? path : "engine");
+	if(fs::is_directory(dir/"1")) dir/="1";   /* Triton model repository layout */
+	if(!fs::exists(dir)){ g_err="engine path not found: "+dir.string(); return; }
+
+	char *cfg=read_file((dir/"generation_config.json").c_str(), NULL);
+	if(!cfg) cfg=read_file((dir/"config.json").c_str(), NULL);
+	if(cfg){ g_eos=json_int(cfg, "eos_token_id"); g_pad=json_int(cfg, "pad_token_id"); free(cfg); }
+
+	fs::path sp=dir/"tokenizer.model";
+	if(!fs::exists(sp)) sp=dir.parent_path()/"tokenizer.model";
+	if(!g_sp.Load(sp.string()).ok()){ g_err="cannot load tokenizer: "+sp.string(); return; }
+	g_prompt=trt_prompt_new(dir.c_str(), sp_encode, &g_sp);
+
+	try {
+		tle::ExecutorConfig ec;   /* in-flight batching by default */
+		std::vector<tle::SizeType32> ranks;
+		for(auto &f: fs::directory_iterator(dir))
+			if(f.path().extension()==".engine") ranks.push_back((tle::SizeType32)ranks.size());
+		if(ranks.size()>1){       /* one shard per GPU; run under mpirun -n <ranks> */
+			tle::ParallelConfig pc;
+			pc.setDeviceIds(ranks);
+			pc.setParticipantIds(ranks);
+			ec.setParallelConfig(pc);
+		}
+		g_exec=new tle::Executor(dir, tle::ModelType::kDECODER_ONLY, ec);
+	} catch(const std::exception &e){
+		g_err=std::string("TRT-LLM engine initialization failed: ")+e.what();
+	}
+}
+
+static int fail(struct llm_resp *out, int status, const std::string &msg){
+	out->status=status; out->err=xstrdup(msg.c_str());
+	return -1;
+}
+
+extern "C" int llm_trtllm_complete(const struct llm_req *r, struct llm_resp *out){
+	memset(out, 0, sizeof *out);
+	std::call_once(g_once, load, r->trt_engine_path);
+	if(!g_exec) return fail(out, LLM_EBACKEND, g_err);
+
+	struct trt_ids in={NULL, 0, 0};
+	if(trt_prompt_ids(g_prompt, r->msgs, r->nmsgs, &in, NULL)<0 || !in.n){
+		trt_ids_free(&in);
+		return fail(out, LLM_EBACKEND, "cannot tokenize prompt");
+	}
+	tle::VecTokens ids(in.v, in.v+in.n);
+	trt_ids_free(&in);
+
+	tle::SamplingConfig sc;
+	if(r->temperature>0) sc.setTemperature((float)r->temperature);
+	else sc.setTopK(1);   /* temperature 0: greedy */
+	tle::OutputConfig oc;
+	oc.excludeInputFromOutput=true;
+	std::optional<tle::TokenIdType> end, pad;
+	if(g_eos>=0) end=g_eos;
+	if(g_pad>=0) pad=g_pad;
+
+	try {
+		tle::Request req(ids, r->max_tokens>0? r->max_tokens : TRT_DEF_MAX_TOKENS, false, sc, oc, end, pad);
+		tle::IdType id=g_exec->enqueueRequest(req);
+		for(;;){
+			if(r->cancel && *r->cancel){ g_exec->cancelRequest(id); return fail(out, LLM_ECANCELED, "cancelled"); }
+			if(r->deadline_us && now_us()>=r->deadline_us){ g_exec->cancelRequest(id); return fail(out, LLM_ETIMEOUT, "deadline exceeded"); }
+			std::vector<tle::Response> rs=g_exec->awaitResponses(id, std::chrono::milliseconds(TRT_POLL_MS));
+			if(rs.empty()) continue;
+			if(rs.front().hasError()) return fail(out, LLM_EBACKEND, rs.front().getErrorMsg());
+			const tle::Result &res=rs.front().getResult();
+			if(!res.isFinal) continue;
+			std::vector<int> toks;
+			if(!res.outputTokenIds.empty()) toks.assign(res.outputTokenIds[0].begin(), res.outputTokenIds[0].end());
+			if(!toks.empty() && toks.back()==g_eos) toks.pop_back();
+			std::string text;
+			if(!g_sp.Decode(toks, &text).ok()) return fail(out, LLM_EBACKEND, "cannot decode output");
+			out->content=xstrdup(text.c_str());
+			return 0;
+		}
+	} catch(const std::exception &e){
+		return fail(out, LLM_EBACKEND, std::string("TRT-LLM generation failed: ")+e.what());
+	}
+}
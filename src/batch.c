@@ -0,0 +1,265 @@
+/*==============================================================================
+ * src/batch.c  —  offline completions over JSONL (--batch)
+ *
+ * The main thread streams request lines into a bounded queue; --concurrency
+ * workers take them, call the backend (through the replica set, so pooled
+ * connections, retries and hedging all apply) and append one result line
+ * each, in completion order. Every result line is flushed as it is written,
+ * so the output file is its own checkpoint: on restart, ids that already
+ * have a status 0 line are skipped.
+ *
+ * Input:  {"id":..., "messages":[{"role":..,"content":..},...]}
+ *     or  {"id":..., "prompt":"...", "system":"..."}
+ *         optional "model", "temperature", "max_tokens"; a missing id
+ *         becomes the line number.
+ * Output: {"id":..., "status":N, "http_status":N, "latency_ms":N,
+ *          "content":"..." | "error":"..."}
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "batch.h"
+#include "json.h"
+#include "../config.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct job { char *line, *id; };
+
+struct batch {
+	const struct server_cfg *cfg;
+	llm_fn fn;
+	FILE *in, *out;
+	int conc;
+
+	/* ids with a successful line in the output already */
+	char **done; size_t ndone, cap;
+
+	pthread_mutex_t mtx;
+	pthread_cond_t not_empty, not_full;
+	struct job *q; int qcap, qhead, qlen, eof;
+
+	pthread_mutex_t out_mtx;
+	unsigned long nok, nfail, nskip;
+};
+
+/* ------------------------------- id set ---------------------------------- */
+static uint32_t hash_id(const char *s){
+	uint32_t h=2166136261u;
+	while(*s){ h^=(unsigned char)*s++; h*=16777619u; }
+	return h;
+}
+
+static int done_has(const struct batch *b, const char *id){
+	if(!b->cap) return 0;
+	for(size_t i=hash_id(id)&(b->cap-1); b->done[i]; i=(i+1)&(b->cap-1))
+		if(!strcmp(b->done[i], id)) return 1;
+	return 0;
+}
+
+static void done_add(struct batch *b, char *id){
+	if(done_has(b, id)){ free(id); return; }
+	if((b->ndone+1)*2 > b->cap){
+		size_t ncap = b->cap? b->cap*2 : 1024;
+		char **nd = xmalloc(ncap*sizeof *nd);
+		memset(nd, 0, ncap*sizeof *nd);
+		for(size_t i=0;i<b->cap;i++) if(b->done[i]){
+			size_t j=hash_id(b->done[i])&(ncap-1);
+			while(nd[j]) j=(j+1)&(ncap-1);
+			nd[j]=b->done[i];
+		}
+		free(b->done);
+		b->done=nd; b->cap=ncap;
+	}
+	size_t j=hash_id(id)&(b->cap-1);
+	while(b->done[j]) j=(j+1)&(b->cap-1);
+	b->done[j]=id;
+	b->ndone++;
+}
+
+/* raw JSON text of the line's id, or its line number */
+static char *line_id(const char *line, unsigned long lineno){
+	const char *v=json_member(line, "id"), *e=v? json_skip(v) : NULL;
+	if(e){
+		char *id=xmalloc((size_t)(e-v)+1);
+		memcpy(id, v, (size_t)(e-v)); id[e-v]=0;
+		return id;
+	}
+	struct sbuf s; sb_init(&s);
+	sb_printf(&s, "%lu", lineno);
+	return sb_steal(&s);
+}
+
+/* ------------------------------ checkpoint ------------------------------- */
+static void load_checkpoint(struct batch *b, const char *path){
+	FILE *f=fopen(path, "r");
+	if(!f) return;
+	char *line=NULL; size_t cap=0; ssize_t n;
+	int last_nl=1;
+	while((n=getline(&line, &cap, f))>0){
+		last_nl = line[n-1]=='\n';
+		if(!last_nl) break;   /* torn last line from a killed run */
+		const char *st=json_member(line, "status"), *v=json_member(line, "id"), *e;
+		if(st && *st=='0' && v && (e=json_skip(v))){
+			char *id=xmalloc((size_t)(e-v)+1);
+			memcpy(id, v, (size_t)(e-v)); id[e-v]=0;
+			done_add(b, id);
+		}
+	}
+	free(line);
+	fclose(f);
+	if(!last_nl) warnx("batch: %s ends in a partial line; it will be redone", path);
+}
+
+/* -------------------------------- workers -------------------------------- */
+static void emit(struct batch *b, const char *id, int rc, const struct llm_resp *resp, uint64_t us){
+	struct sbuf o; sb_init(&o);
+	sb_printf(&o, "{\"id\":%s,\"status\":%d,\"http_status\":%d,\"latency_ms\":%llu,",
+	          id, rc? (resp->status? resp->status : LLM_ETRANSPORT) : 0, resp->http_status,
+	          (unsigned long long)(us/1000));
+	if(!rc){ sb_puts(&o, "\"content\":"); json_escape_into(&o, resp->content); }
+	else{ sb_puts(&o, "\"error\":"); json_escape_into(&o, resp->err? resp->err : "backend error"); }
+	sb_puts(&o, "}\n");
+	pthread_mutex_lock(&b->out_mtx);
+	fwrite(o.s, 1, o.len, b->out);
+	fflush(b->out);
+	if(rc) b->nfail++; else b->nok++;
+	pthread_mutex_unlock(&b->out_mtx);
+	sb_free(&o);
+}
+
+static void run_job(struct batch *b, struct job *j){
+	const struct server_cfg *cfg=b->cfg;
+	struct llm_msg *msgs=NULL;
+	int nmsgs=json_messages(j->line, &msgs);
+	const char *v;
+	if(!nmsgs && (v=json_member(j->line, "prompt"))){
+		char *sys=json_string(json_member(j->line, "system"));
+		msgs=xrealloc(msgs, 2*sizeof *msgs);
+		if(sys) msgs[nmsgs++]=(struct llm_msg){ xstrdup("system"), sys };
+		msgs[nmsgs++]=(struct llm_msg){ xstrdup("user"), json_string(v) };
+	}
+	struct llm_resp resp; memset(&resp, 0, sizeof resp);
+	int rc=-1;
+	uint64_t t0=now_us();
+	if(!nmsgs || !msgs[nmsgs-1].content){
+		resp.status=LLM_EREJECTED;
+		resp.err=xstrdup("line has no messages or prompt");
+	}else{
+		char *model=json_string(json_member(j->line, "model"));
+		const char *t=json_member(j->line, "temperature"), *mt=json_member(j->line, "max_tokens");
+		struct llm_req req = {
+			.msgs = msgs, .nmsgs = nmsgs,
+			.model = model? model : cfg->model,
+			.temperature = t? atof(t) : cfg->temperature,
+			.max_tokens = mt? atoi(mt) : cfg->max_tokens,
+			.api_base = cfg->api_base, .api_key = cfg->api_key,
+			.no_network = cfg->no_network, .http2 = cfg->http2, .hme_argv = cfg->hme_argv, .hme_argc = cfg->hme_argc,
+			.trt_engine_path = cfg->trt_engine,
+			.deadline_us = cfg->timeout_sec>0? t0 + (uint64_t)cfg->timeout_sec*1000000 : 0
+		};
+		rc = cfg->ups ? upstream_complete(cfg->ups, b->fn, &req, &resp)
+		              : b->fn(&req, &resp);
+		if(rc==0 && resp.status) rc=-1;
+		free(model);
+	}
+	emit(b, j->id, rc, &resp, now_us()-t0);
+	free(resp.content); free(resp.err);
+	for(int i=0;i<nmsgs;i++){ free((void*)msgs[i].role); free((void*)msgs[i].content); }
+	free(msgs);
+}
+
+static void *worker(void *arg){
+	struct batch *b=arg;
+	for(;;){
+		pthread_mutex_lock(&b->mtx);
+		while(!b->qlen && !b->eof) pthread_cond_wait(&b->not_empty, &b->mtx);
+		if(!b->qlen){ pthread_mutex_unlock(&b->mtx); return NULL; }
+		struct job j=b->q[b->qhead];
+		b->qhead=(b->qhead+1)%b->qcap; b->qlen--;
+		pthread_cond_signal(&b->not_full);
+		pthread_mutex_unlock(&b->mtx);
+		run_job(b, &j);
+		free(j.line); free(j.id);
+	}
+}
+
+/* --------------------------------- API ----------------------------------- */
+struct batch *batch_open(const struct server_cfg *cfg, llm_fn fn,
+                         const char *in, const char *out, int conc)
+{
+	struct batch *b=xmalloc(sizeof *b);
+	memset(b, 0, sizeof *b);
+	b->cfg=cfg; b->fn=fn;
+	b->conc = conc>0? conc : 1;
+	if(!strcmp(in, "-")) b->in=stdin;
+	else if(!(b->in=fopen(in, "r"))){ free(b); return NULL; }
+	if(!out || !strcmp(out, "-")) b->out=stdout;
+	else{
+		load_checkpoint(b, out);
+		if(!(b->out=fopen(out, "a+"))){ batch_free(b); return NULL; }
+		/* start on a fresh line after a torn one */
+		if(fseek(b->out, -1, SEEK_END)==0 && fgetc(b->out)!='\n') fputc('\n', b->out);
+		fseek(b->out, 0, SEEK_END);
+	}
+	b->qcap=2*b->conc;
+	b->q=xmalloc((size_t)b->qcap*sizeof *b->q);
+	pthread_mutex_init(&b->mtx, NULL);
+	pthread_mutex_init(&b->out_mtx, NULL);
+	pthread_cond_init(&b->not_empty, NULL);
+	pthread_cond_init(&b->not_full, NULL);
+	return b;
+}
+
+int batch_run(struct batch *b){
+	pthread_t *th=xmalloc((size_t)b->conc*sizeof *th);
+	int nth=0;
+	for(int i=0;i<b->conc;i++) if(!pthread_create(&th[nth], NULL, worker, b)) nth++;
+	if(!nth) die("batch: cannot start workers");
+
+	uint64_t t0=now_us();
+	char *line=NULL; size_t cap=0; ssize_t n;
+	unsigned long lineno=0;
+	while((n=getline(&line, &cap, b->in))>0){
+		lineno++;
+		while(n && (line[n-1]=='\n' || line[n-1]=='\r')) line[--n]=0;
+		if(!n) continue;
+		char *id=line_id(line, lineno);
+		if(done_has(b, id)){ free(id); b->nskip++; continue; }
+		pthread_mutex_lock(&b->mtx);
+		while(b->qlen==b->qcap) pthread_cond_wait(&b->not_full, &b->mtx);
+		b->q[(b->qhead+b->qlen)%b->qcap]=(struct job){ xstrdup(line), id };
+		b->qlen++;
+		pthread_cond_signal(&b->not_empty);
+		pthread_mutex_unlock(&b->mtx);
+	}
+	free(line);
+	pthread_mutex_lock(&b->mtx);
+	b->eof=1;
+	pthread_cond_broadcast(&b->not_empty);
+	pthread_mutex_unlock(&b->mtx);
+	for(int i=0;i<nth;i++) pthread_join(th[i], NULL);
+	free(th);
+
+	double s=(double)(now_us()-t0)/1e6;
+	warnx("batch: %lu ok, %lu failed, %lu skipped in %.1fs (%.1f req/s)",
+	      b->nok, b->nfail, b->nskip, s, s>0? (double)(b->nok+b->nfail)/s : 0.0);
+	return b->nfail? 1 : 0;
+}
+
+void batch_free(struct batch *b){
+	if(!b) return;
+	if(b->in && b->in!=stdin) fclose(b->in);
+	if(b->out && b->out!=stdout) fclose(b->out);
+	for(size_t i=0;i<b->cap;i++) free(b->done[i]);
+	free(b->done);
+	if(b->q){
+		pthread_mutex_destroy(&b->mtx);
+		pthread_mutex_destroy(&b->out_mtx);
+		pthread_cond_destroy(&b->not_empty);
+		pthread_cond_destroy(&b->not_full);
+	}
+	free(b->q);
+	free(b);
+}
@@ -0,0 +1,19 @@
+/*==============================================================================
+ * src/batch.h  —  offline JSONL completion runs
+ * License: BSD3
+ *============================================================================*/
+#ifndef BATCH_H
+#define BATCH_H
+#include "httpd.h"
+
+struct batch;
+
+/* Open the input ("-" = stdin) and output ("-" or NULL = stdout) and load
+   the ids already completed in the output. Call before the sandbox. */
+struct batch *batch_open(const struct server_cfg *cfg, llm_fn fn,
+                         const char *in, const char *out, int conc);
+/* Run every pending line with conc requests in flight; 1 if any failed. */
+int  batch_run(struct batch *b);
+void batch_free(struct batch *b);
+
+#endif
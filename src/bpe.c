@@ -0,0 +1,213 @@
+/*==============================================================================
+ * src/bpe.c  —  tiktoken-compatible BPE token counter
+ *
+ * The vocabulary is one flat open-addressed table of 16-byte entries plus a
+ * byte arena holding the token strings, so a merge lookup touches one cache
+ * line in the common case. Text is split with a hand-written approximation
+ * of the cl100k/o200k pre-tokenizer (non-ASCII bytes count as letters) and
+ * each piece is merged lowest-rank-first like tiktoken. Counts are exact for
+ * ASCII text and close for the rest, which is what a context budget needs.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "bpe.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BPE_MAX_PIECE  256     /* longer pieces are merged in slices */
+#define BPE_MSG_FRAME  3       /* tokens of framing per chat message */
+#define BPE_CACHE      4096    /* per-message count cache, power of two */
+
+struct ent { uint32_t h, rank, off, len; };
+
+struct bpe {
+	struct ent *tab; uint32_t mask;
+	char *arena;
+};
+
+static uint32_t hash32(const unsigned char *p, size_t n){
+	uint32_t h=2166136261u;
+	while(n--){ h^=*p++; h*=16777619u; }
+	return h? h : 1;   /* 0 marks an empty slot */
+}
+
+static int b64v(int c){
+	if(c>='A'&&c<='Z') return c-'A';
+	if(c>='a'&&c<='z') return c-'a'+26;
+	if(c>='0'&&c<='9') return c-'0'+52;
+	if(c=='+') return 62;
+	if(c=='/') return 63;
+	return -1;
+}
+static size_t b64dec(const char *s, size_t n, unsigned char *out){
+	size_t o=0; uint32_t acc=0; int bits=0;
+	for(size_t i=0;i<n;i++){
+		int v=b64v((unsigned char)s[i]);
+		if(v<0) continue;
+		acc=(acc<<6)|(uint32_t)v; bits+=6;
+		if(bits>=8){ bits-=8; out[o++]=(unsigned char)(acc>>bits); }
+	}
+	return o;
+}
+
+static uint32_t lookup(const struct bpe *b, const unsigned char *p, size_t n){
+	uint32_t h=hash32(p,n);
+	for(uint32_t i=h&b->mask;; i=(i+1)&b->mask){
+		const struct ent *e=&b->tab[i];
+		if(!e->h) return UINT32_MAX;
+		if(e->h==h && e->len==n && !memcmp(b->arena+e->off, p, n)) return e->rank;
+	}
+}
+
+struct bpe *bpe_load(const char *path){
+	size_t len=0;
+	char *txt=read_file(path, &len);
+	if(!txt) return NULL;
+	size_t lines=0;
+	for(size_t i=0;i<len;i++) if(txt[i]=='\n') lines++;
+
+	struct bpe *b=xmalloc(sizeof *b);
+	uint32_t cap=1024; while(cap < lines*2+2) cap<<=1;
+	b->mask=cap-1;
+	b->tab=xmalloc(cap*sizeof *b->tab); memset(b->tab,0,cap*sizeof *b->tab);
+	b->arena=xmalloc(len+1);   /* decoded tokens are shorter than their base64 */
+	size_t aoff=0, ntok=0;
+
+	for(char *p=txt; p<txt+len; ){
+		char *nl=memchr(p,'\n',(size_t)(txt+len-p)); if(!nl) nl=txt+len;
+		char *sp=memchr(p,' ',(size_t)(nl-p));
+		if(sp){
+			unsigned char *dst=(unsigned char*)b->arena+aoff;
+			size_t n=b64dec(p,(size_t)(sp-p),dst);
+			uint32_t rank=(uint32_t)strtoul(sp+1,NULL,10);
+			uint32_t h=hash32(dst,n), i=h&b->mask;
+			while(b->tab[i].h) i=(i+1)&b->mask;
+			b->tab[i]=(struct ent){ h, rank, (uint32_t)aoff, (uint32_t)n };
+			aoff+=n; ntok++;
+		}
+		p=nl+1;
+	}
+	free(txt);
+	if(!ntok){ bpe_free(b); return NULL; }
+	return b;
+}
+
+void bpe_free(struct bpe *b){
+	if(!b) return;
+	free(b->tab); free(b->arena); free(b);
+}
+
+/* ------------------------------- merging --------------------------------- */
+static size_t merge_count(const struct bpe *b, const unsigned char *p, size_t n){
+	if(lookup(b,p,n)!=UINT32_MAX) return 1;
+	/* parts[i] = start of i-th part; rank[i] = rank of parts i,i+1 merged */
+	uint32_t start[BPE_MAX_PIECE+1], rank[BPE_MAX_PIECE];
+	size_t np=n;
+	for(size_t i=0;i<=n;i++) start[i]=(uint32_t)i;
+	for(size_t i=0;i+1<np;i++) rank[i]=lookup(b, p+start[i], start[i+2]-start[i]);
+	while(np>1){
+		size_t best=0; uint32_t br=UINT32_MAX;
+		for(size_t i=0;i+1<np;i++) if(rank[i]<br){ br=rank[i]; best=i; }
+		if(br==UINT32_MAX) break;
+		/* merge parts best and best+1 */
+		memmove(&start[best+1], &start[best+2], (np-best-1)*sizeof *start);
+		memmove(&rank[best+1], &rank[best+2], (np>best+3? np-best-3 : 0)*sizeof *rank);
+		np--;
+		if(best+1<np) rank[best]=lookup(b, p+start[best], start[best+2]-start[best]);
+		if(best>0)    rank[best-1]=lookup(b, p+start[best-1], start[best+1]-start[best-1]);
+	}
+	return np;
+}
+
+/* --------------------------- pre-tokenization ---------------------------- */
+enum { C_OTHER, C_LETTER, C_DIGIT, C_SPACE, C_NL };
+static int cls(unsigned char c){
+	if((c|32)>='a' && (c|32)<='z') return C_LETTER;
+	if(c>=0x80) return C_LETTER;
+	if(c>='0'&&c<='9') return C_DIGIT;
+	if(c=='\n'||c=='\r') return C_NL;
+	if(c==' '||c=='\t'||c=='\f'||c=='\v') return C_SPACE;
+	return C_OTHER;
+}
+
+/* length of the next pre-token at p (n>0 bytes left) */
+static size_t next_piece(const unsigned char *p, size_t n){
+	size_t i=0;
+	/* contractions: 's 't 'm 'd 're 've 'll */
+	if(p[0]=='\'' && n>1){
+		int c=p[1]|32;
+		if(c=='s'||c=='t'||c=='m'||c=='d') return 2;
+		if(n>2){
+			int d=p[2]|32;
+			if((c=='r'&&d=='e')||(c=='v'&&d=='e')||(c=='l'&&d=='l')) return 3;
+		}
+	}
+	int c0=cls(p[0]);
+	/* [^\r\n\p{L}\p{N}]?\p{L}+ */
+	if(c0==C_LETTER || ((c0==C_OTHER||c0==C_SPACE) && n>1 && cls(p[1])==C_LETTER)){
+		i = c0==C_LETTER? 0 : 1;
+		while(i<n && cls(p[i])==C_LETTER) i++;
+		return i;
+	}
+	/* \p{N}{1,3} */
+	if(c0==C_DIGIT){
+		while(i<n && i<3 && cls(p[i])==C_DIGIT) i++;
+		return i;
+	}
+	/* ' '?[^\s\p{L}\p{N}]+[\r\n]* */
+	if(c0==C_OTHER || (p[0]==' ' && n>1 && cls(p[1])==C_OTHER)){
+		i = c0==C_OTHER? 0 : 1;
+		while(i<n && cls(p[i])==C_OTHER) i++;
+		while(i<n && cls(p[i])==C_NL) i++;
+		return i;
+	}
+	/* whitespace: \s*[\r\n]+ | \s+(?!\S) | \s+ */
+	size_t last_nl=0;
+	while(i<n && (cls(p[i])==C_SPACE || cls(p[i])==C_NL)){
+		if(cls(p[i])==C_NL) last_nl=i+1;
+		i++;
+	}
+	if(last_nl) return last_nl;
+	if(i<n && i>1) return i-1;  /* leave one space for the next word */
+	return i? i : 1;
+}
+
+size_t bpe_count(const struct bpe *b, const char *s, size_t n){
+	const unsigned char *p=(const unsigned char*)s;
+	size_t total=0;
+	while(n){
+		size_t k=next_piece(p,n);
+		for(size_t off=0; off<k; off+=BPE_MAX_PIECE){
+			size_t m = k-off<BPE_MAX_PIECE? k-off : BPE_MAX_PIECE;
+			total+=merge_count(b, p+off, m);
+		}
+		p+=k; n-=k;
+	}
+	return total;
+}
+
+/* ------------------------- per-message count cache ----------------------- */
+static struct { uint32_t h, len, count; } cache[BPE_CACHE];
+static pthread_mutex_t cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+size_t bpe_count_msg(const struct bpe *b, const char *content){
+	size_t n = content? strlen(content) : 0;
+	if(!b) return BPE_MSG_FRAME + (n+3)/4;
+	uint32_t h=hash32((const unsigned char*)content, n);
+	uint32_t slot=h&(BPE_CACHE-1);
+	pthread_mutex_lock(&cache_mtx);
+	if(cache[slot].h==h && cache[slot].len==(uint32_t)n){
+		size_t c=cache[slot].count;
+		pthread_mutex_unlock(&cache_mtx);
+		return c;
+	}
+	pthread_mutex_unlock(&cache_mtx);
+	size_t c = BPE_MSG_FRAME + bpe_count(b, content, n);
+	pthread_mutex_lock(&cache_mtx);
+	cache[slot].h=h; cache[slot].len=(uint32_t)n; cache[slot].count=(uint32_t)c;
+	pthread_mutex_unlock(&cache_mtx);
+	return c;
+}
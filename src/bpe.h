@@ -0,0 +1,22 @@
+/*==============================================================================
+ * src/bpe.h  —  byte-pair-encoding token counter (tiktoken vocabulary files)
+ * License: BSD3
+ *============================================================================*/
+#ifndef BPE_H
+#define BPE_H
+#include <stddef.h>
+
+struct bpe;
+
+/* Load a tiktoken rank file ("<base64 token> <rank>" per line). */
+struct bpe *bpe_load(const char *path);
+void   bpe_free(struct bpe *b);
+
+/* Number of tokens in s[0..n). */
+size_t bpe_count(const struct bpe *b, const char *s, size_t n);
+
+/* Token count of one chat message, cached by content hash. With b==NULL
+   this falls back to a bytes/4 estimate. Includes per-message framing. */
+size_t bpe_count_msg(const struct bpe *b, const char *content);
+
+#endif
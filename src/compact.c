@@ -0,0 +1,261 @@
+/*==============================================================================
+ * src/compact.c  —  --compact: old history turns summarized in the background
+ *
+ * Long /chat conversations resend every turn. Past --compact N entries the
+ * oldest ones are stood in for by a summary the backend wrote earlier, off
+ * the request path: once a reply is out, the history the browser will send
+ * next is queued here, and one thread summarizes its old turns while the
+ * user reads and types. Summaries cover whole blocks of COMPACT_BLOCK
+ * entries, so the following requests all find the same one, and each
+ * builds on the one before: the summary up to block k is written from the
+ * summary up to block k-1 and the turns of block k. The history lives in
+ * the browser, so summaries are keyed by its content: a chain of SipHash
+ * values over the blocks, under a key drawn at start so that no client can
+ * craft a history that lands on another conversation's summary.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "compact.h"
+#include "httpd.h"
+#include "upstream.h"
+#include "util.h"
+#include "../config.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEP "\n\n===\n\n"   /* between history entries, as in httpd.c */
+
+struct slot {
+	uint64_t key, used;                 /* used: LRU tick, 0 = free */
+	char *summary;                      /* NULL while pending */
+	int pending;
+};
+
+struct job {
+	char *history;
+	int from, to;                       /* entries to add to base */
+	char *base;                         /* summary up to from, or NULL */
+	uint64_t key;                       /* of the summary up to to */
+};
+
+static const struct server_cfg *cfg;
+static llm_fn fn;
+static uint64_t k0, k1;
+static struct slot slots[COMPACT_SLOTS];
+static struct job queue[COMPACT_QUEUE];
+static int qhead, qlen, running, stop;
+static uint64_t tick;
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cv = PTHREAD_COND_INITIALIZER;
+static pthread_t thr;
+
+/* ------------------------------- SipHash-2-4 ------------------------------ */
+#define ROTL(x,b) (uint64_t)(((x)<<(b)) | ((x)>>(64-(b))))
+#define SIPROUND do{ \
+	v0+=v1; v1=ROTL(v1,13); v1^=v0; v0=ROTL(v0,32); \
+	v2+=v3; v3=ROTL(v3,16); v3^=v2; \
+	v0+=v3; v3=ROTL(v3,21); v3^=v0; \
+	v2+=v1; v1=ROTL(v1,17); v1^=v2; v2=ROTL(v2,32); }while(0)
+
+static uint64_t siphash(uint64_t a, uint64_t b, const unsigned char *p, size_t n){
+	uint64_t v0=a^0x736f6d6570736575ULL, v1=b^0x646f72616e646f6dULL;
+	uint64_t v2=a^0x6c7967656e657261ULL, v3=b^0x7465646279746573ULL;
+	uint64_t m;
+	for(const unsigned char *end=p+(n&~(size_t)7); p<end; p+=8){
+		m=0;
+		for(int i=7;i>=0;i--) m=m<<8 | p[i];
+		v3^=m; SIPROUND; SIPROUND; v0^=m;
+	}
+	m=(uint64_t)n<<56;
+	for(int i=(int)(n&7)-1;i>=0;i--) m|=(uint64_t)p[i]<<(8*i);
+	v3^=m; SIPROUND; SIPROUND; v0^=m;
+	v2^=0xff; SIPROUND; SIPROUND; SIPROUND; SIPROUND;
+	return v0^v1^v2^v3;
+}
+
+/* -------------------------------- history --------------------------------- */
+/* where each entry starts; their number */
+static int split(const char *h, const char ***at){
+	const char **v=NULL;
+	int n=0, cap=0;
+	for(const char *p=h; p && *p; ){
+		if(n==cap){ cap = cap? cap*2 : 64; v=xrealloc(v, (size_t)cap*sizeof *v); }
+		v[n++]=p;
+		if(!(p=strstr(p, SEP))) break;
+		p+=strlen(SEP);
+	}
+	*at=v;
+	return n;
+}
+
+/* whole blocks of entries due for a summary */
+static int due(int n){
+	return n>cfg->compact && n>COMPACT_KEEP? (n-COMPACT_KEEP)/COMPACT_BLOCK : 0;
+}
+
+/* key[k-1]: the first k blocks, each chained into the next one's key */
+static void chain(const char *h, const char **at, int n, int nblk, uint64_t *key){
+	uint64_t prev=0;
+	for(int k=1;k<=nblk;k++){
+		const char *a=at[(k-1)*COMPACT_BLOCK];
+		const char *b = k*COMPACT_BLOCK<n? at[k*COMPACT_BLOCK] : h+strlen(h);
+		key[k-1]=prev=siphash(k0^prev, k1, (const unsigned char*)a, (size_t)(b-a));
+	}
+}
+
+/* ---------------------------------- cache --------------------------------- */
+static struct slot *find(uint64_t key){
+	for(int i=0;i<COMPACT_SLOTS;i++)
+		if(slots[i].used && slots[i].key==key) return &slots[i];
+	return NULL;
+}
+
+/* the least recently used slot not waiting on a job, emptied */
+static struct slot *claim(uint64_t key){
+	struct slot *s=NULL;
+	for(int i=0;i<COMPACT_SLOTS;i++)
+		if(!slots[i].pending && (!s || slots[i].used<s->used)) s=&slots[i];
+	if(!s) return NULL;
+	free(s->summary);
+	*s=(struct slot){ key, ++tick, NULL, 1 };
+	return s;
+}
+
+char *compact_lookup(const char *history, int *skip){
+	*skip=0;
+	if(!running || !history) return NULL;
+	const char **at;
+	int n=split(history, &at), nblk=due(n);
+	char *r=NULL;
+	if(nblk){
+		uint64_t *key=xmalloc((size_t)nblk*sizeof *key);
+		chain(history, at, n, nblk, key);
+		pthread_mutex_lock(&mtx);
+		for(int k=nblk;k>0 && !r;k--){
+			struct slot *s=find(key[k-1]);
+			if(!s || !s->summary) continue;
+			s->used=++tick;
+			struct sbuf b; sb_init(&b);
+			sb_puts(&b, COMPACT_HEADER); sb_puts(&b, s->summary);
+			r=sb_steal(&b);
+			*skip=k*COMPACT_BLOCK;
+		}
+		pthread_mutex_unlock(&mtx);
+		free(key);
+	}
+	free(at);
+	return r;
+}
+
+void compact_submit(char *history){
+	if(!running || !history){ free(history); return; }
+	const char **at;
+	int n=split(history, &at), nblk=due(n);
+	if(!nblk){ free(at); free(history); return; }
+	uint64_t *key=xmalloc((size_t)nblk*sizeof *key);
+	chain(history, at, n, nblk, key);
+	free(at);
+
+	pthread_mutex_lock(&mtx);
+	struct slot *s;
+	if(find(key[nblk-1]) || qlen==COMPACT_QUEUE) goto out;   /* done, queued, or too busy */
+	int base=nblk-1;
+	while(base>0 && !((s=find(key[base-1])) && s->summary)) base--;
+	struct job j={ history, base*COMPACT_BLOCK, nblk*COMPACT_BLOCK,
+	               base? xstrdup(find(key[base-1])->summary) : NULL, key[nblk-1] };
+	if(!claim(j.key)){ free(j.base); goto out; }
+	queue[(qhead+qlen++)%COMPACT_QUEUE]=j;
+	history=NULL;
+	pthread_cond_signal(&cv);
+out:
+	pthread_mutex_unlock(&mtx);
+	free(key);
+	free(history);
+}
+
+/* -------------------------------- summarizer ------------------------------ */
+static char *summarize(const struct job *j){
+	struct sbuf b; sb_init(&b);
+	if(j->base) sb_printf(&b, "Summary so far:\n%s\n\nThe conversation since:\n\n", j->base);
+	const char **at;
+	int n=split(j->history, &at);
+	for(int i=j->from;i<j->to && i<n;i++){
+		const char *e=at[i];
+		size_t len = i+1<n? (size_t)(at[i+1]-e)-strlen(SEP) : strlen(e);
+		if(len<3 || (e[0]!='U' && e[0]!='A') || e[1]!=':') continue;
+		sb_puts(&b, e[0]=='U'? "user: " : "assistant: ");
+		sb_putn(&b, e+3, len-3);
+		sb_puts(&b, "\n\n");
+	}
+	free(at);
+
+	struct llm_msg msgs[2]={ { "system", COMPACT_PROMPT }, { "user", b.s } };
+	struct llm_req req = {
+		.msgs = msgs, .nmsgs = 2,
+		.model = cfg->model, .temperature = 0, .max_tokens = COMPACT_MAX_TOKENS,
+		.api_base = cfg->api_base, .api_key = cfg->api_key,
+		.no_network = cfg->no_network, .http2 = cfg->http2, .hme_argv = cfg->hme_argv, .hme_argc = cfg->hme_argc,
+		.trt_engine_path = cfg->trt_engine,
+		.deadline_us = cfg->timeout_sec>0? now_us()+(uint64_t)cfg->timeout_sec*1000000 : 0,
+		.cancel = &stop
+	};
+	struct llm_resp resp = {0};
+	int rc = cfg->ups ? upstream_complete(cfg->ups, fn, &req, &resp) : fn(&req, &resp);
+	sb_free(&b);
+	if(rc!=0 || resp.status!=0 || !resp.content || !*resp.content){
+		if(cfg->verbose) warnx("compact: no summary (%d/%d): %s", rc, resp.status, resp.err? resp.err : "empty");
+		free(resp.content); free(resp.err);
+		return NULL;
+	}
+	free(resp.err);
+	return resp.content;
+}
+
+static void *run(void *arg){
+	(void)arg;
+	pthread_mutex_lock(&mtx);
+	for(;;){
+		while(!qlen && !stop) pthread_cond_wait(&cv, &mtx);
+		if(stop) break;
+		struct job j=queue[qhead];
+		qhead=(qhead+1)%COMPACT_QUEUE; qlen--;
+		pthread_mutex_unlock(&mtx);
+		char *sum=summarize(&j);
+		pthread_mutex_lock(&mtx);
+		struct slot *s=find(j.key);
+		if(s && s->pending){
+			s->pending=0;
+			if(sum){ s->summary=sum; s->used=++tick; sum=NULL; }
+			else s->used=0;
+		}
+		free(sum); free(j.history); free(j.base);
+	}
+	pthread_mutex_unlock(&mtx);
+	return NULL;
+}
+
+void compact_start(const struct server_cfg *c, llm_fn f){
+	cfg=c; fn=f;
+	unsigned char r[16];
+	FILE *u=fopen("/dev/urandom", "rb");
+	if(!u || fread(r, 1, sizeof r, u)!=sizeof r) die("compact: cannot read /dev/urandom");
+	fclose(u);
+	for(int i=0;i<8;i++){ k0=k0<<8 | r[i]; k1=k1<<8 | r[8+i]; }
+	if(pthread_create(&thr, NULL, run, NULL)) die("compact: cannot start thread");
+	running=1;
+}
+
+void compact_stop(void){
+	if(!running) return;
+	pthread_mutex_lock(&mtx);
+	stop=1;
+	pthread_cond_broadcast(&cv);
+	pthread_mutex_unlock(&mtx);
+	pthread_join(thr, NULL);
+	running=0;
+	for(; qlen; qlen--, qhead=(qhead+1)%COMPACT_QUEUE){ free(queue[qhead].history); free(queue[qhead].base); }
+	for(int i=0;i<COMPACT_SLOTS;i++) free(slots[i].summary);
+}
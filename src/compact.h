@@ -0,0 +1,26 @@
+/*==============================================================================
+ * src/compact.h  —  --compact: old history turns summarized in the background
+ * License: BSD3
+ *============================================================================*/
+#ifndef COMPACT_H
+#define COMPACT_H
+#include "../include/llm_backend.h"
+
+struct server_cfg;
+
+/* Start the summarizer thread; history past cfg->compact entries is then
+   compacted. Reads its hash key from /dev/urandom, so call it before the
+   sandbox. Dies on failure. */
+void compact_start(const struct server_cfg *cfg, llm_fn fn);
+void compact_stop(void);
+
+/* A system message standing in for history entries [0, *skip), malloc'd,
+   or NULL (*skip 0) when none is cached yet. */
+char *compact_lookup(const char *history, int *skip);
+
+/* Called once the reply is out, with the history the next request will
+   send (taken over): queues the summary that request could use. Never
+   blocks; a full queue drops it. */
+void compact_submit(char *history);
+
+#endif
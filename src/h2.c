@@ -0,0 +1,736 @@
+/*==============================================================================
+ * src/h2.c  —  HTTP/2 client: many completions over one upstream connection
+ *
+ * One I/O thread per connection owns the socket. It writes queued frames,
+ * sends request bodies as the peer's flow-control windows allow, reads
+ * frames, decodes header blocks (HPACK) in arrival order and appends each
+ * stream's reply to that stream's buffer. A request only queues frames
+ * and waits on its own stream, so its deadline or cancel resets that
+ * stream and nothing else. Stream receive windows are credited as the
+ * request takes its bytes, so a slow reader is paced by the upstream
+ * rather than buffered without bound.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "h2.h"
+#include "hconn.h"
+#include "trace.h"
+#include "../config.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+enum { F_DATA, F_HEADERS, F_PRIORITY, F_RST, F_SETTINGS, F_PUSH, F_PING, F_GOAWAY,
+       F_WINDOW, F_CONT };
+#define FL_END_STREAM  0x1
+#define FL_ACK         0x1
+#define FL_END_HEADERS 0x4
+#define FL_PADDED      0x8
+#define FL_PRIORITY    0x20
+#define FRAME_MAX      16384    /* we never raise SETTINGS_MAX_FRAME_SIZE */
+#define HPACK_TABLE    4096     /* nor SETTINGS_HEADER_TABLE_SIZE */
+#define ERR_CANCEL     0x8
+
+/* --------------------------------- HPACK ---------------------------------- */
+static const char *const stat_tab[61][2] = {
+	{":authority",""},{":method","GET"},{":method","POST"},{":path","/"},
+	{":path","/index.html"},{":scheme","http"},{":scheme","https"},{":status","200"},
+	{":status","204"},{":status","206"},{":status","304"},{":status","400"},
+	{":status","404"},{":status","500"},{"accept-charset",""},{"accept-encoding","gzip, deflate"},
+	{"accept-language",""},{"accept-ranges",""},{"accept",""},{"access-control-allow-origin",""},
+	{"age",""},{"allow",""},{"authorization",""},{"cache-control",""},
+	{"content-disposition",""},{"content-encoding",""},{"content-language",""},{"content-length",""},
+	{"content-location",""},{"content-range",""},{"content-type",""},{"cookie",""},
+	{"date",""},{"etag",""},{"expect",""},{"expires",""},
+	{"from",""},{"host",""},{"if-match",""},{"if-modified-since",""},
+	{"if-none-match",""},{"if-range",""},{"if-unmodified-since",""},{"last-modified",""},
+	{"link",""},{"location",""},{"max-forwards",""},{"proxy-authenticate",""},
+	{"proxy-authorization",""},{"range",""},{"referer",""},{"refresh",""},
+	{"retry-after",""},{"server",""},{"set-cookie",""},{"strict-transport-security",""},
+	{"transfer-encoding",""},{"user-agent",""},{"vary",""},{"via",""},
+	{"www-authenticate",""}
+};
+enum { S_AUTHORITY=1, S_POST=3, S_PATH=4, S_HTTP=6, S_HTTPS=7, S_ACCEPT_ENCODING=16,
+       S_ACCEPT=19, S_AUTHORIZATION=23, S_CONTENT_LENGTH=28, S_CONTENT_TYPE=31 };
+
+/* RFC 7541 Appendix B: code, bit length; 256 is EOS */
+static const struct { uint32_t code; uint8_t len; } huff[257] = {
+	{0x1ff8,13},{0x7fffd8,23},{0xfffffe2,28},{0xfffffe3,28},{0xfffffe4,28},{0xfffffe5,28},
+	{0xfffffe6,28},{0xfffffe7,28},{0xfffffe8,28},{0xffffea,24},{0x3ffffffc,30},{0xfffffe9,28},
+	{0xfffffea,28},{0x3ffffffd,30},{0xfffffeb,28},{0xfffffec,28},{0xfffffed,28},{0xfffffee,28},
+	{0xfffffef,28},{0xffffff0,28},{0xffffff1,28},{0xffffff2,28},{0x3ffffffe,30},{0xffffff3,28},
+	{0xffffff4,28},{0xffffff5,28},{0xffffff6,28},{0xffffff7,28},{0xffffff8,28},{0xffffff9,28},
+	{0xffffffa,28},{0xffffffb,28},{0x14,6},{0x3f8,10},{0x3f9,10},{0xffa,12},
+	{0x1ff9,13},{0x15,6},{0xf8,8},{0x7fa,11},{0x3fa,10},{0x3fb,10},
+	{0xf9,8},{0x7fb,11},{0xfa,8},{0x16,6},{0x17,6},{0x18,6},
+	{0x0,5},{0x1,5},{0x2,5},{0x19,6},{0x1a,6},{0x1b,6},
+	{0x1c,6},{0x1d,6},{0x1e,6},{0x1f,6},{0x5c,7},{0xfb,8},
+	{0x7ffc,15},{0x20,6},{0xffb,12},{0x3fc,10},{0x1ffa,13},{0x21,6},
+	{0x5d,7},{0x5e,7},{0x5f,7},{0x60,7},{0x61,7},{0x62,7},
+	{0x63,7},{0x64,7},{0x65,7},{0x66,7},{0x67,7},{0x68,7},
+	{0x69,7},{0x6a,7},{0x6b,7},{0x6c,7},{0x6d,7},{0x6e,7},
+	{0x6f,7},{0x70,7},{0x71,7},{0x72,7},{0xfc,8},{0x73,7},
+	{0xfd,8},{0x1ffb,13},{0x7fff0,19},{0x1ffc,13},{0x3ffc,14},{0x22,6},
+	{0x7ffd,15},{0x3,5},{0x23,6},{0x4,5},{0x24,6},{0x5,5},
+	{0x25,6},{0x26,6},{0x27,6},{0x6,5},{0x74,7},{0x75,7},
+	{0x28,6},{0x29,6},{0x2a,6},{0x7,5},{0x2b,6},{0x76,7},
+	{0x2c,6},{0x8,5},{0x9,5},{0x2d,6},{0x77,7},{0x78,7},
+	{0x79,7},{0x7a,7},{0x7b,7},{0x7ffe,15},{0x7fc,11},{0x3ffd,14},
+	{0x1ffd,13},{0xffffffc,28},{0xfffe6,20},{0x3fffd2,22},{0xfffe7,20},{0xfffe8,20},
+	{0x3fffd3,22},{0x3fffd4,22},{0x3fffd5,22},{0x7fffd9,23},{0x3fffd6,22},{0x7fffda,23},
+	{0x7fffdb,23},{0x7fffdc,23},{0x7fffdd,23},{0x7fffde,23},{0xffffeb,24},{0x7fffdf,23},
+	{0xffffec,24},{0xffffed,24},{0x3fffd7,22},{0x7fffe0,23},{0xffffee,24},{0x7fffe1,23},
+	{0x7fffe2,23},{0x7fffe3,23},{0x7fffe4,23},{0x1fffdc,21},{0x3fffd8,22},{0x7fffe5,23},
+	{0x3fffd9,22},{0x7fffe6,23},{0x7fffe7,23},{0xffffef,24},{0x3fffda,22},{0x1fffdd,21},
+	{0xfffe9,20},{0x3fffdb,22},{0x3fffdc,22},{0x7fffe8,23},{0x7fffe9,23},{0x1fffde,21},
+	{0x7fffea,23},{0x3fffdd,22},{0x3fffde,22},{0xfffff0,24},{0x1fffdf,21},{0x3fffdf,22},
+	{0x7fffeb,23},{0x7fffec,23},{0x1fffe0,21},{0x1fffe1,21},{0x3fffe0,22},{0x1fffe2,21},
+	{0x7fffed,23},{0x3fffe1,22},{0x7fffee,23},{0x7fffef,23},{0xfffea,20},{0x3fffe2,22},
+	{0x3fffe3,22},{0x3fffe4,22},{0x7ffff0,23},{0x3fffe5,22},{0x3fffe6,22},{0x7ffff1,23},
+	{0x3ffffe0,26},{0x3ffffe1,26},{0xfffeb,20},{0x7fff1,19},{0x3fffe7,22},{0x7ffff2,23},
+	{0x3fffe8,22},{0x1ffffec,25},{0x3ffffe2,26},{0x3ffffe3,26},{0x3ffffe4,26},{0x7ffffde,27},
+	{0x7ffffdf,27},{0x3ffffe5,26},{0xfffff1,24},{0x1ffffed,25},{0x7fff2,19},{0x1fffe3,21},
+	{0x3ffffe6,26},{0x7ffffe0,27},{0x7ffffe1,27},{0x3ffffe7,26},{0x7ffffe2,27},{0xfffff2,24},
+	{0x1fffe4,21},{0x1fffe5,21},{0x3ffffe8,26},{0x3ffffe9,26},{0xffffffd,28},{0x7ffffe3,27},
+	{0x7ffffe4,27},{0x7ffffe5,27},{0xfffec,20},{0xfffff3,24},{0xfffed,20},{0x1fffe6,21},
+	{0x3fffe9,22},{0x1fffe7,21},{0x1fffe8,21},{0x7ffff3,23},{0x3fffea,22},{0x3fffeb,22},
+	{0x1ffffee,25},{0x1ffffef,25},{0xfffff4,24},{0xfffff5,24},{0x3ffffea,26},{0x7ffff4,23},
+	{0x3ffffeb,26},{0x7ffffe6,27},{0x3ffffec,26},{0x3ffffed,26},{0x7ffffe7,27},{0x7ffffe8,27},
+	{0x7ffffe9,27},{0x7ffffea,27},{0x7ffffeb,27},{0xffffffe,28},{0x7ffffec,27},{0x7ffffed,27},
+	{0x7ffffee,27},{0x7ffffef,27},{0x7fffff0,27},{0x3ffffee,26},{0x3fffffff,30},
+};
+
+/* decoding tree: child >0 is a node, <0 is -(symbol+1), 0 is no code */
+static short htree[256][2];
+static pthread_once_t htree_once = PTHREAD_ONCE_INIT;
+
+static void htree_build(void){
+	int nodes=1;
+	for(int s=0;s<257;s++){
+		int n=0;
+		for(int b=huff[s].len-1;b>0;b--){
+			int bit=(huff[s].code>>b)&1;
+			if(!htree[n][bit]) htree[n][bit]=(short)nodes++;
+			n=htree[n][bit];
+		}
+		htree[n][huff[s].code&1]=(short)-(s+1);
+	}
+}
+
+static int huff_decode(struct sbuf *b, const unsigned char *p, size_t n){
+	pthread_once(&htree_once, htree_build);
+	int node=0, depth=0;
+	for(size_t i=0;i<n;i++) for(int k=7;k>=0;k--){
+		int next=htree[node][(p[i]>>k)&1];
+		if(next<0){
+			if(next==-257) return -1;   /* EOS inside a string */
+			sb_putc(b, (char)(-next-1));
+			node=0; depth=0;
+		}else if(!next) return -1;
+		else{ node=next; depth++; }
+	}
+	return depth>7? -1 : 0;   /* padding: a prefix of EOS, under a byte */
+}
+
+struct hent { char *name, *value; };
+struct hpack {
+	struct hent *e; size_t n, cap;   /* e[n-1] is the newest: index 62 */
+	size_t size, max;
+};
+
+static void hp_evict(struct hpack *h, size_t room){
+	size_t k=0;
+	while(k<h->n && h->size+room > h->max){
+		h->size -= strlen(h->e[k].name)+strlen(h->e[k].value)+32;
+		free(h->e[k].name); free(h->e[k].value);
+		k++;
+	}
+	memmove(h->e, h->e+k, (h->n-k)*sizeof *h->e);
+	h->n-=k;
+}
+
+static void hp_add(struct hpack *h, const char *name, const char *value){
+	size_t sz=strlen(name)+strlen(value)+32;
+	hp_evict(h, sz);
+	if(sz > h->max) return;
+	if(h->n==h->cap){ h->cap=h->cap? h->cap*2 : 16; h->e=xrealloc(h->e, h->cap*sizeof *h->e); }
+	h->e[h->n++]=(struct hent){ xstrdup(name), xstrdup(value) };
+	h->size+=sz;
+}
+
+static void hp_free(struct hpack *h){
+	h->max=0;
+	hp_evict(h, 1);
+	free(h->e);
+}
+
+static const unsigned char *hp_int(const unsigned char *p, const unsigned char *end,
+                                   int bits, size_t *v)
+{
+	size_t max=(1u<<bits)-1;
+	if(p>=end) return NULL;
+	*v = *p++ & max;
+	if(*v<max) return p;
+	for(int sh=0; p<end && sh<28; sh+=7){
+		*v += (size_t)(*p & 127) << sh;
+		if(!(*p++ & 128)) return p;
+	}
+	return NULL;
+}
+
+static const unsigned char *hp_str(const unsigned char *p, const unsigned char *end, struct sbuf *b){
+	size_t n;
+	int h = p<end && (*p & 128);
+	b->len=0;
+	if(!(p=hp_int(p, end, 7, &n)) || n > (size_t)(end-p)) return NULL;
+	if(h){ if(huff_decode(b, p, n)<0) return NULL; }
+	else sb_putn(b, (const char*)p, n);
+	if(!b->s) sb_puts(b, "");
+	return p+n;
+}
+
+/* entry i (1-based, static then dynamic) into name/value */
+static int hp_get(const struct hpack *h, size_t i, struct sbuf *name, struct sbuf *value){
+	const char *nm, *vl;
+	if(i>=1 && i<=61){ nm=stat_tab[i-1][0]; vl=stat_tab[i-1][1]; }
+	else if(i>61 && i-62 < h->n){ nm=h->e[h->n-1-(i-62)].name; vl=h->e[h->n-1-(i-62)].value; }
+	else return -1;
+	name->len=0; sb_puts(name, nm);
+	if(value){ value->len=0; sb_puts(value, vl); }
+	return 0;
+}
+
+/* Decode one header block. With head, append an HTTP/1.1-style head
+   (":status" as the status line, then "name: value" lines, then a blank
+   line). *status gets :status. -1 on a compression error. */
+static int hp_decode(struct hpack *h, const unsigned char *p, size_t n,
+                     struct sbuf *head, int *status)
+{
+	const unsigned char *end=p+n;
+	struct sbuf name, value; sb_init(&name); sb_init(&value);
+	int rc=-1;
+	*status=0;
+	while(p<end){
+		size_t i;
+		int add=0;
+		if(*p & 128){
+			if(!(p=hp_int(p, end, 7, &i)) || hp_get(h, i, &name, &value)<0) goto out;
+		}else if((*p & 0xe0)==0x20){   /* dynamic table size update */
+			if(!(p=hp_int(p, end, 5, &i)) || i>HPACK_TABLE) goto out;
+			h->max=i;
+			hp_evict(h, 0);
+			continue;
+		}else{
+			add = (*p & 0xc0)==0x40;
+			if(!(p=hp_int(p, end, add? 6 : 4, &i))) goto out;
+			if(i){ if(hp_get(h, i, &name, NULL)<0) goto out; }
+			else if(!(p=hp_str(p, end, &name))) goto out;
+			if(!(p=hp_str(p, end, &value))) goto out;
+			if(add) hp_add(h, name.s, value.s);
+		}
+		if(!strcmp(name.s, ":status")){
+			*status=atoi(value.s);
+			if(head) sb_printf(head, "HTTP/1.1 %s\r\n", value.s);
+		}else if(head && name.s[0]!=':')
+			sb_printf(head, "%s: %s\r\n", name.s, value.s);
+	}
+	if(head) sb_puts(head, "\r\n");
+	rc = *status? 0 : -1;
+out:
+	sb_free(&name); sb_free(&value);
+	return rc;
+}
+
+static void hp_put_int(struct sbuf *b, unsigned first, int bits, size_t v){
+	size_t max=(1u<<bits)-1;
+	if(v<max){ sb_putc(b, (char)(first|v)); return; }
+	sb_putc(b, (char)(first|max));
+	for(v-=max; v>=128; v>>=7) sb_putc(b, (char)(v%128+128));
+	sb_putc(b, (char)v);
+}
+
+/* literal without indexing (never indexed if secret), name from the
+   static table, value sent raw */
+static void hp_put(struct sbuf *b, int idx, const char *v, int secret){
+	size_t n=strlen(v);
+	hp_put_int(b, secret? 0x10 : 0, 4, (size_t)idx);
+	hp_put_int(b, 0, 7, n);
+	sb_putn(b, v, n);
+}
+
+/* ------------------------------ connections ------------------------------- */
+enum { C_CONNECTING, C_READY, C_GOAWAY, C_DEAD };
+
+struct h2stream {
+	uint32_t id;
+	struct h2stream *next;
+	const char *body; size_t blen, boff;   /* request body still to send */
+	long long swin;                        /* what the peer lets us send */
+	struct sbuf in;                        /* reply bytes not yet taken */
+	size_t recv;                           /* DATA bytes not yet credited */
+	int head, done, err;
+	pthread_cond_t cv;
+};
+
+struct h2conn {
+	char key[288];
+	struct hconn c;
+	pthread_mutex_t mtx;
+	int state, refs;
+	int wake[2];                 /* poked when frames are queued */
+	struct sbuf w; size_t woff;  /* frames to write */
+	struct h2stream *streams;
+	unsigned nstreams, max_streams;
+	uint32_t next_id, max_frame;
+	long long cwin, iwin;        /* peer's connection / initial stream window */
+	size_t crecv;                /* DATA bytes not yet credited on stream 0 */
+	struct hpack dec;
+	struct sbuf hb;              /* header block being reassembled */
+	uint32_t hb_id; int hb_open, hb_es;
+	uint64_t idle_since;
+};
+
+static struct h2conn *conns[H2_CONNS_MAX];
+static int nconns;
+static char h1only[8][288];   /* upstreams whose ALPN said no, most recent */
+static unsigned nh1only;
+static pthread_mutex_t conns_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t conns_cv;   /* on the now_us() clock, as deadlines are */
+static pthread_once_t conns_once = PTHREAD_ONCE_INIT;
+
+/* every connection comes from conn_get(), which runs this first */
+static void conns_cv_init(void){
+	pthread_condattr_t ca;
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&conns_cv, &ca);
+	pthread_condattr_destroy(&ca);
+}
+
+static void conn_unref(struct h2conn *x){
+	if(__atomic_sub_fetch(&x->refs, 1, __ATOMIC_ACQ_REL)) return;
+	hc_close(&x->c);
+	close(x->wake[0]); close(x->wake[1]);
+	sb_free(&x->w); sb_free(&x->hb);
+	hp_free(&x->dec);
+	pthread_mutex_destroy(&x->mtx);
+	free(x);
+}
+
+static void conn_drop(struct h2conn *x){
+	pthread_mutex_lock(&conns_mtx);
+	for(int i=0;i<nconns;i++) if(conns[i]==x){ conns[i]=conns[--nconns]; break; }
+	pthread_cond_broadcast(&conns_cv);
+	pthread_mutex_unlock(&conns_mtx);
+	conn_unref(x);
+}
+
+static void put_frame(struct sbuf *w, size_t len, int type, int flags, uint32_t id){
+	unsigned char h[9]={ (unsigned char)(len>>16), (unsigned char)(len>>8), (unsigned char)len,
+	                     (unsigned char)type, (unsigned char)flags, (unsigned char)(id>>24 & 0x7f),
+	                     (unsigned char)(id>>16), (unsigned char)(id>>8), (unsigned char)id };
+	sb_putn(w, (const char*)h, 9);
+}
+
+static void put_u32(struct sbuf *w, uint32_t v){
+	unsigned char b[4]={ (unsigned char)(v>>24), (unsigned char)(v>>16), (unsigned char)(v>>8), (unsigned char)v };
+	sb_putn(w, (const char*)b, 4);
+}
+
+static uint32_t get_u32(const unsigned char *p){
+	return (uint32_t)p[0]<<24 | (uint32_t)p[1]<<16 | (uint32_t)p[2]<<8 | p[3];
+}
+
+static void put_window(struct h2conn *x, uint32_t id, size_t inc){
+	put_frame(&x->w, 4, F_WINDOW, 0, id);
+	put_u32(&x->w, (uint32_t)inc);
+}
+
+static void poke(struct h2conn *x){
+	char c=0;
+	if(write(x->wake[1], &c, 1)<0){ /* full: a wakeup is pending anyway */ }
+}
+
+static struct h2stream *find_stream(struct h2conn *x, uint32_t id){
+	for(struct h2stream *s=x->streams; s; s=s->next) if(s->id==id) return s;
+	return NULL;
+}
+
+static void stream_end(struct h2stream *s, int err){
+	if(s->done) return;
+	s->done=1; s->err=err;
+	pthread_cond_signal(&s->cv);
+}
+
+/* move request bodies into DATA frames as far as the windows allow */
+static void pump(struct h2conn *x){
+	for(struct h2stream *s=x->streams; s && x->cwin>0; s=s->next){
+		while(s->boff<s->blen && x->cwin>0 && s->swin>0){
+			size_t n=s->blen-s->boff;
+			if(n>x->max_frame) n=x->max_frame;
+			if((long long)n>x->cwin) n=(size_t)x->cwin;
+			if((long long)n>s->swin) n=(size_t)s->swin;
+			s->boff+=n;
+			put_frame(&x->w, n, F_DATA, s->boff==s->blen? FL_END_STREAM : 0, s->id);
+			sb_putn(&x->w, s->body+s->boff-n, n);
+			x->cwin-=(long long)n; s->swin-=(long long)n;
+		}
+	}
+}
+
+/* the header block in x->hb is complete */
+static int got_headers(struct h2conn *x){
+	struct h2stream *s=find_stream(x, x->hb_id);
+	int st;
+	struct sbuf *head = s && !s->done && !s->head? &s->in : NULL;
+	size_t mark = head? head->len : 0;
+	x->hb_open=0;
+	if(hp_decode(&x->dec, (const unsigned char*)x->hb.s, x->hb.len, head, &st)<0) return -1;
+	if(!s || s->done) return 0;
+	if(head && st>=200) s->head=1;
+	if(head && head->len>mark) pthread_cond_signal(&s->cv);
+	if(x->hb_es) stream_end(s, s->head? 0 : EPROTO);
+	return 0;
+}
+
+/* one frame from the peer; -1 is a connection error */
+static int on_frame(struct h2conn *x, int type, int fl, uint32_t id,
+                    const unsigned char *p, size_t n)
+{
+	struct h2stream *s = id? find_stream(x, id) : NULL;
+	size_t pad=0, len=n;
+	if(x->hb_open && (type!=F_CONT || id!=x->hb_id)) return -1;
+	if((type==F_DATA || type==F_HEADERS) && (fl & FL_PADDED)){
+		if(!n || p[0]>=n) return -1;
+		pad=p[0]; p++; n-=1+pad;
+	}
+	switch(type){
+	case F_DATA:
+		x->crecv+=len;
+		if(x->crecv >= H2_CONN_WINDOW/2){ put_window(x, 0, x->crecv); x->crecv=0; }
+		if(s && !s->done){
+			if(!s->head) return -1;
+			sb_putn(&s->in, (const char*)p, n);
+			s->recv+=len;
+			pthread_cond_signal(&s->cv);
+			if(fl & FL_END_STREAM) stream_end(s, 0);
+		}
+		break;
+	case F_HEADERS:
+		if(fl & FL_PRIORITY){ if(n<5) return -1; p+=5; n-=5; }
+		x->hb.len=0;
+		sb_putn(&x->hb, (const char*)p, n);
+		x->hb_id=id; x->hb_es=fl & FL_END_STREAM; x->hb_open=1;
+		if(fl & FL_END_HEADERS) return got_headers(x);
+		break;
+	case F_CONT:
+		sb_putn(&x->hb, (const char*)p, n);
+		if(fl & FL_END_HEADERS) return got_headers(x);
+		break;
+	case F_RST:
+		if(s) stream_end(s, ECONNRESET);
+		break;
+	case F_SETTINGS:
+		if(fl & FL_ACK) break;
+		if(n%6) return -1;
+		for(size_t i=0;i<n;i+=6){
+			unsigned k=(unsigned)p[i]<<8 | p[i+1];
+			uint32_t v=get_u32(p+i+2);
+			if(k==3) x->max_streams=v;
+			else if(k==4){
+				for(struct h2stream *t=x->streams; t; t=t->next) t->swin += (long long)v - x->iwin;
+				x->iwin=v;
+			}else if(k==5){
+				if(v<16384 || v>16777215) return -1;
+				x->max_frame=v;
+			}
+		}
+		put_frame(&x->w, 0, F_SETTINGS, FL_ACK, 0);
+		break;
+	case F_PING:
+		if(n!=8) return -1;
+		if(!(fl & FL_ACK)){ put_frame(&x->w, 8, F_PING, FL_ACK, 0); sb_putn(&x->w, (const char*)p, 8); }
+		break;
+	case F_GOAWAY:
+		if(n<8) return -1;
+		if(x->state==C_READY) x->state=C_GOAWAY;
+		for(struct h2stream *t=x->streams; t; t=t->next)
+			if(t->id > (get_u32(p) & 0x7fffffff)) stream_end(t, ECONNRESET);
+		break;
+	case F_WINDOW:
+		if(n!=4) return -1;
+		if(!id) x->cwin += get_u32(p) & 0x7fffffff;
+		else if(s) s->swin += get_u32(p) & 0x7fffffff;
+		break;
+	case F_PUSH:
+		return -1;   /* disabled in our SETTINGS */
+	}
+	return 0;
+}
+
+static void *conn_main(void *arg){
+	struct h2conn *x=arg;
+	struct sbuf rb; sb_init(&rb);
+	char tmp[16384];
+	short rwant=POLLIN, wwant=POLLOUT;
+	for(;;){
+		pthread_mutex_lock(&x->mtx);
+		pump(x);
+		int pending = x->w.len > x->woff;
+		if(!x->nstreams && (x->state==C_GOAWAY ||
+		   (x->state==C_READY && now_ms()-x->idle_since > HTTP_POOL_IDLE_MS)))
+			x->state=C_DEAD;
+		int dead = x->state==C_DEAD;
+		pthread_mutex_unlock(&x->mtx);
+		if(dead) break;
+
+		struct pollfd pf[2]={ { x->c.fd, (short)(rwant | (pending? wwant : 0)), 0 },
+		                      { x->wake[0], POLLIN, 0 } };
+		if(poll(pf, 2, 1000)<0 && errno!=EINTR) break;
+		if(pf[1].revents){ char d[64]; while(read(x->wake[0], d, sizeof d)>0) ; }
+
+		int fail=0;
+		pthread_mutex_lock(&x->mtx);
+		while(x->w.len > x->woff){
+			short want;
+			ssize_t k=hc_try(&x->c, x->w.s+x->woff, x->w.len-x->woff, 1, &want);
+			if(k>0){ x->woff+=(size_t)k; continue; }
+			if(k<0 && (errno==EAGAIN || errno==EINTR)){ wwant=want; break; }
+			fail=1; break;
+		}
+		if(x->woff==x->w.len) x->w.len=x->woff=0;
+		pthread_mutex_unlock(&x->mtx);
+
+		for(int i=0; !fail && i<16; i++){
+			short want;
+			ssize_t k=hc_try(&x->c, tmp, sizeof tmp, 0, &want);
+			if(k>0){ sb_putn(&rb, tmp, (size_t)k); continue; }
+			if(k<0 && (errno==EAGAIN || errno==EINTR)){ rwant=want; break; }
+			fail=1;   /* EOF or error */
+		}
+		size_t off=0;
+		pthread_mutex_lock(&x->mtx);
+		while(!fail && rb.len-off >= 9){
+			const unsigned char *h=(const unsigned char*)rb.s+off;
+			size_t n=(size_t)h[0]<<16 | (size_t)h[1]<<8 | h[2];
+			if(n>FRAME_MAX){ fail=1; break; }
+			if(rb.len-off < 9+n) break;
+			if(on_frame(x, h[3], h[4], get_u32(h+5) & 0x7fffffff, h+9, n)<0) fail=1;
+			off+=9+n;
+		}
+		if(fail) x->state=C_DEAD;
+		pthread_mutex_unlock(&x->mtx);
+		if(off){ memmove(rb.s, rb.s+off, rb.len-off); rb.len-=off; }
+	}
+	pthread_mutex_lock(&x->mtx);
+	x->state=C_DEAD;
+	for(struct h2stream *s=x->streams; s; s=s->next) stream_end(s, ECONNRESET);
+	pthread_mutex_unlock(&x->mtx);
+	sb_free(&rb);
+	conn_drop(x);
+	return NULL;
+}
+
+/* a connection to key with room for one more stream, referenced; NULL
+   with errno if none can be had */
+static struct h2conn *conn_get(const char *key, const struct llm_req *r,
+                               const char *host, const char *port, int use_tls)
+{
+	pthread_once(&conns_once, conns_cv_init);
+	pthread_mutex_lock(&conns_mtx);
+	for(;;){
+		int connecting=0;
+		for(unsigned i=0;i<nh1only && i<8;i++) if(!strcmp(h1only[i], key)){
+			pthread_mutex_unlock(&conns_mtx);
+			errno=EPROTONOSUPPORT;
+			return NULL;
+		}
+		for(int i=0;i<nconns;i++){
+			struct h2conn *x=conns[i];
+			if(strcmp(x->key, key)) continue;
+			if(x->state==C_CONNECTING){ connecting=1; continue; }
+			pthread_mutex_lock(&x->mtx);
+			int ok = x->state==C_READY && x->nstreams < x->max_streams && x->next_id < 0x7fff0000;
+			pthread_mutex_unlock(&x->mtx);
+			if(ok){
+				__atomic_add_fetch(&x->refs, 1, __ATOMIC_ACQ_REL);
+				pthread_mutex_unlock(&conns_mtx);
+				return x;
+			}
+		}
+		if(!connecting) break;
+		/* someone is already dialing: wait for it rather than dial too */
+		int e=hc_expired(r), ms=hc_poll_ms(r);
+		if(e){ pthread_mutex_unlock(&conns_mtx); errno=e; return NULL; }
+		uint64_t at=now_us()+(uint64_t)(ms<0? 1000 : ms)*1000;
+		struct timespec ts={ (time_t)(at/1000000), (long)(at%1000000)*1000 };
+		pthread_cond_timedwait(&conns_cv, &conns_mtx, &ts);
+	}
+	if(nconns==H2_CONNS_MAX){
+		pthread_mutex_unlock(&conns_mtx);
+		errno=EPROTONOSUPPORT;   /* all in use: this one goes over HTTP/1.1 */
+		return NULL;
+	}
+	struct h2conn *x=xmalloc(sizeof *x);
+	memset(x, 0, sizeof *x);
+	snprintf(x->key, sizeof x->key, "%s", key);
+	x->state=C_CONNECTING; x->refs=2;   /* the table's, then the I/O thread's; ours */
+	x->c.fd=-1; x->wake[0]=x->wake[1]=-1;
+	pthread_mutex_init(&x->mtx, NULL);
+	conns[nconns++]=x;
+	pthread_mutex_unlock(&conns_mtx);
+
+	static const struct llm_req forever;
+	int ok=-1, e=0;
+	x->c.r=r;
+	if(hc_connect(&x->c, host, port, use_tls, "h2,http/1.1")<0) e=errno;
+	else if(use_tls && (!hc_alpn(&x->c) || strcmp(hc_alpn(&x->c), "h2"))){
+		e=EPROTONOSUPPORT;
+		pthread_mutex_lock(&conns_mtx);
+		snprintf(h1only[nh1only++ % 8], sizeof *h1only, "%s", key);
+		pthread_mutex_unlock(&conns_mtx);
+	}else if(pipe(x->wake)<0) e=errno;
+	else{
+		for(int k=0;k<2;k++){
+			set_cloexec(x->wake[k]);
+			fcntl(x->wake[k], F_SETFL, fcntl(x->wake[k], F_GETFL)|O_NONBLOCK);
+		}
+		x->c.r=&forever;
+		x->max_streams=H2_MAX_STREAMS; x->max_frame=FRAME_MAX;
+		x->next_id=1; x->cwin=x->iwin=65535;
+		x->dec.max=HPACK_TABLE;
+		x->idle_since=now_ms();
+		static const char preface[]="PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+		sb_putn(&x->w, preface, sizeof preface - 1);
+		put_frame(&x->w, 12, F_SETTINGS, 0, 0);
+		sb_putn(&x->w, "\0\2", 2); put_u32(&x->w, 0);              /* ENABLE_PUSH */
+		sb_putn(&x->w, "\0\4", 2); put_u32(&x->w, H2_WINDOW);      /* INITIAL_WINDOW_SIZE */
+		put_window(x, 0, H2_CONN_WINDOW - 65535);
+		pthread_t th;
+		pthread_attr_t a;
+		pthread_attr_init(&a);
+		pthread_attr_setdetachstate(&a, PTHREAD_CREATE_DETACHED);
+		if(pthread_create(&th, &a, conn_main, x)==0) ok=0;
+		else e=EAGAIN;
+		pthread_attr_destroy(&a);
+	}
+	pthread_mutex_lock(&x->mtx);
+	x->state = ok? C_DEAD : C_READY;
+	pthread_mutex_unlock(&x->mtx);
+	if(ok<0){
+		conn_drop(x);       /* the table's reference */
+		conn_unref(x);      /* ours */
+		errno=e;
+		return NULL;
+	}
+	pthread_mutex_lock(&conns_mtx);
+	pthread_cond_broadcast(&conns_cv);
+	pthread_mutex_unlock(&conns_mtx);
+	return x;
+}
+
+/* --------------------------------- API ------------------------------------ */
+int h2_post(const struct llm_req *r, const char *host, const char *port, int use_tls,
+            const char *auth, const char *path, const char *payload, struct sbuf *out,
+            int (*feed)(void *arg, struct sbuf *out), void *arg)
+{
+	char key[288];
+	snprintf(key, sizeof key, "%s %s %d", host, port, use_tls);
+	struct h2conn *x=conn_get(key, r, host, port, use_tls);
+	if(!x) return -1;
+
+	struct sbuf hb; sb_init(&hb);
+	char authority[300], clen[24];
+	if(!*port) snprintf(authority, sizeof authority, "localhost");   /* unix socket */
+	else if(!strcmp(port, use_tls? "443" : "80")) snprintf(authority, sizeof authority, "%s", host);
+	else snprintf(authority, sizeof authority, "%s:%s", host, port);
+	snprintf(clen, sizeof clen, "%zu", strlen(payload));
+	sb_putc(&hb, (char)(0x80|S_POST));
+	sb_putc(&hb, (char)(0x80|(use_tls? S_HTTPS : S_HTTP)));
+	hp_put(&hb, S_AUTHORITY, authority, 0);
+	hp_put(&hb, S_PATH, path, 0);
+	hp_put(&hb, S_CONTENT_TYPE, "application/json", 0);
+	hp_put(&hb, S_ACCEPT, feed? "text/event-stream" : "application/json", 0);
+	hp_put(&hb, S_ACCEPT_ENCODING, "identity", 0);
+	if(auth) hp_put(&hb, S_AUTHORIZATION, auth, 1);
+	hp_put(&hb, S_CONTENT_LENGTH, clen, 0);
+
+	struct h2stream st;
+	memset(&st, 0, sizeof st);
+	sb_init(&st.in);
+	st.body=payload; st.blen=strlen(payload);
+	pthread_condattr_t ca;
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&st.cv, &ca);
+	pthread_condattr_destroy(&ca);
+
+	int rc=-1, e=ECONNRESET;
+	pthread_mutex_lock(&x->mtx);
+	if(x->state!=C_READY){
+		pthread_mutex_unlock(&x->mtx);
+		goto out;
+	}
+	/* ids go out in the order they are taken: both under the lock */
+	st.id=x->next_id; x->next_id+=2;
+	st.swin=x->iwin;
+	st.next=x->streams; x->streams=&st; x->nstreams++;
+	for(size_t off=0; off<hb.len; ){
+		size_t n = hb.len-off > x->max_frame? x->max_frame : hb.len-off;
+		int fl = off+n==hb.len? FL_END_HEADERS : 0;
+		if(!off && !st.blen) fl|=FL_END_STREAM;
+		put_frame(&x->w, n, off? F_CONT : F_HEADERS, fl, st.id);
+		sb_putn(&x->w, hb.s+off, n);
+		off+=n;
+	}
+	pump(x);
+	poke(x);
+	uint64_t t0=trace_t0(r->trace_id);
+	for(;;){
+		if(st.in.len){
+			if(!out->len) trace_span(r->trace_id, "first byte", t0);
+			sb_putn(out, st.in.s, st.in.len);
+			st.in.len=0;
+			if(out->len > MAX_RESP_BODY){ e=EFBIG; break; }
+			if(st.recv && !st.done){ put_window(x, st.id, st.recv); poke(x); }
+			st.recv=0;
+			pthread_mutex_unlock(&x->mtx);
+			hc_first_byte(r);
+			int stop = feed && feed(arg, out);
+			pthread_mutex_lock(&x->mtx);
+			if(stop){ e=ECANCELED; break; }
+			continue;
+		}
+		if(st.done){ e=st.err; rc = e? -1 : 0; break; }
+		if((e=hc_expired(r))) break;
+		int ms=hc_poll_ms(r);
+		if(ms<0) pthread_cond_wait(&st.cv, &x->mtx);
+		else{
+			uint64_t at=now_us()+(uint64_t)ms*1000;
+			struct timespec ts={ (time_t)(at/1000000), (long)(at%1000000)*1000 };
+			pthread_cond_timedwait(&st.cv, &x->mtx, &ts);
+		}
+	}
+	if(!st.done && x->state!=C_DEAD){
+		put_frame(&x->w, 4, F_RST, 0, st.id);
+		put_u32(&x->w, ERR_CANCEL);
+		poke(x);
+	}
+	for(struct h2stream **pp=&x->streams; *pp; pp=&(*pp)->next)
+		if(*pp==&st){ *pp=st.next; break; }
+	if(!--x->nstreams) x->idle_since=now_ms();
+	pthread_mutex_unlock(&x->mtx);
+out:
+	conn_unref(x);
+	sb_free(&hb);
+	sb_free(&st.in);
+	pthread_cond_destroy(&st.cv);
+	if(rc<0) errno=e;
+	return rc;
+}
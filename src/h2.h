@@ -0,0 +1,20 @@
+/*==============================================================================
+ * src/h2.h  —  HTTP/2 client transport for the OpenAI backend
+ * License: BSD3
+ *============================================================================*/
+#ifndef H2_H
+#define H2_H
+#include "util.h"
+#include "../include/llm_backend.h"
+
+/* POST payload as a new stream on a shared HTTP/2 connection to host:port
+   (ALPN "h2" with TLS, prior knowledge without). The reply is put in out
+   as an HTTP/1.1-style head followed by the body, as curl -i prints it;
+   feed, if set, is called after every addition and returns nonzero to
+   reset the stream. -1 with errno on failure, EPROTONOSUPPORT when the
+   caller should use HTTP/1.1 instead. */
+int h2_post(const struct llm_req *r, const char *host, const char *port, int use_tls,
+            const char *auth, const char *path, const char *payload, struct sbuf *out,
+            int (*feed)(void *arg, struct sbuf *out), void *arg);
+
+#endif
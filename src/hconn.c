@@ -0,0 +1,181 @@
+/*==============================================================================
+ * src/hconn.c  —  upstream connections: deadlines, connect, TLS, I/O
+ *
+ * The socket is non-blocking from connect() on, and every wait goes
+ * through poll() with the time left until r->deadline_us, so a hung
+ * upstream can hold a request no longer than its deadline.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "hconn.h"
+#include "util.h"
+#include "trace.h"
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+
+/* ------------------------- deadlines and cancel --------------------------- */
+int hc_expired(const struct llm_req *r){
+	if(r->cancel && __atomic_load_n(r->cancel, __ATOMIC_ACQUIRE)) return ECANCELED;
+	if(r->deadline_us && now_us() >= r->deadline_us) return ETIMEDOUT;
+	return 0;
+}
+
+int hc_poll_ms(const struct llm_req *r){
+	long long ms=-1;
+	if(r->deadline_us){
+		uint64_t now=now_us();
+		ms = now>=r->deadline_us? 0 : (long long)((r->deadline_us-now+999)/1000);
+	}
+	if(r->cancel && (ms<0 || ms>CANCEL_POLL_MS)) ms=CANCEL_POLL_MS;
+	return ms>INT_MAX? INT_MAX : (int)ms;
+}
+
+/* wait until fd is ready for ev; -1 with errno ETIMEDOUT/ECANCELED/... */
+int hc_wait(int fd, short ev, const struct llm_req *r){
+	for(;;){
+		int e=hc_expired(r);
+		if(e){ errno=e; return -1; }
+		struct pollfd p={ fd, ev, 0 };
+		int n=poll(&p, 1, hc_poll_ms(r));
+		if(n>0) return 0;
+		if(n<0 && errno!=EINTR) return -1;
+	}
+}
+
+void hc_first_byte(const struct llm_req *r){
+	if(r->first_byte_us && !__atomic_load_n(r->first_byte_us, __ATOMIC_RELAXED))
+		__atomic_store_n(r->first_byte_us, (unsigned long long)now_us(), __ATOMIC_RELEASE);
+}
+
+/* ------------------------------ connections ------------------------------- */
+void hc_close(struct hconn *c){
+#if defined(TLS_BACKEND_LIBTLS)
+	if(c->tls){ tls_close(c->tls); tls_free(c->tls); }
+	if(c->cfg) tls_config_free(c->cfg);
+#endif
+	if(c->fd>=0) close(c->fd);
+}
+
+/* a connected non-blocking socket, or -1 with errno */
+static int dial(const struct hconn *c, int family, const struct sockaddr *a, socklen_t n){
+	int fd=socket(family, SOCK_STREAM, 0);
+	if(fd<0) return -1;
+	set_cloexec(fd);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)|O_NONBLOCK);
+	if(connect(fd, a, n)==0) return fd;
+	if(errno==EINPROGRESS && hc_wait(fd, POLLOUT, c->r)==0){
+		int err=0; socklen_t el=sizeof err;
+		if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &el)==0 && !err) return fd;
+		errno=err;
+	}
+	int e=errno;
+	close(fd);
+	errno=e;
+	return -1;
+}
+
+/* no port: host is the path of a unix socket (unix:// base), never TLS */
+static int dial_unix(struct hconn *c, const char *path){
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family=AF_UNIX;
+	if(strlen(path)>=sizeof sa.sun_path){ errno=ENAMETOOLONG; return -1; }
+	memcpy(sa.sun_path, path, strlen(path));
+	uint64_t t0=trace_t0(c->r->trace_id);
+	c->fd=dial(c, AF_UNIX, (struct sockaddr*)&sa, sizeof sa);
+	int e=errno;
+	trace_span(c->r->trace_id, "connect", t0);
+	errno=e;
+	return c->fd<0? -1 : 0;
+}
+
+int hc_connect(struct hconn *c, const char *host, const char *port, int use_tls,
+               const char *alpn)
+{
+	struct addrinfo hints, *res=0, *rp;
+	const struct llm_req *r=c->r;
+	memset(c,0,sizeof *c);
+	c->fd=-1; c->r=r;
+	if(!*port) return dial_unix(c, host);
+	memset(&hints,0,sizeof hints);
+	hints.ai_family=AF_UNSPEC; hints.ai_socktype=SOCK_STREAM;
+	uint64_t t0=trace_t0(r->trace_id);
+	int gai=getaddrinfo(host, port, &hints, &res);
+	trace_span(r->trace_id, "dns", t0);
+	if(gai) return -1;
+	t0=trace_t0(r->trace_id);
+	for(rp=res; rp && c->fd<0; rp=rp->ai_next){
+		c->fd=dial(c, rp->ai_family, rp->ai_addr, rp->ai_addrlen);
+		if(c->fd<0 && (errno==ETIMEDOUT || errno==ECANCELED)) break;
+	}
+	int e=errno;
+	trace_span(r->trace_id, "connect", t0);
+	freeaddrinfo(res);
+	errno=e;
+	if(c->fd<0 || !use_tls) return c->fd<0? -1 : 0;
+#if defined(TLS_BACKEND_LIBTLS)
+	if(!(c->cfg=tls_config_new())) return -1;
+	/* For compactness. In production, configure CA roots or pin certs. */
+	tls_config_insecure_noverifycert(c->cfg);
+	if(alpn && tls_config_set_alpn(c->cfg, alpn)) return -1;
+	if(!(c->tls=tls_client())) return -1;
+	if(tls_configure(c->tls,c->cfg) || tls_connect_socket(c->tls, c->fd, host)) return -1;
+	t0=trace_t0(r->trace_id);
+	for(;;){
+		int k=tls_handshake(c->tls);
+		if(k==0){ trace_span(r->trace_id, "tls", t0); return 0; }
+		if(k!=TLS_WANT_POLLIN && k!=TLS_WANT_POLLOUT) return -1;
+		if(hc_wait(c->fd, k==TLS_WANT_POLLIN? POLLIN : POLLOUT, c->r)<0) return -1;
+	}
+#else
+	(void)alpn;
+	errno=EPROTONOSUPPORT;
+	return -1;
+#endif
+}
+
+const char *hc_alpn(const struct hconn *c){
+#if defined(TLS_BACKEND_LIBTLS)
+	if(c->tls) return tls_conn_alpn_selected(c->tls);
+#endif
+	(void)c;
+	return NULL;
+}
+
+ssize_t hc_try(struct hconn *c, void *buf, size_t n, int wr, short *want){
+	ssize_t k;
+	*want = wr? POLLOUT : POLLIN;
+#if defined(TLS_BACKEND_LIBTLS)
+	if(c->tls){
+		k = wr? tls_write(c->tls, buf, n) : tls_read(c->tls, buf, n);
+		if(k==TLS_WANT_POLLIN || k==TLS_WANT_POLLOUT){
+			*want = k==TLS_WANT_POLLIN? POLLIN : POLLOUT;
+			errno=EAGAIN;
+			return -1;
+		}
+		return k;
+	}
+#endif
+	k = wr? send(c->fd, buf, n, MSG_NOSIGNAL) : recv(c->fd, buf, n, 0);
+	if(k<0 && errno==EWOULDBLOCK) errno=EAGAIN;
+	return k;
+}
+
+ssize_t hc_io(struct hconn *c, void *buf, size_t n, int wr){
+	for(;;){
+		int e=hc_expired(c->r);
+		if(e){ errno=e; return -1; }
+		short want;
+		ssize_t k=hc_try(c, buf, n, wr, &want);
+		if(k>=0) return k;
+		if(errno!=EAGAIN && errno!=EINTR) return -1;
+		if(errno==EAGAIN && hc_wait(c->fd, want, c->r)<0) return -1;
+	}
+}
@@ -0,0 +1,46 @@
+/*==============================================================================
+ * src/hconn.h  —  upstream connections: deadlines, connect, TLS, I/O
+ * License: BSD3
+ *============================================================================*/
+#ifndef HCONN_H
+#define HCONN_H
+#include <sys/types.h>
+#include "../include/llm_backend.h"
+
+#if defined(TLS_BACKEND_LIBTLS)
+#include <tls.h>
+#endif
+
+/* Every wait goes through poll() with the time left until r->deadline_us,
+   cut to CANCEL_POLL_MS when r->cancel may be raised. */
+#define CANCEL_POLL_MS 50
+
+int  hc_expired(const struct llm_req *r);   /* ETIMEDOUT/ECANCELED, else 0 */
+int  hc_poll_ms(const struct llm_req *r);   /* poll() timeout; -1: forever */
+int  hc_wait(int fd, short ev, const struct llm_req *r);
+void hc_first_byte(const struct llm_req *r);
+
+struct hconn {
+	int fd;
+#if defined(TLS_BACKEND_LIBTLS)
+	struct tls *tls;
+	struct tls_config *cfg;
+#endif
+	const struct llm_req *r;  /* whose deadline bounds hc_connect/hc_io */
+};
+
+/* Non-blocking connect (and TLS handshake, offering alpn if not NULL)
+   within c->r's deadline; an empty port connects to the unix socket at
+   path host, without TLS. -1 with errno on failure. */
+int  hc_connect(struct hconn *c, const char *host, const char *port, int use_tls,
+                const char *alpn);
+const char *hc_alpn(const struct hconn *c);  /* protocol chosen, or NULL */
+void hc_close(struct hconn *c);
+
+/* read or write until some bytes move, waiting within c->r's deadline */
+ssize_t hc_io(struct hconn *c, void *buf, size_t n, int wr);
+/* one attempt: -1 with errno EAGAIN and *want = POLLIN/POLLOUT when the
+   caller must poll first */
+ssize_t hc_try(struct hconn *c, void *buf, size_t n, int wr, short *want);
+
+#endif
@@ -3,19 +3,35 @@
  * License: BSD3
  *============================================================================*/
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE      /* SO_REUSEPORT on glibc */
 #include "httpd.h"
+#include "alog.h"
+#include "bpe.h"
+#include "json.h"
+#include "trace.h"
+#include "compact.h"
+#include "route.h"
+#include "store.h"
+#include "reload.h"
 #include "../config.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 
-static int open_listen(const char *bindaddr){
+static int open_listen(const char *bindaddr, int backlog, int reuseport){
 	char host[256], port[16];
 	if(split_host_port(bindaddr, host, sizeof host, port, sizeof port)<0)
 		die("invalid bind address: %s", bindaddr);
@@ -32,9 +48,17 @@ static int open_listen(const char *bindaddr){
 	for(rp=res; rp; rp=rp->ai_next){
 		fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
 		if(fd<0) continue;
+		set_cloexec(fd);
 		setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof on);
+		/* --procs: one listener per worker, the kernel balances accepts */
+#if defined(SO_REUSEPORT)
+		if(reuseport && setsockopt(fd,SOL_SOCKET,SO_REUSEPORT,&on,sizeof on))
+			die("SO_REUSEPORT: %s", strerror(errno));
+#else
+		if(reuseport) die("--procs needs SO_REUSEPORT");
+#endif
 		if(bind(fd, rp->ai_addr, rp->ai_addrlen)==0){
-			if(listen(fd, 16)==0) break;
+			if(listen(fd, backlog)==0) break;
 		}
 		close(fd); fd=-1;
 	}
@@ -43,24 +67,185 @@ static int open_listen(const char *bindaddr){
 	return fd;
 }
 
+/* --bind fd:N (inetd "wait" mode, s6, ...) or systemd-style activation
+   (LISTEN_PID/LISTEN_FDS, the first fd); -1 if neither. The variables are
+   dropped so backend children do not take them for theirs. A supervisor
+   keeps its copy of the socket; an llmserv reloading on SIGUSR2 says with
+   LLMSERV_LISTEN_HELD whether its own came from one. */
+static int inherited_listener(const char *bindaddr, int *held){
+	const char *pid=getenv("LISTEN_PID"), *n=getenv("LISTEN_FDS"), *h=getenv("LLMSERV_LISTEN_HELD");
+	int fd=-1;
+	if(pid && n && atol(pid)==(long)getpid() && atoi(n)>=1){
+		if(atoi(n)>1) warnx("LISTEN_FDS=%s: only the first socket is used", n);
+		fd=3;   /* SD_LISTEN_FDS_START */
+		*held = h? atoi(h)!=0 : 1;
+	}
+	unsetenv("LISTEN_PID"); unsetenv("LISTEN_FDS"); unsetenv("LISTEN_FDNAMES");
+	unsetenv("LLMSERV_LISTEN_HELD");
+	if(fd<0 && !strncmp(bindaddr, "fd:", 3)){
+		char *end;
+		long v=strtol(bindaddr+3, &end, 10);
+		if(end==bindaddr+3 || *end || v<0 || v>65535) die("invalid bind address: %s", bindaddr);
+		fd=(int)v;
+		*held=1;
+	}
+	if(fd<0) return -1;
+	int type=0; socklen_t len=sizeof type;
+	if(getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) || type!=SOCK_STREAM)
+		die("inherited fd %d is not a stream socket", fd);
+#if defined(SO_ACCEPTCONN)
+	int on=0; len=sizeof on;
+	if(!getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &on, &len) && !on)
+		die("inherited fd %d is not listening", fd);
+#endif
+	set_cloexec(fd);
+	return fd;
+}
+
+/* --bind unix:/path, created with mode (umask aside). A socket file left by
+   an earlier run is replaced; one a live server still accepts on is not. */
+static int open_unix(const char *path, int backlog, int mode){
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family=AF_UNIX;
+	if(!*path || strlen(path)>=sizeof sa.sun_path) die("invalid unix socket path: %s", path);
+	memcpy(sa.sun_path, path, strlen(path));
+	struct stat sb;
+	if(!lstat(path, &sb) && S_ISSOCK(sb.st_mode)){
+		int p=socket(AF_UNIX, SOCK_STREAM, 0);
+		if(p>=0 && !connect(p, (struct sockaddr*)&sa, sizeof sa)) die("%s: another server is listening", path);
+		if(p>=0) close(p);
+		unlink(path);
+	}
+	int fd=socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd<0) die("socket: %s", strerror(errno));
+	set_cloexec(fd);
+	mode_t old=umask(~(mode_t)mode & 0777);   /* no window with a wider mode */
+	int r=bind(fd, (struct sockaddr*)&sa, sizeof sa);
+	umask(old);
+	if(r || listen(fd, backlog)) die("cannot bind %s: %s", path, strerror(errno));
+	return fd;
+}
+
+int http_listen_shared(const struct server_cfg *cfg, int *held){
+	*held=0;
+	int fd=inherited_listener(cfg->bind_addr, held);
+	if(fd>=0) return fd;
+	if(!strncmp(cfg->bind_addr, "unix:", 5)) return open_unix(cfg->bind_addr+5, cfg->backlog, cfg->socket_mode);
+	return -1;
+}
+
 static ssize_t read_full(int fd, void *buf, size_t cap, int timeout_sec){
 	(void)timeout_sec; /* keep it simple: blocking read */
 	return read(fd, buf, cap);
 }
 
-static void write_all(int fd, const void *buf, size_t n){
-	const char *p=(const char*)buf;
+static size_t write_all(int fd, const void *buf, size_t n){
+	const char *p=(const char*)buf; size_t done=0;
 	while(n){
 		ssize_t w=write(fd,p,n);
 		if(w<0){ if(errno==EINTR) continue; break; }
-		p+=w; n-=w;
+		p+=w; n-=w; done+=(size_t)w;
 	}
+	return done;
 }
 
-struct server_state { const struct server_cfg *cfg; llm_fn fn; };
+static size_t writev_all(int fd, struct iovec *iov, int n){
+	size_t done=0;
+	while(n){
+		ssize_t w=writev(fd,iov,n);
+		if(w<0){ if(errno==EINTR) continue; break; }
+		done+=(size_t)w;
+		for(; n && (size_t)w>=iov->iov_len; iov++, n--) w-=(ssize_t)iov->iov_len;
+		if(n){ iov->iov_base=(char*)iov->iov_base+w; iov->iov_len-=(size_t)w; }
+	}
+	return done;
+}
+
+/* --------------------------- prebuilt responses ---------------------------
+ * Built once before the first accept() and only read afterwards: the whole
+ * 200 (head and body) and its 304 twin, so a hit is a single write(). The
+ * index page is one too, rendered from the startup server_cfg. */
+struct canned {
+	char *full, *nm;          /* 200 with body; 304 Not Modified */
+	size_t nfull, nnm;
+	char etag[20];            /* strong: "<fnv-1a 64 of the body>" */
+};
+
+/* extra: header lines ("Name: value\r\n"...) sent with both */
+static void canned_build(struct canned *c, const char *ctype, const char *extra,
+                         const char *body, size_t n)
+{
+	uint64_t h=14695981039346656037ULL;
+	for(size_t i=0;i<n;i++){ h^=(unsigned char)body[i]; h*=1099511628211ULL; }
+	snprintf(c->etag, sizeof c->etag, "\"%016llx\"", (unsigned long long)h);
+	struct sbuf b; sb_init(&b);
+	sb_printf(&b, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+	          "ETag: %s\r\n%sConnection: close\r\n\r\n", ctype, n, c->etag, extra);
+	sb_putn(&b, body, n);
+	c->nfull=b.len; c->full=sb_steal(&b);
+	sb_printf(&b, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%sConnection: close\r\n\r\n",
+	          c->etag, extra);
+	c->nnm=b.len; c->nm=sb_steal(&b);
+}
 
-static char *route_index(const struct server_cfg *cfg){
-	return render_page(APP_TITLE, CSS_INLINE, cfg->model, cfg->temperature, "", "", NULL);
+static void canned_free(struct canned *c){ free(c->full); free(c->nm); }
+
+/* If-None-Match holds our tag (weak comparison, so W/"..." counts) or * */
+static int etag_match(const char *headers, const char *etag){
+	const char *v=http_header(headers, "If-None-Match");
+	if(!v) return 0;
+	size_t n=strcspn(v, "\r\n"), k=strlen(etag);
+	if(n==1 && *v=='*') return 1;
+	for(const char *p=v; p+k<=v+n; p++) if(!memcmp(p, etag, k)) return 1;
+	return 0;
+}
+
+static void canned_send(int fd, const struct canned *c, const char *headers, struct alog_rec *lr){
+	if(etag_match(headers, c->etag)){
+		lr->status=304;
+		lr->bytes=write_all(fd, c->nm, c->nnm);
+	}else lr->bytes=write_all(fd, c->full, c->nfull);
+}
+
+struct server_state {
+	const struct server_cfg *cfg; llm_fn fn;
+	uint64_t t_accept;        /* of the request being served */
+	uint64_t deadline_us;     /* its --timeout deadline */
+	uint64_t trace_id;        /* its trace_next(), 0 when not traced */
+	char *compact_hist;       /* --compact: its new history, once sent */
+	struct canned css;        /* /static/style.css */
+	char css_href[48];        /* its URL, versioned by the ETag */
+	struct canned index;      /* GET / */
+};
+
+static void static_init(struct server_state *st){
+	const struct server_cfg *cfg = st->cfg;
+	canned_build(&st->css, "text/css; charset=utf-8", CACHE_STATIC, CSS_INLINE, strlen(CSS_INLINE));
+	snprintf(st->css_href, sizeof st->css_href, "/static/style.css?v=%.16s", st->css.etag+1);
+	/* the blank form only changes with the flags, so browsers may keep
+	   it as long as they ask first */
+	char *html = render_page(APP_TITLE, st->css_href, cfg->model, cfg->temperature, "", "", NULL, 0, NULL);
+	canned_build(&st->index, "text/html; charset=utf-8",
+	             CSP_HEADER XFO_HEADER REF_HEADER CACHE_REVALIDATE, html, strlen(html));
+	free(html);
+}
+
+/* --routes: a model's timeout= replaces --timeout, still from accept */
+static uint64_t deadline_for(const struct server_state *st, const char *model){
+	int t=route_timeout(model);
+	return t>0? st->t_accept + (uint64_t)t*1000000 : st->deadline_us;
+}
+
+/* a rendered page: head and document in one writev */
+static void send_html(int fd, const char *html, struct alog_rec *lr){
+	char hdr[512];
+	size_t n=strlen(html);
+	int k=snprintf(hdr, sizeof hdr, "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\n"
+	               "Content-Length: %zu\r\n" CSP_HEADER XFO_HEADER REF_HEADER CACHECTL
+	               "Connection: close\r\n\r\n", n);
+	struct iovec iov[2]={ { hdr, (size_t)k }, { (void*)html, n } };
+	lr->bytes=writev_all(fd, iov, 2);
 }
 
 /* History format (stateless):
@@ -72,19 +257,22 @@ static void history_append(struct sbuf *h, const char prefix, const char *conten
 	sb_printf(h, "%c: %s", prefix, content);
 }
 
+/* Entries before skip are in the system prompt's summary (--compact):
+ * they go into the transcript only. */
 static void messages_from_history(struct sbuf *transcript_pre,
                                   struct llm_msg *msgs, int *nmsgs,
                                   const char *system_prompt,
-                                  const char *history_raw)
+                                  const char *history_raw, int skip)
 {
 	int n=0;
 	if(system_prompt && *system_prompt){
 		msgs[n++] = (struct llm_msg){ "system", system_prompt };
 	}
+	int first=n;
 	if(history_raw && *history_raw){
 		/* iterate records */
 		const char *p=history_raw;
-		while(*p){
+		for(int i=0; *p; i++){
 			const char *sep = strstr(p, "\n\n===\n\n");
 			size_t len = sep? (size_t)(sep-p): strlen(p);
 			if(len>=3 && (p[0]=='U'||p[0]=='A') && p[1]==':' && p[2]==' '){
@@ -95,28 +283,74 @@ static void messages_from_history(struct sbuf *transcript_pre,
 				char *esc = html_escape(frag);
 				sb_printf(transcript_pre, "%s: %s\n\n", role, esc);
 				free(esc);
+				if(i < skip){ free(frag); if(!sep) break; p = sep + 7; continue; }
+				/* keep the last MAX_TURNS turns: drop the oldest when full */
+				if(n == first + MAX_TURNS*2){
+					free((void*)msgs[first].content);
+					memmove(&msgs[first], &msgs[first+1], (size_t)(n-first-1)*sizeof *msgs);
+					n--;
+				}
 				msgs[n++] = (struct llm_msg){ role, frag };
-				if(n >= MAX_TURNS*2+2) break; /* cap turns */
 			}
 			if(!sep) break;
-			p = sep + 6;
+			p = sep + 7;
 		}
 	}
 	*nmsgs = n;
 }
 
-static char *handle_chat(struct server_state *st, const char *body){
+/* Drop the oldest history turns until the prompt fits the token budget.
+ * A leading system message and the final user prompt are always kept. */
+static void trim_to_budget(const struct server_cfg *cfg, struct llm_msg *msgs, int *nmsgs){
+	if(cfg->context_tokens<=0) return;
+	long budget = (long)cfg->context_tokens - (cfg->max_tokens>0? cfg->max_tokens : 0) - 3;
+	int n=*nmsgs, first = (n && !strcmp(msgs[0].role,"system"))? 1 : 0;
+	long used=0;
+	size_t cost[1 + MAX_TURNS*2 + 1];
+	for(int i=0;i<n;i++){ cost[i]=bpe_count_msg(cfg->bpe, msgs[i].content); used+=(long)cost[i]; }
+	int drop=0;
+	while(used > budget && first+drop < n-1){ used-=(long)cost[first+drop]; drop++; }
+	if(!drop) return;
+	for(int i=first;i<first+drop;i++) free((void*)msgs[i].content);
+	memmove(&msgs[first], &msgs[first+drop], (size_t)(n-first-drop)*sizeof *msgs);
+	*nmsgs = n-drop;
+}
+
+enum { F_PROMPT, F_MODEL, F_TEMP, F_HISTORY, F_CONV, F_AT, F_NKEYS };
+static const char *const form_keys[F_NKEYS] = { "prompt", "model", "temp", "history", "conv", "at" };
+
+/* body is owned by the caller and decoded in place */
+static char *handle_chat(struct server_state *st, char *body, struct alog_rec *lr){
 	const struct server_cfg *cfg = st->cfg;
-	char *prompt  = form_get(body, "prompt");
-	char *model   = form_get(body, "model");
-	char *tempstr = form_get(body, "temp");
-	char *history = form_get(body, "history");
-	double temp = tempstr? atof(tempstr) : cfg->temperature;
-	if(!model||!*model) { free(model); model=xstrdup(cfg->model); }
+	char *f[F_NKEYS];
+	uint64_t t0 = trace_t0(st->trace_id);
+	form_parse(body, form_keys, F_NKEYS, f);
+	trace_span(st->trace_id, "form_parse", t0);
+	const char *prompt  = f[F_PROMPT];
+	const char *model   = f[F_MODEL] && *f[F_MODEL] ? f[F_MODEL] : cfg->model;
+	const char *history = f[F_HISTORY];
+	double temp = f[F_TEMP]? atof(f[F_TEMP]) : cfg->temperature;
+	snprintf(lr->model, sizeof lr->model, "%s", model);
+
+	/* --store: the page carries an id and the number of entries it shows
+	   instead of the history itself */
+	char conv[STORE_ID_LEN+1]="", *stored=NULL;
+	int at=0, lost=0;
+	if(store_active() && f[F_CONV] && *f[F_CONV]){
+		snprintf(conv, sizeof conv, "%s", f[F_CONV]);
+		t0 = trace_t0(st->trace_id);
+		if(!(stored=store_history(conv, f[F_AT]? atoi(f[F_AT]) : 0, &at))){ conv[0]=0; lost=1; }
+		trace_span(st->trace_id, "store_history", t0);
+		history=stored;
+	}
 
 	struct sbuf transcript; sb_init(&transcript);
 	struct llm_msg msgs[1 + MAX_TURNS*2 + 1]; int nmsgs=0;
-	messages_from_history(&transcript, msgs, &nmsgs, "", history);
+	t0 = trace_t0(st->trace_id);
+	int skip = 0;
+	char *summary = cfg->compact && prompt && *prompt? compact_lookup(history, &skip) : NULL;
+	messages_from_history(&transcript, msgs, &nmsgs, summary, history, skip);
+	trace_span(st->trace_id, "messages_from_history", t0);
 
 	/* Append current user prompt */
 	if(prompt && *prompt){
@@ -127,23 +361,35 @@ static char *handle_chat(struct server_state *st, const char *body){
 		free(esc);
 	}else{
 		/* If no prompt, just render existing state */
-		char *html = render_page(APP_TITLE, CSS_INLINE, model, temp,
-		                         transcript.s, history?history:"", NULL);
+		t0 = now_us();
+		char *html = render_page(APP_TITLE, st->css_href, model, temp,
+		                         transcript.s, history?history:"", *conv? conv : NULL, at,
+		                         lost? "This conversation is no longer stored." : NULL);
+		lr->render_us = (uint32_t)(now_us()-t0);
+		trace_span(st->trace_id, "render_page", t0);
 		/* free allocated message contents from history */
 		for(int i=0;i<nmsgs;i++){ if(msgs[i].content) free((void*)msgs[i].content); }
-		free(prompt); free(model); free(tempstr); free(history); sb_free(&transcript);
+		sb_free(&transcript);
+		free(stored);
 		return html;
 	}
 
+	trim_to_budget(cfg, msgs, &nmsgs);
+
 	struct llm_req req = {
 		.msgs = msgs, .nmsgs = nmsgs,
 		.model = model, .temperature = temp, .max_tokens = cfg->max_tokens,
 		.api_base = cfg->api_base, .api_key = cfg->api_key,
-		.no_network = cfg->no_network, .hme_argv = cfg->hme_argv, .hme_argc = cfg->hme_argc,
-		.trt_engine_path = cfg->trt_engine
+		.no_network = cfg->no_network, .http2 = cfg->http2, .hme_argv = cfg->hme_argv, .hme_argc = cfg->hme_argc,
+		.trt_engine_path = cfg->trt_engine,
+		.deadline_us = deadline_for(st, model), .trace_id = st->trace_id
 	};
 	struct llm_resp resp = {0};
-	int rc = st->fn(&req, &resp);
+	t0 = now_us();
+	int rc = cfg->ups ? upstream_complete(cfg->ups, st->fn, &req, &resp)
+	                  : st->fn(&req, &resp);
+	lr->backend_us = (uint32_t)(now_us()-t0);
+	trace_span(st->trace_id, "backend", t0);
 
 	char *err_html=NULL;
 	if(rc!=0 || resp.status!=0){
@@ -151,7 +397,7 @@ static char *handle_chat(struct server_state *st, const char *body){
 		sb_printf(&e, "Error (%d/%d): ", rc, resp.status);
 		if(resp.err){ char *eh=html_escape(resp.err); sb_puts(&e, eh); free(eh); }
 		err_html = sb_steal(&e);
-	}
+	}else if(lost) err_html = xstrdup("This conversation is no longer stored; it starts over here.");
 
 	/* Append assistant answer into transcript and history */
 	struct sbuf h; sb_init(&h);
@@ -163,24 +409,269 @@ static char *handle_chat(struct server_state *st, const char *body){
 	sb_printf(&transcript, "assistant: %s\n\n", ans_esc);
 	free(ans_esc);
 
-	char *html = render_page(APP_TITLE, CSS_INLINE, model, temp,
-	                         transcript.s, h.s, err_html);
+	/* --store: only this turn's entries go to disk, or all of them for a
+	   new conversation; should that fail the page holds the history again */
+	int stored_n=-1;
+	if(store_active()){
+		struct sbuf add; sb_init(&add);
+		if(*conv){
+			if(prompt && *prompt)   history_append(&add, 'U', prompt);
+			if(resp.content && *resp.content) history_append(&add, 'A', resp.content);
+		}
+		t0 = trace_t0(st->trace_id);
+		stored_n = store_append(conv, at, *conv? add.s : h.s);
+		trace_span(st->trace_id, "store_append", t0);
+		sb_free(&add);
+	}
+
+	t0 = now_us();
+	char *html = render_page(APP_TITLE, st->css_href, model, temp,
+	                         transcript.s, h.s, stored_n>0? conv : NULL, stored_n, err_html);
+	lr->render_us = (uint32_t)(now_us()-t0);
+	trace_span(st->trace_id, "render_page", t0);
 
 	free(err_html);
 	free(resp.content); free(resp.err);
 	for(int i=0;i<nmsgs;i++){
 		if(msgs[i].content) free((void*)msgs[i].content);
 	}
-	free(prompt); free(model); free(tempstr); free(history);
+	if(cfg->compact) st->compact_hist = sb_steal(&h);
 	sb_free(&h); sb_free(&transcript);
+	free(stored);
+	return html;
+}
+
+/* GET /c/ID (--store): a stored conversation, to go on with */
+static char *resume_page(struct server_state *st, const char *id){
+	int n;
+	char *history = store_history(id, 0, &n);
+	if(!history) return NULL;
+	struct sbuf transcript; sb_init(&transcript);
+	struct llm_msg msgs[MAX_TURNS*2]; int nmsgs=0;
+	messages_from_history(&transcript, msgs, &nmsgs, NULL, history, 0);
+	for(int i=0;i<nmsgs;i++) free((void*)msgs[i].content);
+	char *html = render_page(APP_TITLE, st->css_href, st->cfg->model, st->cfg->temperature,
+	                         transcript.s? transcript.s : "", NULL, id, n, NULL);
+	sb_free(&transcript);
+	free(history);
 	return html;
 }
 
-static void handle_conn(struct server_state *st, int cfd){
+/* ------------------------- /v1/chat/completions ---------------------------
+ * OpenAI-shaped JSON in and out, through the same backend, replica set and
+ * deadline as the web UI. With "stream":true the reply is SSE: the headers
+ * go out with the first delta and every delta is written to the client as
+ * it comes off the upstream connection; a backend that cannot stream gives
+ * one event with the whole answer. History trimming is left to the client. */
+static const char *reason(int code){
+	switch(code){
+	case 200: return "OK";
+	case 400: return "Bad Request";
+	case 401: return "Unauthorized";
+	case 403: return "Forbidden";
+	case 404: return "Not Found";
+	case 413: return "Payload Too Large";
+	case 422: return "Unprocessable Entity";
+	case 429: return "Too Many Requests";
+	case 502: return "Bad Gateway";
+	case 504: return "Gateway Timeout";
+	default:  return "Error";
+	}
+}
+
+/* HTTP status and OpenAI error type for a failed completion */
+static int error_status(const struct llm_resp *r, const char **type){
+	switch(r->status){
+	case LLM_ETHROTTLED: *type="rate_limit_exceeded"; return 429;
+	case LLM_EREJECTED:
+		*type="invalid_request_error";
+		return r->http_status>=400 && r->http_status<500? r->http_status : 400;
+	case LLM_ETIMEOUT:   *type="timeout"; return 504;
+	default:             *type="upstream_error"; return 502;
+	}
+}
+
+static void error_json(struct sbuf *b, const char *msg, const char *type){
+	sb_puts(b, "{\"error\":{\"message\":");
+	json_escape_into(b, msg);
+	sb_printf(b, ",\"type\":\"%s\"}}", type);
+}
+
+/* headers and body in one writev, no concatenation */
+static void send_json(int fd, int code, const char *extra, const struct sbuf *body, struct alog_rec *lr){
+	char hdr[512];
+	int n=snprintf(hdr, sizeof hdr, "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n"
+	               "Content-Length: %zu\r\n%s" CACHECTL "Connection: close\r\n\r\n",
+	               code, reason(code), body->len, extra? extra : "");
+	struct iovec iov[2]={ { hdr, (size_t)n }, { body->s, body->len } };
+	lr->status=code;
+	lr->bytes=writev_all(fd, iov, 2);
+}
+
+struct sse_out {
+	int fd, started, failed;
+	struct sbuf ev;           /* reused for every event */
+	size_t pre;               /* ev.s[0..pre): "data: {id,object,created,model," */
+	size_t bytes;
+};
+
+static int sse_write(struct sse_out *o){
+	if(!o->started){
+		static const char h[]="HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+		                      CACHECTL "Connection: close\r\n\r\n";
+		/* one small write per token: do not let Nagle hold them back */
+		int on=1;
+		setsockopt(o->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+		struct iovec iov[2]={ { (void*)h, sizeof h - 1 }, { o->ev.s, o->ev.len } };
+		size_t w=writev_all(o->fd, iov, 2);
+		o->bytes+=w;
+		if(w < sizeof h - 1 + o->ev.len) o->failed=1;
+		return o->failed? -1 : 0;
+	}
+	size_t w=write_all(o->fd, o->ev.s, o->ev.len);
+	o->bytes+=w;
+	if(w<o->ev.len) o->failed=1;
+	return o->failed? -1 : 0;
+}
+
+static int sse_delta(void *arg, const char *text, size_t n){
+	struct sse_out *o=arg;
+	o->ev.len=o->pre;
+	sb_puts(&o->ev, o->started? "\"choices\":[{\"index\":0,\"delta\":{\"content\":"
+	                          : "\"choices\":[{\"index\":0,\"delta\":{\"role\":\"assistant\",\"content\":");
+	json_escape_n(&o->ev, text, n);
+	sb_puts(&o->ev, "},\"finish_reason\":null}]}\n\n");
+	int rc=sse_write(o);
+	o->started=1;
+	return rc;
+}
+
+static void handle_completions(struct server_state *st, int fd, const char *body, struct alog_rec *lr){
+	const struct server_cfg *cfg = st->cfg;
+	struct llm_msg *msgs=NULL;
+	uint64_t t0 = trace_t0(st->trace_id);
+	int nmsgs=json_messages(body, &msgs), bad=!nmsgs;
+	for(int i=0;i<nmsgs;i++) if(!msgs[i].content) bad=1;
+	char *model=json_string(json_member(body, "model"));
+	const char *t=json_member(body, "temperature"), *mt=json_member(body, "max_tokens");
+	const char *sv=json_member(body, "stream");
+	int stream = sv && !strncmp(sv, "true", 4);
+	trace_span(st->trace_id, "json_parse", t0);
+	snprintf(lr->model, sizeof lr->model, "%s", model? model : cfg->model);
+
+	struct sbuf out; sb_init(&out);
+	unsigned long long id=(unsigned long long)now_us();
+	long long created=(long long)(now_ms()/1000);
+	struct sse_out o = { .fd = fd };
+	sb_init(&o.ev);
+	if(bad){
+		error_json(&out, "messages must be a non-empty array of {role, content} strings",
+		           "invalid_request_error");
+		send_json(fd, 400, NULL, &out, lr);
+		goto done;
+	}
+
+	struct llm_req req = {
+		.msgs = msgs, .nmsgs = nmsgs,
+		.model = model? model : cfg->model,
+		.temperature = t? atof(t) : cfg->temperature,
+		.max_tokens = mt? atoi(mt) : cfg->max_tokens,
+		.api_base = cfg->api_base, .api_key = cfg->api_key,
+		.no_network = cfg->no_network, .http2 = cfg->http2, .hme_argv = cfg->hme_argv, .hme_argc = cfg->hme_argc,
+		.trt_engine_path = cfg->trt_engine,
+		.deadline_us = deadline_for(st, model? model : cfg->model), .trace_id = st->trace_id
+	};
+	if(stream){
+		sb_printf(&o.ev, "data: {\"id\":\"chatcmpl-%llx\",\"object\":\"chat.completion.chunk\","
+		                 "\"created\":%lld,\"model\":", id, created);
+		json_escape_into(&o.ev, req.model);
+		sb_putc(&o.ev, ',');
+		o.pre=o.ev.len;
+		req.on_delta=sse_delta; req.delta_arg=&o;
+	}
+	struct llm_resp resp = {0};
+	t0 = now_us();
+	int rc = cfg->ups ? upstream_complete(cfg->ups, st->fn, &req, &resp)
+	                  : st->fn(&req, &resp);
+	lr->backend_us = (uint32_t)(now_us()-t0);
+	trace_span(st->trace_id, "backend", t0);
+	if(rc==0 && resp.status) rc=-1;
+	t0 = trace_t0(st->trace_id);
+
+	if(rc!=0 && !o.started){
+		const char *type;
+		int code=error_status(&resp, &type);
+		char extra[64]="";
+		if(code==429 && resp.retry_after_ms>0)
+			snprintf(extra, sizeof extra, "Retry-After: %d\r\n", (resp.retry_after_ms+999)/1000);
+		error_json(&out, resp.err? resp.err : "backend error", type);
+		send_json(fd, code, extra, &out, lr);
+	}else if(stream){
+		/* a backend that cannot stream: its whole answer as one delta */
+		if(rc==0 && !o.started) sse_delta(&o, resp.content? resp.content : "", resp.content? strlen(resp.content) : 0);
+		if(!o.failed){
+			o.ev.len=o.pre;
+			if(rc==0) sb_puts(&o.ev, "\"choices\":[{\"index\":0,\"delta\":{},\"finish_reason\":\"stop\"}]}\n\n"
+			                       "data: [DONE]\n\n");
+			else{
+				const char *type;
+				error_status(&resp, &type);
+				o.ev.len=0;
+				sb_puts(&o.ev, "data: ");
+				error_json(&o.ev, resp.err? resp.err : "backend error", type);
+				sb_puts(&o.ev, "\n\n");
+			}
+			sse_write(&o);
+		}
+		lr->status=200;
+		lr->bytes=o.bytes;
+	}else{
+		sb_printf(&out, "{\"id\":\"chatcmpl-%llx\",\"object\":\"chat.completion\",\"created\":%lld,"
+		                "\"model\":", id, created);
+		json_escape_into(&out, req.model);
+		sb_puts(&out, ",\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":");
+		json_escape_into(&out, resp.content);
+		sb_puts(&out, "},\"finish_reason\":\"stop\"}]}");
+		send_json(fd, 200, NULL, &out, lr);
+	}
+	trace_span(st->trace_id, "write", t0);
+	free(resp.content); free(resp.err);
+done:
+	sb_free(&o.ev);
+	sb_free(&out);
+	for(int i=0;i<nmsgs;i++){ free((void*)msgs[i].role); free((void*)msgs[i].content); }
+	free(msgs);
+	free(model);
+}
+
+/* body of clen bytes: nhave already read in `have`, the rest from fd */
+static char *read_body(int fd, const char *have, size_t nhave, size_t clen){
+	char *b = xmalloc(clen+1);
+	size_t n = nhave<clen? nhave : clen;
+	memcpy(b, have, n);
+	while(n<clen){
+		ssize_t r = read_full(fd, b+n, clen-n, IO_TIMEOUT_SEC);
+		if(r<0 && errno==EINTR) continue;
+		if(r<=0) break;
+		n+=(size_t)r;
+	}
+	b[n]=0;
+	return b;
+}
+
+static void handle_conn(struct server_state *st, int cfd, uint64_t t_accept, struct alog_rec *lr){
 	char buf[8192];
-	ssize_t r = read_full(cfd, buf, sizeof buf - 1, IO_TIMEOUT_SEC);
-	if(r<=0) return;
-	buf[r]=0;
+	size_t r=0;
+	char *eoh=NULL;
+	/* read until end of headers; the body may follow in the same reads */
+	while(!eoh && r < sizeof buf - 1){
+		ssize_t n = read_full(cfd, buf+r, sizeof buf - 1 - r, IO_TIMEOUT_SEC);
+		if(n<0 && errno==EINTR) continue;
+		if(n<=0) break;
+		r+=(size_t)n; buf[r]=0;
+		eoh = strstr(buf, "\r\n\r\n");
+	}
+	if(!r) return;
 
 	/* crude parse */
 	char *method = buf;
@@ -193,48 +684,150 @@ static void handle_conn(struct server_state *st, int cfd){
 	*sp2=0;
 
 	char *headers = sp2+1;
-	char *body = strstr(headers, "\r\n\r\n");
+	char *body = eoh;
 	size_t bodylen=0;
-	if(body){ *body=0; body+=4; bodylen = (size_t)(buf + r - body); }
+	if(body){
+		body[2]=0; body+=4; bodylen = (size_t)(buf + r - body);
+		const char *cl = http_header(headers, "Content-Length");
+		if(cl) bodylen = strtoul(cl, NULL, 10);
+	}
 
+	lr->queue_us = (uint32_t)(now_us()-t_accept);
+	trace_span(st->trace_id, "read headers", t_accept);
+	lr->status = 200;
 	if(strcmp(method,"GET")==0 && strcmp(path,"/")==0){
-		char *html = route_index(st->cfg);
-		write_all(cfd, html, strlen(html));
-		free(html);
+		lr->route = "/";
+		canned_send(cfd, &st->index, headers, lr);
+		return;
+	}
+	/* the ?v= query only busts caches; any version gets the current file */
+	if(strcmp(method,"GET")==0 && !strncmp(path,"/static/style.css",17) && (!path[17] || path[17]=='?')){
+		lr->route = "/static/style.css";
+		canned_send(cfd, &st->css, headers, lr);
 		return;
 	}
 	if(strcmp(method,"GET")==0 && strcmp(path,"/health")==0){
 		const char *resp = "HTTP/1.1 200 OK\r\nContent-Type:text/plain\r\n"
 		                   "Connection: close\r\n\r\nok\n";
-		write_all(cfd, resp, strlen(resp));
+		lr->route = "/health";
+		lr->bytes = write_all(cfd, resp, strlen(resp));
 		return;
 	}
-	if(strcmp(method,"POST")==0 && strcmp(path,"/chat")==0){
+	if(strcmp(method,"GET")==0 && !strncmp(path,"/c/",3) && store_active()){
+		uint64_t t0 = trace_t0(st->trace_id);
+		char *html = resume_page(st, path+3);
+		trace_span(st->trace_id, "resume", t0);
+		if(html){
+			lr->route = "/c/";
+			send_html(cfd, html, lr);
+			free(html);
+			return;
+		}
+	}
+	int api = !strcmp(path,"/v1/chat/completions");
+	if(strcmp(method,"POST")==0 && (api || strcmp(path,"/chat")==0)){
+		lr->route = api? "/v1/chat/completions" : "/chat";
 		/* ensure body not huge */
 		if(bodylen > MAX_REQ_BODY){
 			const char *resp = "HTTP/1.1 413 Payload Too Large\r\nConnection: close\r\n\r\n";
-			write_all(cfd, resp, strlen(resp)); return;
+			lr->status = 413;
+			lr->bytes = write_all(cfd, resp, strlen(resp)); return;
 		}
-		/* copy body to owned buffer and handle */
-		char *b = xmalloc(bodylen+1); memcpy(b, body, bodylen); b[bodylen]=0;
-		char *html = handle_chat(st, b);
-		write_all(cfd, html, strlen(html));
-		free(html); free(b);
+		/* read the rest of the body into an owned buffer and handle */
+		uint64_t t0 = trace_t0(st->trace_id);
+		char *b = read_body(cfd, body? body:"", body? (size_t)(buf + r - body) : 0, bodylen);
+		trace_span(st->trace_id, "read body", t0);
+		if(api) handle_completions(st, cfd, b, lr);
+		else{
+			char *html = handle_chat(st, b, lr);
+			t0 = trace_t0(st->trace_id);
+			send_html(cfd, html, lr);
+			trace_span(st->trace_id, "write", t0);
+			free(html);
+			/* the user reads the answer while the next summary is written */
+			compact_submit(st->compact_hist);
+			st->compact_hist = NULL;
+		}
+		free(b);
 		return;
 	}
 	const char *nf = "HTTP/1.1 404 Not Found\r\nConnection: close\r\n\r\n";
-	write_all(cfd, nf, strlen(nf));
+	lr->route = "404"; lr->status = 404;
+	lr->bytes = write_all(cfd, nf, strlen(nf));
+}
+
+/* SIGTERM: stop accepting, let the request in flight finish, exit; past
+   DRAIN_SEC the default SIGALRM action ends it anyway */
+static volatile sig_atomic_t drain, usr2;
+
+static void on_term(int sig){
+	(void)sig;
+	if(!drain) alarm(DRAIN_SEC);
+	drain=1;
 }
 
+static void on_usr2(int sig){ (void)sig; usr2=1; }
+
 int run_http_server(const struct server_cfg *cfg, llm_fn fn){
-	int lfd = open_listen(cfg->bind_addr);
-	struct server_state st = { cfg, fn };
+	int lfd = cfg->listen_fd>=0? cfg->listen_fd : open_listen(cfg->bind_addr, cfg->backlog, cfg->procs>1);
+	struct server_state st = { .cfg = cfg, .fn = fn };
+	static_init(&st);
+	/* the loop polls so that it sees the signals between connections;
+	   SA_RESTART leaves the request in flight alone. The listener is
+	   non-blocking: another process may take the connection first. */
+	fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof sa);
+	sa.sa_flags=SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler=on_term;
+	sigaction(SIGTERM, &sa, NULL);
+	/* under --procs the supervisor takes SIGUSR2 */
+	sa.sa_handler=on_usr2;
+	if(cfg->procs<=1) sigaction(SIGUSR2, &sa, NULL);
+	reload_ready();
+	int handed=0;
 	for(;;){
+		if(usr2){
+			usr2=0;
+			if(!cfg->reload) warnx("SIGUSR2: the sandbox would bind the new instance too; run with --procs to reload");
+			else if(!reload_exec(lfd, cfg->listen_held)){ handed=1; on_term(SIGTERM); }
+		}
+		/* what is queued on a listener no one else accepts on is served
+		   before leaving, or it would be reset */
+		if(drain && (handed || cfg->listen_held)) break;
+		struct pollfd pf={ lfd, POLLIN, 0 };
+		int k=poll(&pf, 1, drain? 0 : LISTEN_POLL_MS);
+		if(k<0 && errno!=EINTR) break;
+		if(k<=0){ if(drain) break; continue; }
 		int cfd = accept(lfd, NULL, NULL);
-		if(cfd<0){ if(errno==EINTR) continue; break; }
-		handle_conn(&st, cfd);
+		if(cfd<0){
+			if(errno==EINTR || errno==EAGAIN || errno==EWOULDBLOCK || errno==ECONNABORTED) continue;
+			break;
+		}
+#if !defined(__linux__)
+		/* BSD accept() hands the listener's O_NONBLOCK on */
+		fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) & ~O_NONBLOCK);
+#endif
+		set_cloexec(cfd);
+		uint64_t t_accept = now_us();
+		st.t_accept = t_accept;
+		st.deadline_us = cfg->timeout_sec>0? t_accept + (uint64_t)cfg->timeout_sec*1000000 : 0;
+		st.trace_id = trace_next();
+		struct alog_rec lr = { .ts_ms = now_ms() };
+		handle_conn(&st, cfd, t_accept, &lr);
 		close(cfd);
+		if(lr.route){
+			lr.total_us = (uint32_t)(now_us()-t_accept);
+			alog_submit(&lr);
+		}
+		if(st.trace_id){
+			trace_span(st.trace_id, lr.route? lr.route : "request", t_accept);
+			trace_flush(st.trace_id);
+		}
 	}
 	close(lfd);
+	canned_free(&st.css);
+	canned_free(&st.index);
 	return 0;
 }
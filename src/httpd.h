@@ -6,24 +6,49 @@
 #define HTTPD_H
 #include "util.h"
 #include "tmpl.h"
+#include "upstream.h"
 #include "../include/llm_backend.h"
 
 struct server_cfg {
 	const char *bind_addr;
+	int backlog;              /* listen() queue, --backlog */
+	int socket_mode;          /* --socket-mode, for --bind unix:PATH */
+	int listen_fd;            /* from http_listen_shared(), or -1 */
+	int listen_held;          /* and a service manager keeps it open too */
+	int procs;                /* --procs workers, each with its own listener */
+	int reload;               /* SIGUSR2 may re-exec this (single) process */
 	const char *backend;      /* "openai" or "trtllm" */
-	const char *api_base;
+	const char *api_base;     /* first --api-base */
+	const char **api_bases;   /* all --api-base values */
+	int napi_bases;
+	struct upstream_set *ups; /* replica set for the openai backend, or NULL */
 	const char *api_key;
 	const char **hme_argv;
 	int hme_argc;
 	int no_network;
+	int http2;                /* --http2 */
 	const char *trt_engine;
 	const char *model;
 	double temperature;
 	int max_tokens;
+	int timeout_sec;          /* per-request upstream deadline */
+	int context_tokens;       /* 0: no token budget (MAX_TURNS only) */
+	int compact;              /* --compact: summarize /chat history past N entries */
+	struct bpe *bpe;          /* from --vocab; NULL: bytes/4 estimate */
 	int verbose;
+	const char *access_log;   /* NULL: off unless -v ("-" = stderr) */
+	int access_log_fmt;       /* ALOG_JSON or ALOG_LOGFMT */
+	unsigned access_log_sample;
 	int sessioned; /* reserved for future */
 };
 
+/* The listener all --procs workers accept on, opened before they fork: an
+   inherited socket (LISTEN_FDS, --bind fd:N) or --bind unix:PATH. -1 for
+   HOST:PORT, which each worker binds with SO_REUSEPORT. *held is set when
+   whoever passed it down keeps it open, so that connections queued on it
+   need not be served before exiting. Dies on failure. */
+int http_listen_shared(const struct server_cfg *cfg, int *held);
+
 int run_http_server(const struct server_cfg *cfg, llm_fn fn);
 
 #endif
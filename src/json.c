@@ -0,0 +1,211 @@
+/*==============================================================================
+ * src/json.c  —  minimal JSON codec for the OpenAI wire format
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "json.h"
+#include "util.h"
+#include "../config.h"
+#include <string.h>
+
+/* --- Minimal JSON builder & string escaper --- */
+void json_escape_into(struct sbuf *b, const char *s){
+	json_escape_n(b, s, s? strlen(s) : 0);
+}
+
+void json_escape_n(struct sbuf *b, const char *s, size_t n){
+	sb_putc(b,'"');
+	if (s) for(const unsigned char *p=(const unsigned char*)s, *e=p+n; p<e; ++p){
+		switch(*p){
+			case '\\': sb_puts(b,"\\\\"); break;
+			case '"':  sb_puts(b,"\\\""); break;
+			case '\n': sb_puts(b,"\\n"); break;
+			case '\r': sb_puts(b,"\\r"); break;
+			case '\t': sb_puts(b,"\\t"); break;
+			default:
+				if(*p < 0x20) sb_printf(b,"\\u%04x", (unsigned)*p);
+				else sb_putc(b,*p);
+		}
+	}
+	sb_putc(b,'"');
+}
+
+char *build_openai_json(const struct llm_req *r){
+	struct sbuf b; sb_init(&b);
+	sb_puts(&b, "{");
+	sb_puts(&b, "\"model\":"); json_escape_into(&b, r->model ? r->model : DEF_MODEL);
+	sb_printf(&b, ",\"temperature\":%.3f", r->temperature);
+	if(r->max_tokens>0) sb_printf(&b, ",\"max_tokens\":%d", r->max_tokens);
+	if(r->on_delta) sb_puts(&b, ",\"stream\":true");
+	sb_puts(&b, ",\"messages\":[");
+	for(int i=0;i<r->nmsgs;i++){
+		if(i) sb_putc(&b, ',');
+		sb_puts(&b, "{\"role\":"); json_escape_into(&b, r->msgs[i].role);
+		sb_puts(&b, ",\"content\":"); json_escape_into(&b, r->msgs[i].content);
+		sb_puts(&b, "}");
+	}
+	sb_puts(&b, "]}");
+	return sb_steal(&b);
+}
+
+/* Extract first choices[0].message.content via a simple matcher (no full JSON) */
+char *extract_content(const char *json){
+	if(!json) return NULL;
+	const char *p = strstr(json, "\"content\"");
+	if(!p) return NULL;
+
+	/* Find the first quote after the colon: "content": " ... " */
+	const char *colon = strchr(p, ':'); if(!colon) return NULL;
+	const char *start = strchr(colon, '"'); if(!start) return NULL;
+	start++;
+
+	struct sbuf b; sb_init(&b);
+	for(const char *s=start; *s; ++s){
+		if(*s=='"'){ /* if not escaped, it's the end */
+			const char *prev=s-1; int esc=0;
+			while(prev>=start && *prev=='\\'){ esc^=1; prev--; }
+			if(!esc){
+				return sb_steal(&b);
+			}
+		}
+		if(*s=='\\'){
+			++s;
+			if(!*s){ break; }
+			switch(*s){
+				case 'n': sb_putc(&b,'\n'); break;
+				case 'r': /* ignore */ break;
+				case 't': sb_putc(&b,'\t'); break;
+				case '"': sb_putc(&b,'"'); break;
+				case '\\': sb_putc(&b,'\\'); break;
+				default: sb_putc(&b,'\\'); sb_putc(&b,*s); break;
+			}
+		}else{
+			sb_putc(&b,*s);
+		}
+	}
+	sb_free(&b);
+	return NULL;
+}
+
+/* --- Minimal JSON reader: enough to walk one request object --- */
+static const char *ws(const char *p){
+	while(*p==' '||*p=='\t'||*p=='\r'||*p=='\n') p++;
+	return p;
+}
+
+const char *json_skip(const char *p){
+	p=ws(p);
+	if(*p=='"'){
+		for(p++; *p && *p!='"'; p++) if(*p=='\\' && p[1]) p++;
+		return *p? p+1 : NULL;
+	}
+	if(*p=='{' || *p=='['){
+		int depth=0;
+		for(; *p; p++){
+			if(*p=='"'){ if(!(p=json_skip(p))) return NULL; p--; continue; }
+			if(*p=='{' || *p=='[') depth++;
+			else if((*p=='}' || *p==']') && --depth==0) return p+1;
+		}
+		return NULL;
+	}
+	const char *s=p;
+	while(*p && !strchr(",:}] \t\r\n", *p)) p++;
+	return p>s? p : NULL;
+}
+
+const char *json_member(const char *obj, const char *key){
+	size_t kl=strlen(key);
+	const char *p=ws(obj);
+	if(*p++!='{') return NULL;
+	for(;;){
+		p=ws(p);
+		if(*p!='"') return NULL;
+		const char *k=p, *e=json_skip(p);
+		if(!e) return NULL;
+		int hit = (size_t)(e-k)==kl+2 && !memcmp(k+1, key, kl);
+		p=ws(e);
+		if(*p++!=':') return NULL;
+		p=ws(p);
+		if(hit) return p;
+		if(!(p=json_skip(p))) return NULL;
+		p=ws(p);
+		if(*p++!=',') return NULL;
+	}
+}
+
+static void put_utf8(struct sbuf *b, unsigned long c){
+	if(c<0x80) sb_putc(b,(char)c);
+	else if(c<0x800){ sb_putc(b,(char)(0xC0|c>>6)); sb_putc(b,(char)(0x80|(c&63))); }
+	else if(c<0x10000){ sb_putc(b,(char)(0xE0|c>>12)); sb_putc(b,(char)(0x80|((c>>6)&63))); sb_putc(b,(char)(0x80|(c&63))); }
+	else{ sb_putc(b,(char)(0xF0|c>>18)); sb_putc(b,(char)(0x80|((c>>12)&63))); sb_putc(b,(char)(0x80|((c>>6)&63))); sb_putc(b,(char)(0x80|(c&63))); }
+}
+
+static long hex4(const char *p){
+	long v=0;
+	for(int i=0;i<4;i++){
+		int c=(unsigned char)p[i], d = c>='0'&&c<='9'? c-'0' : (c|32)>='a'&&(c|32)<='f'? (c|32)-'a'+10 : -1;
+		if(d<0) return -1;
+		v=v*16+d;
+	}
+	return v;
+}
+
+char *json_string(const char *p){
+	if(!p || *(p=ws(p))!='"') return NULL;
+	struct sbuf b; sb_init(&b);
+	for(p++; *p && *p!='"'; p++){
+		if(*p!='\\'){ sb_putc(&b,*p); continue; }
+		switch(*++p){
+			case 'n': sb_putc(&b,'\n'); break;
+			case 'r': sb_putc(&b,'\r'); break;
+			case 't': sb_putc(&b,'\t'); break;
+			case 'b': sb_putc(&b,'\b'); break;
+			case 'f': sb_putc(&b,'\f'); break;
+			case 'u': {
+				long c=hex4(p+1);
+				if(c<0) goto bad;
+				p+=4;
+				if(c>=0xD800 && c<0xDC00 && p[1]=='\\' && p[2]=='u'){
+					long lo=hex4(p+3);
+					if(lo>=0xDC00 && lo<0xE000){ c=0x10000+((c-0xD800)<<10)+(lo-0xDC00); p+=6; }
+				}
+				put_utf8(&b,(unsigned long)c);
+				break;
+			}
+			case 0: goto bad;
+			default: sb_putc(&b,*p);   /* \" \\ \/ */
+		}
+	}
+	if(*p=='"'){ if(!b.s) sb_puts(&b,""); return sb_steal(&b); }
+bad:
+	sb_free(&b);
+	return NULL;
+}
+
+/* the "messages" array of obj as malloc'd role/content pairs */
+int json_messages(const char *obj, struct llm_msg **out){
+	struct llm_msg *msgs=NULL; int n=0, cap=0;
+	const char *p=json_member(obj, "messages");
+	if(p && *p=='[') for(p++;;){
+		p=ws(p);
+		if(*p==','){ p++; continue; }
+		if(*p!='{') break;
+		if(n==cap){ cap=cap? cap*2 : 8; msgs=xrealloc(msgs, (size_t)cap*sizeof *msgs); }
+		char *role=json_string(json_member(p, "role"));
+		msgs[n].role=role? role : xstrdup("user");
+		msgs[n].content=json_string(json_member(p, "content"));
+		n++;
+		if(!(p=json_skip(p))) break;
+	}
+	*out=msgs;
+	return n;
+}
+
+/* choices[0].delta.content of one SSE chunk; NULL when it has none */
+char *json_delta(const char *chunk){
+	const char *p=json_member(chunk, "choices");
+	if(!p || *p!='[') return NULL;
+	p=ws(p+1);
+	if(!(p=json_member(p, "delta"))) return NULL;
+	return json_string(json_member(p, "content"));
+}
@@ -0,0 +1,22 @@
+/*==============================================================================
+ * src/json.h
+ * License: BSD3
+ *============================================================================*/
+#ifndef JSON_H
+#define JSON_H
+#include "util.h"
+#include "../include/llm_backend.h"
+
+void  json_escape_into(struct sbuf *b, const char *s); /* quoted */
+void  json_escape_n(struct sbuf *b, const char *s, size_t n); /* n bytes */
+char *build_openai_json(const struct llm_req *r);      /* malloc'd */
+char *extract_content(const char *json);               /* malloc'd or NULL */
+
+/* reader: p points at a value; NULL when absent or malformed */
+const char *json_skip(const char *p);                   /* just past it */
+const char *json_member(const char *obj, const char *key); /* top level */
+char *json_string(const char *p);                       /* malloc'd, decoded */
+int   json_messages(const char *obj, struct llm_msg **msgs); /* count */
+char *json_delta(const char *chunk);       /* SSE choices[0].delta.content */
+
+#endif
@@ -7,9 +7,20 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <signal.h>
 #include "util.h"
 #include "httpd.h"
 #include "sandbox.h"
+#include "alog.h"
+#include "bpe.h"
+#include "batch.h"
+#include "prefork.h"
+#include "reload.h"
+#include "privsep.h"
+#include "trace.h"
+#include "compact.h"
+#include "route.h"
+#include "store.h"
 #include "../include/llm_backend.h"
 #include "../config.h"
 
@@ -26,15 +37,48 @@ int run_qt_gui(llm_fn fn){ (void)fn; fprintf(stderr,"Qt disabled at build\n"); r
 
 static void usage(const char *prog){
 	fprintf(stderr,
-"usage: %s [--bind HOST:PORT] [--backend openai|trtllm]\n"
-"          [--api-base URL] [--api-key-file FILE] [--model NAME]\n"
-"          [--temp N] [--max-tokens N] [--trtllm-engine PATH]\n"
+"usage: %s [--bind HOST:PORT|unix:PATH|fd:N] [--socket-mode MODE]\n"
+"          [--backlog N] [--procs N [--cpu-pin]] [--privsep N]\n"
+"          [--backend openai|trtllm]\n"
+"          [--api-base URL ...] [--lb least|ewma] [--hedge] [--http2]\n"
+"          [--routes FILE]\n"
+"          [--api-key-file FILE] [--model NAME]\n"
+"          [--temp N] [--max-tokens N] [--timeout SEC] [--trtllm-engine PATH]\n"
+"          [--context-tokens N] [--vocab FILE] [--compact N] [--store DIR]\n"
 "          [--hme-command CMD ... --] [--no-network]\n"
-"          [--local-gui gtk|qt] [-v]\n", prog);
+"          [--access-log FILE|-] [--access-log-format json|logfmt]\n"
+"          [--access-log-sample N] [--trace FILE [--trace-sample N]]\n"
+"          [--local-gui gtk|qt] [-v]\n"
+"          [--batch IN.jsonl [--out OUT.jsonl] [--concurrency N]]\n", prog);
 	exit(2);
 }
 
+/* the replica set, in the serving process or in each --privsep worker */
+static void open_upstreams(struct server_cfg *cfg, llm_fn fn, int policy, int hedge){
+	if(fn==route_complete){ route_open_upstreams(policy, hedge); return; }
+	if(fn!=llm_openai_complete || cfg->hme_argc || cfg->no_network) return;
+	cfg->ups = upstream_set_new(cfg->api_bases, cfg->napi_bases, policy, hedge);
+	if(cfg->napi_bases>1) upstream_start_probes(cfg->ups, UP_PROBE_MS);
+}
+
+/* --privsep: what a backend worker sets up and runs */
+static struct { struct server_cfg *cfg; llm_fn fn; int policy, hedge; } ws;
+
+static void worker_init(void *arg){
+	(void)arg;
+	if(ws.cfg->listen_fd>=0) close(ws.cfg->listen_fd);
+	open_upstreams(ws.cfg, ws.fn, ws.policy, ws.hedge);
+	sandbox_init_backend(!ws.cfg->no_network);
+}
+
+static int worker_call(const struct llm_req *r, struct llm_resp *out){
+	struct llm_req q=*r;
+	q.api_key=ws.cfg->api_key;   /* the front end never sends it */
+	return ws.cfg->ups? upstream_complete(ws.cfg->ups, ws.fn, &q, out) : ws.fn(&q, out);
+}
+
 int main(int argc, char **argv){
+	reload_init(argc, argv);
 	struct server_cfg cfg={0};
 	cfg.bind_addr=DEF_BIND_ADDR;
 	cfg.backend=DEF_BACKEND;
@@ -42,14 +86,36 @@ int main(int argc, char **argv){
 	cfg.model=DEF_MODEL;
 	cfg.temperature=DEF_TEMPERATURE;
 	cfg.max_tokens=DEF_MAX_TOKENS;
+	cfg.context_tokens=DEF_CONTEXT_TOKENS;
+	cfg.timeout_sec=IO_TIMEOUT_SEC;
+	cfg.backlog=DEF_BACKLOG;
+	cfg.socket_mode=DEF_SOCKET_MODE;
+	cfg.listen_fd=-1;
 
 	const char *gui=NULL;
+	const char *lb=DEF_LB;
+	int hedge=0, cpu_pin=0, privsep=0;
+	const char *batch_in=NULL, *batch_out=NULL;
+	const char *trace=NULL, *routes=NULL, *store=NULL;
+	unsigned trace_sample=0;
+	int conc=DEF_CONCURRENCY;
 	char *api_key_mem=NULL;
+	const char **bases = xmalloc(sizeof *bases * (size_t)argc);
+	int nbases=0;
 
 	for(int i=1;i<argc;i++){
 		if(!strcmp(argv[i],"--bind") && i+1<argc){ cfg.bind_addr=argv[++i]; continue; }
+		if(!strcmp(argv[i],"--backlog") && i+1<argc){ cfg.backlog=atoi(argv[++i]); continue; }
+		if(!strcmp(argv[i],"--socket-mode") && i+1<argc){ cfg.socket_mode=(int)strtol(argv[++i], NULL, 8); continue; }
+		if(!strcmp(argv[i],"--procs") && i+1<argc){ cfg.procs=atoi(argv[++i]); continue; }
+		if(!strcmp(argv[i],"--cpu-pin")){ cpu_pin=1; continue; }
+		if(!strcmp(argv[i],"--privsep") && i+1<argc){ privsep=atoi(argv[++i]); continue; }
 		if(!strcmp(argv[i],"--backend") && i+1<argc){ cfg.backend=argv[++i]; continue; }
-		if(!strcmp(argv[i],"--api-base") && i+1<argc){ cfg.api_base=argv[++i]; continue; }
+		if(!strcmp(argv[i],"--api-base") && i+1<argc){ bases[nbases++]=argv[++i]; continue; }
+		if(!strcmp(argv[i],"--lb") && i+1<argc){ lb=argv[++i]; continue; }
+		if(!strcmp(argv[i],"--hedge")){ hedge=1; continue; }
+		if(!strcmp(argv[i],"--http2")){ cfg.http2=1; continue; }
+		if(!strcmp(argv[i],"--routes") && i+1<argc){ routes=argv[++i]; continue; }
 		if(!strcmp(argv[i],"--api-key-file") && i+1<argc){
 			size_t n=0; char *k=read_file(argv[++i], &n);
 			if(!k) die("cannot read key file");
@@ -58,6 +124,14 @@ int main(int argc, char **argv){
 		if(!strcmp(argv[i],"--model") && i+1<argc){ cfg.model=argv[++i]; continue; }
 		if(!strcmp(argv[i],"--temp") && i+1<argc){ cfg.temperature=atof(argv[++i]); continue; }
 		if(!strcmp(argv[i],"--max-tokens") && i+1<argc){ cfg.max_tokens=atoi(argv[++i]); continue; }
+		if(!strcmp(argv[i],"--timeout") && i+1<argc){ cfg.timeout_sec=atoi(argv[++i]); continue; }
+		if(!strcmp(argv[i],"--context-tokens") && i+1<argc){ cfg.context_tokens=atoi(argv[++i]); continue; }
+		if(!strcmp(argv[i],"--compact") && i+1<argc){ cfg.compact=atoi(argv[++i]); continue; }
+		if(!strcmp(argv[i],"--store") && i+1<argc){ store=argv[++i]; continue; }
+		if(!strcmp(argv[i],"--vocab") && i+1<argc){
+			if(!(cfg.bpe=bpe_load(argv[++i]))) die("cannot load vocabulary %s", argv[i]);
+			continue;
+		}
 		if(!strcmp(argv[i],"--trtllm-engine") && i+1<argc){ cfg.trt_engine=argv[++i]; continue; }
 		if(!strcmp(argv[i],"--hme-command") && i+1<argc){
 			cfg.hme_argv = (const char**)&argv[i+1];
@@ -67,17 +141,97 @@ int main(int argc, char **argv){
 			break;
 		}
 		if(!strcmp(argv[i],"--no-network")){ cfg.no_network=1; continue; }
+		if(!strcmp(argv[i],"--access-log") && i+1<argc){ cfg.access_log=argv[++i]; continue; }
+		if(!strcmp(argv[i],"--access-log-format") && i+1<argc){
+			const char *f=argv[++i];
+			if(!strcmp(f,"json")) cfg.access_log_fmt=ALOG_JSON;
+			else if(!strcmp(f,"logfmt")) cfg.access_log_fmt=ALOG_LOGFMT;
+			else usage(argv[0]);
+			continue;
+		}
+		if(!strcmp(argv[i],"--access-log-sample") && i+1<argc){ cfg.access_log_sample=(unsigned)atoi(argv[++i]); continue; }
+		if(!strcmp(argv[i],"--trace") && i+1<argc){ trace=argv[++i]; continue; }
+		if(!strcmp(argv[i],"--trace-sample") && i+1<argc){ trace_sample=(unsigned)atoi(argv[++i]); continue; }
 		if(!strcmp(argv[i],"--local-gui") && i+1<argc){ gui=argv[++i]; continue; }
+		if(!strcmp(argv[i],"--batch") && i+1<argc){ batch_in=argv[++i]; continue; }
+		if(!strcmp(argv[i],"--out") && i+1<argc){ batch_out=argv[++i]; continue; }
+		if(!strcmp(argv[i],"--concurrency") && i+1<argc){ conc=atoi(argv[++i]); continue; }
 		if(!strcmp(argv[i],"-v")){ cfg.verbose++; continue; }
 		usage(argv[0]);
 	}
 
-	llm_fn fn = !strcmp(cfg.backend,"trtllm") ? llm_trtllm_complete : llm_openai_complete;
+	if(nbases){ cfg.api_base=bases[0]; cfg.api_bases=bases; cfg.napi_bases=nbases; }
+	else{ bases[0]=cfg.api_base; cfg.api_bases=bases; cfg.napi_bases=1; }
+	if(strcmp(lb,"least") && strcmp(lb,"ewma")) usage(argv[0]);
+	if(cfg.backlog<1 || cfg.procs<0 || privsep<0) usage(argv[0]);
+	if(gui) privsep=0;
+
+	/* --routes: before the fork, so inflight= limits span the workers */
+	if(routes) route_load(routes, &cfg);
+	/* --store: likewise, so the workers share one index */
+	if(store && !gui && !batch_in) store_open(store);
 
-	/* sandbox: allow inbound sockets; on Linux optionally block connect() when --no-network */
-	sandbox_init_web(!cfg.no_network);
+	/* a unix or inherited listener is shared: the supervisor keeps it
+	   open while workers come and go */
+	if(!gui && !batch_in) cfg.listen_fd=http_listen_shared(&cfg, &cfg.listen_held);
+
+	/* --procs: fork before any thread exists; each worker goes on from here
+	   with its own TCP listener, replica set, access log and sandbox */
+	if(cfg.procs>1 && !gui && !batch_in) prefork(cfg.procs, cpu_pin, cfg.listen_fd, cfg.listen_held);
+	else cfg.procs=1;
+	/* SIGUSR2 without --procs: this process re-execs itself, unless its
+	   sandbox would carry over to the new one (the seccomp filter under
+	   --privsep would keep its backends off the network; pledge has no
+	   exec) */
+#if defined(__OpenBSD__)
+	cfg.reload=0;
+#else
+	cfg.reload=!privsep;
+#endif
+
+	/* --trace: per process, before the --privsep workers that append too */
+	if(trace && !gui && !batch_in && trace_open(trace, trace_sample)<0)
+		die("cannot open trace file %s", trace);
+
+	llm_fn fn = routes? route_complete
+	          : !strcmp(cfg.backend,"trtllm") ? llm_trtllm_complete : llm_openai_complete;
+	int policy = !strcmp(lb,"least")? UP_LEAST : UP_EWMA;
+	if(!cfg.api_key) cfg.api_key = getenv("OPENAI_API_KEY");
+	/* --privsep: also before any thread; the workers get the backend, its
+	   replica set and outbound network, this process keeps the clients */
+	if(privsep){
+		ws.cfg=&cfg; ws.fn=fn; ws.policy=policy; ws.hedge=hedge;
+		privsep_start(privsep, worker_init, NULL, worker_call);
+		fn=privsep_complete;
+		/* the workers have the upstream keys: a compromised front end
+		   must not find them in its memory or environment */
+		str_wipe(api_key_mem);
+		if(cfg.api_key && cfg.api_key==getenv("OPENAI_API_KEY")){
+			str_wipe((char *)cfg.api_key);
+			unsetenv("OPENAI_API_KEY");
+		}
+		cfg.api_key=NULL;
+		route_drop_keys();
+	}else open_upstreams(&cfg, fn, policy, hedge);
+
+	/* access log is opened before the sandbox; -v alone logs to stderr */
+	int logging = !gui && !batch_in && (cfg.access_log || cfg.verbose);
+	if(logging && alog_open(cfg.access_log, cfg.access_log_fmt, cfg.access_log_sample)<0)
+		die("cannot open access log");
+	/* so are the batch input, output and checkpoint */
+	struct batch *batch=NULL;
+	if(batch_in && !(batch=batch_open(&cfg, fn, batch_in, batch_out, conc)))
+		die("cannot open %s or %s", batch_in, batch_out? batch_out : "stdout");
+	/* and the --compact key */
+	if(cfg.compact>0 && !gui && !batch_in) compact_start(&cfg, fn);
+	store_start();
+
+	/* sandbox: allow inbound sockets; on Linux block connect() when
+	   --no-network, or always when --privsep workers do the calling */
+	sandbox_init_web(!cfg.no_network && !privsep,
+	                 (logging && cfg.access_log && strcmp(cfg.access_log,"-")) || store_active(), privsep>0);
 #ifdef __linux__
-	if(cfg.no_network) sandbox_block_connect_linux();
+	if(cfg.no_network || privsep) sandbox_block_connect_linux();
 #endif
 
 	if(gui){
@@ -86,12 +240,20 @@ int main(int argc, char **argv){
 		die("unknown gui: %s", gui);
 	}
 
-	/* Fallback to env API key if not provided */
-	if(!cfg.api_key) cfg.api_key = getenv("OPENAI_API_KEY");
-	if(!strcmp(cfg.backend,"openai") && !cfg.hme_argc && cfg.no_network)
+	if(!routes && !strcmp(cfg.backend,"openai") && !cfg.hme_argc && cfg.no_network)
 		die("openai backend with --no-network requires --hme-command");
 
-	int rc = run_http_server(&cfg, fn);
+	/* a cancelled or timed-out transport child may leave a dead pipe behind */
+	signal(SIGPIPE, SIG_IGN);
+	int rc = batch? batch_run(batch) : run_http_server(&cfg, fn);
+	batch_free(batch);
+	compact_stop();
+	store_close();
+	alog_close();
+	bpe_free(cfg.bpe);
+	upstream_set_free(cfg.ups);
+	route_free();
+	free(bases);
 	free(api_key_mem);
 	return rc;
 }
@@ -0,0 +1,159 @@
+/*==============================================================================
+ * src/prefork.c  —  --procs: a supervisor and N forked workers
+ *
+ * The supervisor only forks, reaps and relays signals; it opens no socket
+ * and starts no thread, but holds on to a unix or inherited listener the
+ * workers share, which so stays open while one is replaced. Each worker
+ * runs the rest of main() on its own: its SO_REUSEPORT listener on a TCP
+ * --bind (the kernel spreads connections across them), replica set,
+ * access-log writer and sandbox, so a crash takes down one worker's
+ * connections and nothing else. A worker killed by a signal is replaced,
+ * at most once per PREFORK_RESTART_MS per slot. SIGTERM is passed on and
+ * waited out while the workers drain; SIGUSR2 starts a new instance
+ * (reload.c) and, once it accepts, does the same.
+ * License: BSD3
+ *============================================================================*/
+#if defined(__linux__)
+#define _GNU_SOURCE          /* sched_setaffinity, CPU_COUNT */
+#else
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "prefork.h"
+#include "reload.h"
+#include "util.h"
+#include "../config.h"
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/prctl.h>
+#endif
+
+#define TICK_MS 100   /* supervisor wakeups while idle */
+
+static volatile sig_atomic_t hup, usr1, usr2, term;
+
+static void on_sig(int sig){
+	if(sig==SIGHUP) hup=1;
+	else if(sig==SIGUSR1) usr1=1;
+	else if(sig==SIGUSR2) usr2=1;
+	else term=sig;
+}
+
+static void pin_cpu(int idx){
+#if defined(__linux__)
+	cpu_set_t cur, one;
+	if(sched_getaffinity(0, sizeof cur, &cur)) return;
+	int k = idx % CPU_COUNT(&cur);
+	for(int c=0;c<CPU_SETSIZE;c++) if(CPU_ISSET(c, &cur) && !k--){
+		CPU_ZERO(&one); CPU_SET(c, &one);
+		if(sched_setaffinity(0, sizeof one, &one)) warnx("worker %d: cannot pin to cpu %d", idx, c);
+		return;
+	}
+#else
+	(void)idx;
+#endif
+}
+
+/* 0 in the new worker, its pid in the supervisor */
+static pid_t spawn(int idx, int pin, pid_t sup){
+	pid_t pid=fork();
+	if(pid<0) die("prefork: fork failed");
+	if(pid) return pid;
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGHUP, SIG_IGN);   /* until the access log takes it */
+	signal(SIGUSR1, SIG_IGN);  /* and --trace this one */
+	signal(SIGUSR2, SIG_IGN);  /* the supervisor's */
+#if defined(__linux__)
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	if(getppid()!=sup) _exit(1);   /* the supervisor went before prctl */
+#else
+	(void)sup;
+#endif
+	if(pin) pin_cpu(idx);
+	return 0;
+}
+
+int prefork(int n, int pin, int lfd, int held){
+	pid_t sup=getpid();
+	pid_t *pids=xmalloc((size_t)n*sizeof *pids);
+	uint64_t *born=xmalloc((size_t)n*sizeof *born), *due=xmalloc((size_t)n*sizeof *due);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler=on_sig;   /* no SA_RESTART: wake the sleep below */
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGUSR2, &sa, NULL);
+
+	int idx;
+	for(idx=0;idx<n;idx++){
+		due[idx]=0; born[idx]=now_us();
+		if(!(pids[idx]=spawn(idx, pin, sup))) goto worker;
+	}
+#if defined(__OpenBSD__)
+	if(pledge("stdio rpath proc exec", NULL)==-1) die("pledge");
+#endif
+	int alive=n, pending=0, rc=0;
+	while((alive || pending) && !term){
+		if(hup){
+			hup=0;
+			for(int i=0;i<n;i++) if(pids[i]>0) kill(pids[i], SIGHUP);
+		}
+		if(usr1){
+			usr1=0;
+			for(int i=0;i<n;i++) if(pids[i]>0) kill(pids[i], SIGUSR1);
+		}
+		/* once the new instance accepts, the workers drain as on SIGTERM */
+		if(usr2){
+			usr2=0;
+			if(!reload_exec(lfd, held)) term=SIGTERM;
+		}
+		int st;
+		pid_t pid;
+		while((pid=waitpid(-1, &st, WNOHANG))>0){
+			int i=0;
+			while(i<n && pids[i]!=pid) i++;
+			if(i==n) continue;
+			pids[i]=0; alive--;
+			/* an exit status is the worker's own verdict (die() on a bad
+			   flag or bind): restarting would only repeat it */
+			if(WIFEXITED(st)){
+				if(WEXITSTATUS(st)){
+					warnx("prefork: worker %d (pid %d) exited with %d", i, (int)pid, WEXITSTATUS(st));
+					rc=1;
+				}
+				continue;
+			}
+			uint64_t at=born[i]+(uint64_t)PREFORK_RESTART_MS*1000;
+			due[i] = at>now_us()? at : now_us();
+			warnx("prefork: worker %d (pid %d) killed by signal %d, restarting", i, (int)pid, WTERMSIG(st));
+		}
+		pending=0;
+		for(idx=0;idx<n;idx++) if(due[idx]){
+			if(now_us()<due[idx]){ pending++; continue; }
+			due[idx]=0; born[idx]=now_us();
+			if(!(pids[idx]=spawn(idx, pin, sup))) goto worker;
+			alive++;
+		}
+		struct timespec ts={ 0, TICK_MS*1000000L };
+		nanosleep(&ts, NULL);
+	}
+	for(int i=0;i<n;i++) if(pids[i]>0) kill(pids[i], term? term : SIGTERM);
+	/* the workers only: a new instance is a child too */
+	for(int i=0;i<n;i++) while(pids[i]>0 && waitpid(pids[i], NULL, 0)<0 && errno==EINTR) ;
+	exit(rc);
+
+worker:
+	free(pids); free(born); free(due);
+	return idx;
+}
@@ -0,0 +1,17 @@
+/*==============================================================================
+ * src/prefork.h  —  --procs: a supervisor and N forked workers
+ * License: BSD3
+ *============================================================================*/
+#ifndef PREFORK_H
+#define PREFORK_H
+
+/* Fork n workers and supervise them: restart any killed by a signal,
+   pass SIGHUP/SIGUSR1/SIGTERM/SIGINT on, exit once all are gone (1 if one
+   exited with an error). SIGUSR2 re-execs the program on the shared
+   listener lfd (-1: none; held as for reload_exec()), then stops the
+   workers. Returns only in a
+   worker, with its index; with pin set, the worker is bound to one CPU of
+   the inherited affinity set. Must run before any thread is started. */
+int prefork(int n, int pin, int lfd, int held);
+
+#endif
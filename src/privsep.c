@@ -0,0 +1,491 @@
+/*==============================================================================
+ * src/privsep.c  —  --privsep: backend calls in separately sandboxed workers
+ *
+ * A manager process, forked before any thread exists, forks backend
+ * workers on request and hands the front end one end of a SOCK_SEQPACKET
+ * socketpair to each (SCM_RIGHTS). A worker serves one call at a time:
+ * PS_REQ in, any number of PS_DELTA out, then PS_RESP; the front end may
+ * send PS_CANCEL in between. The front end never connects anywhere and
+ * the workers never see a client.
+ *
+ * A message over PRIV_INLINE_MAX is written once into a sealed memfd
+ * (shm_open elsewhere) whose descriptor goes along instead of the bytes;
+ * the receiver maps it and reads the strings in place, so a megabyte
+ * transcript is neither pushed through the socket nor reassembled.
+ * License: BSD3
+ *============================================================================*/
+#if defined(__linux__)
+#define _GNU_SOURCE          /* memfd_create, CMSG_SPACE */
+#endif
+#include "privsep.h"
+#include "hconn.h"
+#include "util.h"
+#include "trace.h"
+#include "../config.h"
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0   /* set_cloexec() below covers it */
+#endif
+
+enum { PS_REQ=1, PS_DELTA, PS_CANCEL, PS_RESP };
+
+struct ps_hdr { uint32_t type, len; };
+
+#define RECV_CAP (sizeof(struct ps_hdr) + PRIV_INLINE_MAX)
+
+/* fixed parts; strings follow, each a tag byte (0: NULL) and the bytes
+   with their NUL */
+struct ps_req {
+	double temperature;
+	unsigned long long deadline_us, trace_id;
+	int32_t max_tokens, no_network, http2, stream, nmsgs, hme_argc;
+};
+struct ps_resp { int32_t rc, status, http_status, retry_after_ms; };
+
+/* ------------------------------- messages -------------------------------- */
+struct ps_msg {
+	uint32_t type;
+	const char *p; size_t len;  /* payload */
+	void *map;                  /* when it came in a memfd */
+};
+
+static int shm_new(size_t n){
+	int fd;
+#if defined(__linux__)
+	fd=memfd_create("llmserv", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+#else
+	static unsigned ctr;
+	char name[64];
+	snprintf(name, sizeof name, "/llmserv.%d.%u", (int)getpid(), __atomic_fetch_add(&ctr, 1, __ATOMIC_RELAXED));
+	if((fd=shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600))>=0){ shm_unlink(name); set_cloexec(fd); }
+#endif
+	if(fd>=0 && ftruncate(fd, (off_t)n)){ close(fd); fd=-1; }
+	return fd;
+}
+
+/* the receiver must not be made to fault: the sender may not shrink or
+   rewrite what it passed (Linux; elsewhere only the size is checked) */
+static int shm_ok(int fd, size_t n){
+	struct stat sb;
+	if(fstat(fd, &sb) || (size_t)sb.st_size < n) return 0;
+#if defined(__linux__)
+	int want=F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE;
+	return (fcntl(fd, F_GET_SEALS) & want)==want;
+#else
+	return 1;
+#endif
+}
+
+static ssize_t send_fd(int s, struct iovec *iov, int niov, int fd){
+	struct msghdr mh;
+	union { struct cmsghdr c; char b[CMSG_SPACE(sizeof(int))]; } cm;
+	memset(&mh, 0, sizeof mh);
+	mh.msg_iov=iov; mh.msg_iovlen=(size_t)niov;
+	if(fd>=0){
+		memset(&cm, 0, sizeof cm);
+		mh.msg_control=cm.b; mh.msg_controllen=sizeof cm.b;
+		struct cmsghdr *c=CMSG_FIRSTHDR(&mh);
+		c->cmsg_level=SOL_SOCKET; c->cmsg_type=SCM_RIGHTS;
+		c->cmsg_len=CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(c), &fd, sizeof fd);
+	}
+	ssize_t k;
+	while((k=sendmsg(s, &mh, MSG_NOSIGNAL))<0 && errno==EINTR) ;
+	return k;
+}
+
+/* one message into buf; *fd gets a passed descriptor or -1 */
+static ssize_t recv_fd(int s, void *buf, size_t n, int *fd){
+	struct msghdr mh;
+	union { struct cmsghdr c; char b[CMSG_SPACE(sizeof(int))]; } cm;
+	struct iovec iov={ buf, n };
+	memset(&mh, 0, sizeof mh);
+	mh.msg_iov=&iov; mh.msg_iovlen=1;
+	mh.msg_control=cm.b; mh.msg_controllen=sizeof cm.b;
+	ssize_t k;
+	while((k=recvmsg(s, &mh, MSG_CMSG_CLOEXEC))<0 && errno==EINTR) ;
+	*fd=-1;
+	if(k<0) return -1;
+	for(struct cmsghdr *c=CMSG_FIRSTHDR(&mh); c; c=CMSG_NXTHDR(&mh, c))
+		if(c->cmsg_level==SOL_SOCKET && c->cmsg_type==SCM_RIGHTS){
+			memcpy(fd, CMSG_DATA(c), sizeof *fd);
+			set_cloexec(*fd);
+		}
+	if(mh.msg_flags & (MSG_TRUNC|MSG_CTRUNC)){
+		if(*fd>=0) close(*fd);
+		*fd=-1; errno=EMSGSIZE; return -1;
+	}
+	return k;
+}
+
+/* len payload bytes written by fill(dst, arg) */
+static int ps_send(int s, uint32_t type, size_t len, void (*fill)(char *, const void *), const void *arg){
+	struct ps_hdr h={ type, (uint32_t)len };
+	struct iovec iov[2]={ { &h, sizeof h }, { NULL, 0 } };
+	if(len<=PRIV_INLINE_MAX){
+		char *buf=xmalloc(len? len : 1);
+		if(len) fill(buf, arg);
+		iov[1].iov_base=buf; iov[1].iov_len=len;
+		ssize_t k=send_fd(s, iov, 2, -1);
+		free(buf);
+		return k<0? -1 : 0;
+	}
+	int fd;
+	if(len>UINT32_MAX || (fd=shm_new(len))<0) return -1;
+	void *map=mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map==MAP_FAILED){ close(fd); return -1; }
+	fill(map, arg);
+	munmap(map, len);
+#if defined(__linux__)
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL);
+#endif
+	ssize_t k=send_fd(s, iov, 1, fd);
+	close(fd);
+	return k<0? -1 : 0;
+}
+
+/* buf: RECV_CAP bytes owned by the caller; m->p points into it or into
+   a mapping ps_free() drops */
+static int ps_recv(int s, char *buf, struct ps_msg *m){
+	struct ps_hdr h;
+	int fd;
+	memset(m, 0, sizeof *m);
+	ssize_t k=recv_fd(s, buf, RECV_CAP, &fd);
+	if(k<0) return -1;
+	if(k<(ssize_t)sizeof h){ if(fd>=0) close(fd); errno=EPIPE; return -1; }
+	memcpy(&h, buf, sizeof h);
+	m->type=h.type; m->len=h.len;
+	if(fd<0){
+		if((size_t)k != sizeof h + h.len){ errno=EPROTO; return -1; }
+		m->p=buf+sizeof h;
+		return 0;
+	}
+	if(!h.len || !shm_ok(fd, h.len)){ close(fd); errno=EPROTO; return -1; }
+	m->map=mmap(NULL, h.len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(m->map==MAP_FAILED){ m->map=NULL; return -1; }
+	m->p=m->map;
+	return 0;
+}
+
+static void ps_free(struct ps_msg *m){
+	if(m->map) munmap(m->map, m->len);
+	m->map=NULL;
+}
+
+/* ----------------------------- encode/decode ----------------------------- */
+static size_t str_size(const char *s){ return s? strlen(s)+2 : 1; }
+
+static char *put_str(char *d, const char *s){
+	if(!s){ *d++=0; return d; }
+	size_t n=strlen(s)+1;
+	*d++=1;
+	memcpy(d, s, n);
+	return d+n;
+}
+
+struct rd { const char *p, *end; int bad; };
+
+static const char *get_str(struct rd *d){
+	if(d->p>=d->end){ d->bad=1; return NULL; }
+	if(!*d->p++) return NULL;
+	const char *s=d->p, *z=memchr(s, 0, (size_t)(d->end-s));
+	if(!z){ d->bad=1; return NULL; }
+	d->p=z+1;
+	return s;
+}
+
+static size_t req_size(const struct llm_req *r){
+	size_t n=sizeof(struct ps_req) + str_size(r->model) + str_size(r->api_base)
+	        + str_size(r->trt_engine_path);
+	for(int i=0;i<r->nmsgs;i++) n+=str_size(r->msgs[i].role)+str_size(r->msgs[i].content);
+	for(int i=0;i<r->hme_argc;i++) n+=str_size(r->hme_argv[i]);
+	return n;
+}
+
+static void req_fill(char *d, const void *arg){
+	const struct llm_req *r=arg;
+	struct ps_req f={ r->temperature, r->deadline_us, r->trace_id, r->max_tokens, r->no_network,
+	                  r->http2, r->on_delta!=NULL, r->nmsgs, r->hme_argc };
+	memcpy(d, &f, sizeof f); d+=sizeof f;
+	/* no api_key: the workers hold their own, this process none */
+	d=put_str(d, r->model); d=put_str(d, r->api_base);
+	d=put_str(d, r->trt_engine_path);
+	for(int i=0;i<r->nmsgs;i++){ d=put_str(d, r->msgs[i].role); d=put_str(d, r->msgs[i].content); }
+	for(int i=0;i<r->hme_argc;i++) d=put_str(d, r->hme_argv[i]);
+}
+
+/* strings point into m; msgs and argv are malloc'd */
+static int req_parse(const struct ps_msg *m, struct llm_req *r, int *stream){
+	struct ps_req f;
+	struct rd d={ m->p+sizeof f, m->p+m->len, 0 };
+	if(m->len<sizeof f) return -1;
+	memcpy(&f, m->p, sizeof f);
+	size_t room=m->len-sizeof f;
+	if(f.nmsgs<0 || f.hme_argc<0 || (size_t)f.nmsgs>room/2 || (size_t)f.hme_argc>room) return -1;
+	memset(r, 0, sizeof *r);
+	r->temperature=f.temperature; r->deadline_us=f.deadline_us; r->trace_id=f.trace_id;
+	r->max_tokens=f.max_tokens; r->no_network=f.no_network; r->http2=f.http2;
+	*stream=f.stream;
+	r->model=get_str(&d); r->api_base=get_str(&d);
+	r->trt_engine_path=get_str(&d);
+	struct llm_msg *msgs=xmalloc(sizeof *msgs * (size_t)(f.nmsgs+1));
+	const char **argv=xmalloc(sizeof *argv * (size_t)(f.hme_argc+1));
+	for(int i=0;i<f.nmsgs;i++){ msgs[i].role=get_str(&d); msgs[i].content=get_str(&d); }
+	for(int i=0;i<f.hme_argc;i++) argv[i]=get_str(&d);
+	argv[f.hme_argc]=NULL;
+	r->msgs=msgs; r->nmsgs=f.nmsgs;
+	r->hme_argv=argv; r->hme_argc=f.hme_argc;
+	return d.bad? -1 : 0;
+}
+
+struct resp_out { int rc; const struct llm_resp *r; };
+
+static void resp_fill(char *d, const void *arg){
+	const struct resp_out *o=arg;
+	struct ps_resp f={ o->rc, o->r->status, o->r->http_status, o->r->retry_after_ms };
+	memcpy(d, &f, sizeof f); d+=sizeof f;
+	d=put_str(d, o->r->content);
+	put_str(d, o->r->err);
+}
+
+/* copies out of m: a worker is not trusted with the front end's memory */
+static int resp_parse(const struct ps_msg *m, struct llm_resp *out){
+	struct ps_resp f;
+	struct rd d={ m->p+sizeof f, m->p+m->len, 0 };
+	if(m->len<sizeof f) return -2;
+	memcpy(&f, m->p, sizeof f);
+	const char *content=get_str(&d), *err=get_str(&d);
+	if(d.bad) return -2;
+	out->content=content? xstrdup(content) : NULL;
+	out->err=err? xstrdup(err) : NULL;
+	out->status=f.status; out->http_status=f.http_status; out->retry_after_ms=f.retry_after_ms;
+	return f.rc;
+}
+
+struct bytes { const char *p; size_t n; };
+static void bytes_fill(char *d, const void *arg){
+	const struct bytes *b=arg;
+	memcpy(d, b->p, b->n);
+}
+
+/* -------------------------------- worker --------------------------------- */
+static struct {
+	void (*init)(void *arg); void *arg;
+	llm_fn fn;
+} ps;
+
+static int wfd=-1, wcancel, wdone[2];
+
+struct call { struct llm_req req; struct llm_resp resp; int rc; };
+
+static int w_delta(void *arg, const char *text, size_t n){
+	(void)arg;
+	struct bytes b={ text, n };
+	if(ps_send(wfd, PS_DELTA, n, bytes_fill, &b)<0) return 1;
+	return __atomic_load_n(&wcancel, __ATOMIC_ACQUIRE);
+}
+
+static void *call_main(void *arg){
+	struct call *c=arg;
+	c->rc=ps.fn(&c->req, &c->resp);
+	while(write(wdone[1], "", 1)<0 && errno==EINTR) ;
+	return NULL;
+}
+
+/* one call: run it on a thread while this one listens for PS_CANCEL */
+static void w_serve(const struct ps_msg *m, char *buf){
+	struct call c;
+	struct resp_out o={ -1, &c.resp };
+	int stream=0;
+	memset(&c, 0, sizeof c);
+	if(req_parse(m, &c.req, &stream)<0){
+		c.resp.status=LLM_EBACKEND; c.resp.err=xstrdup("privsep: malformed request");
+	}else{
+		__atomic_store_n(&wcancel, 0, __ATOMIC_RELEASE);
+		c.req.cancel=&wcancel;
+		if(stream) c.req.on_delta=w_delta;
+		pthread_t t;
+		if(pthread_create(&t, NULL, call_main, &c)) die("privsep: cannot start call");
+		struct pollfd p[2]={ { wfd, POLLIN, 0 }, { wdone[0], POLLIN, 0 } };
+		for(;;){
+			if(poll(p, 2, -1)<0) continue;
+			if(p[1].revents) break;
+			if(!p[0].revents) continue;
+			struct ps_msg cm;
+			if(ps_recv(wfd, buf, &cm)<0) _exit(0);   /* front end gone */
+			if(cm.type==PS_CANCEL) __atomic_store_n(&wcancel, 1, __ATOMIC_RELEASE);
+			ps_free(&cm);
+		}
+		char x;
+		while(read(wdone[0], &x, 1)<0 && errno==EINTR) ;
+		pthread_join(t, NULL);
+		o.rc=c.rc;
+	}
+	size_t n=sizeof(struct ps_resp)+str_size(c.resp.content)+str_size(c.resp.err);
+	if(ps_send(wfd, PS_RESP, n, resp_fill, &o)<0) _exit(0);
+	trace_flush(c.req.trace_id);   /* this side's spans: connect, TLS, ... */
+	free(c.resp.content); free(c.resp.err);
+	free((void*)c.req.msgs); free((void*)c.req.hme_argv);
+}
+
+static void worker(int fd){
+	signal(SIGCHLD, SIG_DFL);   /* the manager's; curl and HME children are waited for */
+	wfd=fd;
+	if(pipe(wdone)) _exit(1);
+	set_cloexec(wdone[0]); set_cloexec(wdone[1]);
+	if(ps.init) ps.init(ps.arg);
+	char *buf=xmalloc(RECV_CAP);
+	for(;;){
+		struct ps_msg m;
+		if(ps_recv(fd, buf, &m)<0) _exit(0);
+		if(m.type==PS_REQ) w_serve(&m, buf);   /* a late PS_CANCEL is dropped */
+		ps_free(&m);
+	}
+}
+
+/* fork a worker per byte received on ctl, reply with its socket */
+static void manager(int ctl){
+	signal(SIGCHLD, SIG_IGN);   /* no zombies, nobody to wait for them */
+	for(;;){
+		char c;
+		ssize_t k=recv(ctl, &c, 1, 0);
+		if(k<0 && errno==EINTR) continue;
+		if(k<=0) _exit(0);
+		int sv[2], fd=-1;
+		if(!socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv)){
+			pid_t pid=fork();
+			if(!pid){ close(ctl); close(sv[0]); worker(sv[1]); }
+			close(sv[1]);
+			if(pid>0) fd=sv[0];
+			else close(sv[0]);
+		}
+		struct iovec iov={ &c, 1 };
+		send_fd(ctl, &iov, 1, fd);
+		if(fd>=0) close(fd);
+	}
+}
+
+/* ------------------------------ front end -------------------------------- */
+struct pw { int fd, busy; char *buf; };
+
+static struct pw *pw;
+static int npw, ctl=-1;
+static pthread_mutex_t pw_mtx=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pw_cv=PTHREAD_COND_INITIALIZER;
+
+/* with pw_mtx held */
+static int spawn(void){
+	char c=0;
+	int fd;
+	if(send(ctl, &c, 1, MSG_NOSIGNAL)!=1 || recv_fd(ctl, &c, 1, &fd)!=1) return -1;
+	return fd;
+}
+
+static struct pw *acquire(void){
+	pthread_mutex_lock(&pw_mtx);
+	for(;;){
+		struct pw *w=NULL;
+		for(int i=0;i<npw && !w;i++) if(pw[i].fd>=0 && !pw[i].busy) w=&pw[i];
+		for(int i=0;i<npw && !w;i++) if(pw[i].fd<0 && (pw[i].fd=spawn())>=0) w=&pw[i];
+		if(w){ w->busy=1; pthread_mutex_unlock(&pw_mtx); return w; }
+		int any=0;
+		for(int i=0;i<npw;i++) any|=pw[i].busy;
+		if(!any){ pthread_mutex_unlock(&pw_mtx); return NULL; }   /* cannot spawn */
+		pthread_cond_wait(&pw_cv, &pw_mtx);
+	}
+}
+
+static void release(struct pw *w, int ok){
+	pthread_mutex_lock(&pw_mtx);
+	if(!ok){ close(w->fd); w->fd=spawn(); }   /* -1: acquire() tries again */
+	w->busy=0;
+	pthread_cond_signal(&pw_cv);
+	pthread_mutex_unlock(&pw_mtx);
+}
+
+void privsep_start(int n, void (*init)(void *arg), void *arg, llm_fn fn){
+	int sv[2];
+	ps.init=init; ps.arg=arg; ps.fn=fn;
+	if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv)) die("privsep: socketpair failed");
+	pid_t pid=fork();
+	if(pid<0) die("privsep: fork failed");
+	if(!pid){ close(sv[0]); manager(sv[1]); }
+	close(sv[1]);
+	ctl=sv[0]; set_cloexec(ctl);
+	npw=n;
+	pw=xmalloc(sizeof *pw * (size_t)n);
+	for(int i=0;i<n;i++){
+		pw[i].busy=0; pw[i].buf=xmalloc(RECV_CAP);
+		if((pw[i].fd=spawn())<0) die("privsep: cannot start backend worker");
+	}
+}
+
+static int ps_fail(struct llm_resp *out, int status, const char *err){
+	out->status=status;
+	out->err=xstrdup(err);
+	return -1;
+}
+
+int privsep_complete(const struct llm_req *r, struct llm_resp *out){
+	struct pw *w;
+	/* one more try when an idle worker turns out to be gone */
+	for(int tries=0;;tries++){
+		if(!(w=acquire())) return ps_fail(out, LLM_EBACKEND, "privsep: no backend worker");
+		if(ps_send(w->fd, PS_REQ, req_size(r), req_fill, r)==0) break;
+		release(w, 0);
+		if(tries) return ps_fail(out, LLM_EBACKEND, "privsep: backend worker unreachable");
+	}
+	int stop=0;                 /* ETIMEDOUT/ECANCELED: reply expected soon */
+	uint64_t grace=0;
+	for(;;){
+		int e=stop? 0 : hc_expired(r);
+		if(e){
+			/* the worker keeps the same deadline; a cancel it must be told */
+			stop=e;
+			grace=now_us()+(uint64_t)PRIV_GRACE_MS*1000;
+			if(e==ECANCELED) ps_send(w->fd, PS_CANCEL, 0, bytes_fill, NULL);
+		}
+		if(stop && now_us()>=grace) break;   /* wedged: drop it */
+		struct pollfd p={ w->fd, POLLIN, 0 };
+		int ms = stop? (int)((grace-now_us())/1000)+1 : hc_poll_ms(r);
+		int k=poll(&p, 1, ms);
+		if(k<0 && errno!=EINTR) break;
+		if(k<=0) continue;
+		struct ps_msg m;
+		if(ps_recv(w->fd, w->buf, &m)<0) break;
+		hc_first_byte(r);
+		if(m.type==PS_DELTA){
+			if(m.len && r->on_delta && !stop && r->on_delta(r->delta_arg, m.p, m.len)){
+				stop=ECANCELED;
+				grace=now_us()+(uint64_t)PRIV_GRACE_MS*1000;
+				ps_send(w->fd, PS_CANCEL, 0, bytes_fill, NULL);
+			}
+			ps_free(&m);
+			continue;
+		}
+		int rc = m.type==PS_RESP? resp_parse(&m, out) : -2;
+		ps_free(&m);
+		if(rc==-2) break;
+		release(w, 1);
+		return rc;
+	}
+	release(w, 0);
+	free(out->content); out->content=NULL;
+	if(stop==ETIMEDOUT) return ps_fail(out, LLM_ETIMEOUT, "upstream deadline exceeded");
+	if(stop) return ps_fail(out, LLM_ECANCELED, "upstream call cancelled");
+	return ps_fail(out, LLM_EBACKEND, "privsep: backend worker exited");
+}
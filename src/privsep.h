@@ -0,0 +1,18 @@
+/*==============================================================================
+ * src/privsep.h  —  --privsep: backend calls in separately sandboxed workers
+ * License: BSD3
+ *============================================================================*/
+#ifndef PRIVSEP_H
+#define PRIVSEP_H
+#include "../include/llm_backend.h"
+
+/* Fork the manager that spawns backend workers, then n of them. Each
+   worker runs init(arg) once (replica set, sandbox) and serves calls with
+   fn. Must run before any thread is started; dies on failure. */
+void privsep_start(int n, void (*init)(void *arg), void *arg, llm_fn fn);
+
+/* An llm_fn that runs the call in an idle worker; streaming, cancel and
+   the deadline carry over. A worker that dies is replaced on next use. */
+int  privsep_complete(const struct llm_req *r, struct llm_resp *out);
+
+#endif
@@ -0,0 +1,139 @@
+/*==============================================================================
+ * src/reload.c  —  SIGUSR2: re-exec on the same listener
+ *
+ * The process that takes SIGUSR2 (the --procs supervisor, or the server
+ * itself) forks and execs its own command line again. The listener goes
+ * along as fd 3 with LISTEN_PID/LISTEN_FDS, the way systemd passes one, so
+ * the socket is never closed and connections wait in its queue rather than
+ * being refused. A TCP --bind under --procs has no one listener to pass:
+ * there the new workers bind their own beside the old ones, SO_REUSEPORT
+ * allowing. The new instance writes a byte to a pipe (LLMSERV_READY_FD)
+ * once it accepts, and only then does the old one stop accepting and
+ * drain; if it dies or hangs instead, the old one carries on serving.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "reload.h"
+#include "util.h"
+#include "../config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static char **args;
+static int ready=-1;
+
+void reload_init(int argc, char **argv){
+	/* main() cuts --hme-command's argv short at its "--" */
+	args=xmalloc((size_t)(argc+1)*sizeof *args);
+	memcpy(args, argv, (size_t)argc*sizeof *args);
+	args[argc]=NULL;
+	const char *r=getenv("LLMSERV_READY_FD");
+	if(r){
+		ready=atoi(r);
+		set_cloexec(ready);
+		unsetenv("LLMSERV_READY_FD");
+	}
+}
+
+void reload_ready(void){
+	if(ready<0) return;
+	while(write(ready, "", 1)<0 && errno==EINTR) ;
+	close(ready);
+	ready=-1;
+}
+
+/* argv[0] as execvp() would find it, malloc'd */
+static char *self_path(void){
+	const char *a=args[0], *path=getenv("PATH");
+	if(strchr(a, '/') || !path) return xstrdup(a);
+	struct sbuf b; sb_init(&b);
+	for(const char *p=path, *q; ; p=q+1){
+		q=strchr(p, ':');
+		size_t n = q? (size_t)(q-p) : strlen(p);
+		b.len=0;
+		if(n) sb_putn(&b, p, n); else sb_putc(&b, '.');
+		sb_putc(&b, '/'); sb_puts(&b, a);
+		if(!access(b.s, X_OK) || !q) break;
+	}
+	return sb_steal(&b);
+}
+
+/* decimal v after the '=' of buf; only async-signal-safe calls */
+static void put_num(char *buf, long v){
+	char d[24], *e=strchr(buf, '=')+1;
+	int n=0;
+	do d[n++]=(char)('0'+v%10); while((v/=10));
+	while(n) *e++=d[--n];
+	*e=0;
+}
+
+static int is_ours(const char *e){
+	return !strncmp(e, "LISTEN_PID=", 11) || !strncmp(e, "LISTEN_FDS=", 11)
+	    || !strncmp(e, "LISTEN_FDNAMES=", 15) || !strncmp(e, "LLMSERV_READY_FD=", 17)
+	    || !strncmp(e, "LLMSERV_LISTEN_HELD=", 20);
+}
+
+int reload_exec(int lfd, int held){
+	int p[2];
+	if(pipe(p)){ warnx("reload: pipe failed"); return -1; }
+	set_cloexec(p[0]); set_cloexec(p[1]);
+	/* all the child gets to do between fork and exec is safe in a
+	   threaded process: everything is built here */
+	char *path=self_path();
+	char pid_var[40]="LISTEN_PID=", ready_var[40]="LLMSERV_READY_FD=";
+	int n=0;
+	while(environ[n]) n++;
+	char **env=xmalloc((size_t)(n+5)*sizeof *env);
+	int k=0;
+	for(int i=0;i<n;i++) if(!is_ours(environ[i])) env[k++]=environ[i];
+	env[k++]=ready_var;
+	if(lfd>=0){
+		env[k++]="LISTEN_FDS=1"; env[k++]=pid_var;
+		/* once this process is gone, the socket is the new one's alone */
+		env[k++] = held? "LLMSERV_LISTEN_HELD=1" : "LLMSERV_LISTEN_HELD=0";
+	}
+	env[k]=NULL;
+
+	pid_t pid=fork();
+	if(!pid){
+		int w=p[1];
+		if(w==3 && lfd>=0) w=dup(w);
+		if(lfd>=0 && lfd!=3 && dup2(lfd, 3)<0) _exit(127);
+		if(lfd>=0) fcntl(3, F_SETFD, 0);
+		fcntl(w, F_SETFD, 0);
+		put_num(ready_var, w);
+		put_num(pid_var, (long)getpid());
+		execve(path, args, env);
+		_exit(127);
+	}
+	close(p[1]);
+	free(env);
+	int ok=0;
+	if(pid<0) warnx("reload: fork failed");
+	else{
+		struct pollfd pf={ p[0], POLLIN, 0 };
+		uint64_t end=now_ms()+(uint64_t)RELOAD_WAIT_SEC*1000;
+		char c;
+		for(;;){
+			uint64_t now=now_ms();
+			int r = now<end? poll(&pf, 1, (int)(end-now)) : 0;
+			if(r<0 && errno==EINTR) continue;
+			ok = r>0 && read(p[0], &c, 1)==1;
+			break;
+		}
+		if(!ok){
+			warnx("reload: %s did not start accepting; still serving", path);
+			kill(pid, SIGTERM);
+		}
+	}
+	close(p[0]);
+	free(path);
+	return ok? 0 : -1;
+}
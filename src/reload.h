@@ -0,0 +1,21 @@
+/*==============================================================================
+ * src/reload.h  —  SIGUSR2: re-exec on the same listener
+ * License: BSD3
+ *============================================================================*/
+#ifndef RELOAD_H
+#define RELOAD_H
+
+/* First thing in main(): keep argv for the new instance, and take over the
+   pipe an old instance waits on, if this is a new one. */
+void reload_init(int argc, char **argv);
+
+/* Start the same program, found again by argv[0] so a new build is picked
+   up, with lfd as its listener (LISTEN_FDS) or, for -1, binding its own;
+   held: a service manager keeps lfd open as well. 0 once it accepts; -1,
+   with it stopped, when it did not within RELOAD_WAIT_SEC. */
+int  reload_exec(int lfd, int held);
+
+/* In the new instance, once it accepts: the old one may stop. */
+void reload_ready(void);
+
+#endif
@@ -0,0 +1,245 @@
+/*==============================================================================
+ * src/route.c  —  --routes: per-model backends, upstreams and limits
+ *
+ * One entry per line, the first whose pattern (fnmatch(3)) matches the
+ * request's model wins:
+ *
+ *   # pattern   backend  options
+ *   gpt-4o*     openai   base=https://api.openai.com key_file=/etc/llm/key
+ *   llama3-8b*  openai   base=unix:///run/llm.sock inflight=32 timeout=10
+ *   llama3-70b* openai   base=http://10.0.0.5:8000 inflight=4 max_tokens=2048
+ *   vm-*        hme      cmd=/usr/bin/qrexec-client-vm llm-vm llm.Chat
+ *   trt-*       trtllm   engine=/srv/engine
+ *
+ * base= repeats for replicas; cmd= takes the rest of the line as the
+ * command and its arguments. inflight= caps the route's calls in flight
+ * across all --procs workers and --privsep backends: each call holds one
+ * byte of an unlinked lock file with fcntl(2), which the kernel drops
+ * with the process, so a crashed worker never leaks a slot; a map per
+ * process keeps its threads from sharing a byte.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "route.h"
+#include "upstream.h"
+#include "util.h"
+#include "../config.h"
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_WORDS 64   /* per line */
+
+enum { R_OPENAI, R_HME, R_TRTLLM };
+
+struct route {
+	const char *pattern;
+	int kind;
+	const char **bases; int nbases;
+	char *api_key;                /* key_file=; NULL: the flags' */
+	const char **argv; int argc;  /* cmd= */
+	const char *engine;
+	int inflight, timeout_sec, max_tokens;
+	int lock0;                    /* its first byte in the lock file */
+	unsigned char *held;          /* bytes this process holds */
+	struct upstream_set *ups;
+};
+
+static const struct server_cfg *cfg;
+static struct route routes[ROUTE_MAX];
+static int nroutes, lockfd=-1;
+static char *text;                /* the file; words are cut in place */
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static int number(const char *path, int line, const char *w, const char *v){
+	char *end;
+	long n=strtol(v, &end, 10);
+	if(end==v || *end || n<0 || n>1000000) die("%s:%d: bad value in %s", path, line, w);
+	return (int)n;
+}
+
+void route_load(const char *path, const struct server_cfg *c){
+	cfg=c;
+	if(!(text=read_file(path, NULL))) die("cannot read routes file %s", path);
+	int line=0, slots=0;
+	const char *engine=NULL;
+	for(char *p=text, *nl; p && *p; p=nl){
+		line++;
+		if((nl=strchr(p, '\n'))) *nl++=0;
+		char *w[MAX_WORDS], *save;
+		int nw=0;
+		for(char *t=strtok_r(p, " \t\r", &save); t; t=strtok_r(NULL, " \t\r", &save)){
+			if(nw==MAX_WORDS) die("%s:%d: too many words", path, line);
+			w[nw++]=t;
+		}
+		if(!nw || w[0][0]=='#') continue;
+		if(nw<2) die("%s:%d: pattern without a backend", path, line);
+		if(nroutes==ROUTE_MAX) die("%s: more than %d routes", path, ROUTE_MAX);
+		struct route *rt=&routes[nroutes++];
+		memset(rt, 0, sizeof *rt);
+		rt->pattern=w[0];
+		if(!strcmp(w[1], "openai")) rt->kind=R_OPENAI;
+		else if(!strcmp(w[1], "hme")) rt->kind=R_HME;
+		else if(!strcmp(w[1], "trtllm")) rt->kind=R_TRTLLM;
+		else die("%s:%d: unknown backend %s", path, line, w[1]);
+		rt->bases=xmalloc((size_t)nw*sizeof *rt->bases);
+		for(int i=2;i<nw;i++){
+			char *v=strchr(w[i], '=');
+			if(!v) die("%s:%d: %s is not key=value", path, line, w[i]);
+			*v++=0;
+			if(!strcmp(w[i], "base")) rt->bases[rt->nbases++]=v;
+			else if(!strcmp(w[i], "key_file")){
+				free(rt->api_key);
+				if(!(rt->api_key=read_file(v, NULL))) die("%s:%d: cannot read %s", path, line, v);
+				str_trim(rt->api_key);
+			}
+			else if(!strcmp(w[i], "engine")) rt->engine=v;
+			else if(!strcmp(w[i], "inflight")) rt->inflight=number(path, line, w[i], v);
+			else if(!strcmp(w[i], "timeout")) rt->timeout_sec=number(path, line, w[i], v);
+			else if(!strcmp(w[i], "max_tokens")) rt->max_tokens=number(path, line, w[i], v);
+			else if(!strcmp(w[i], "cmd")){
+				rt->argc=nw-i;
+				rt->argv=xmalloc((size_t)(rt->argc+1)*sizeof *rt->argv);
+				rt->argv[0]=v;
+				for(int j=1;j<rt->argc;j++) rt->argv[j]=w[i+j];
+				rt->argv[rt->argc]=NULL;
+				break;
+			}
+			else die("%s:%d: unknown option %s", path, line, w[i]);
+		}
+		/* what the entry leaves out comes from the flags */
+		if(rt->kind==R_OPENAI && !rt->nbases){
+			free(rt->bases);
+			rt->bases=cfg->api_bases; rt->nbases=cfg->napi_bases;
+		}
+		if(rt->kind==R_HME && !rt->argc){
+			if(!cfg->hme_argc) die("%s:%d: hme route needs cmd= or --hme-command", path, line);
+			rt->argv=cfg->hme_argv; rt->argc=cfg->hme_argc;
+		}
+		if(rt->kind==R_TRTLLM){
+			if(!rt->engine) rt->engine=cfg->trt_engine? cfg->trt_engine : "engine";
+			/* the engine is loaded once per process */
+			if(engine && strcmp(engine, rt->engine)) die("%s:%d: only one TRT-LLM engine per server", path, line);
+			engine=rt->engine;
+		}
+		if(rt->inflight){
+			rt->lock0=slots; slots+=rt->inflight;
+			rt->held=xmalloc((size_t)rt->inflight);
+			memset(rt->held, 0, (size_t)rt->inflight);
+		}
+	}
+	if(!nroutes) die("%s: no routes", path);
+	if(slots){
+		char tmp[]="/tmp/llmserv-routes.XXXXXX";
+		if((lockfd=mkstemp(tmp))<0) die("routes: cannot create lock file");
+		unlink(tmp);
+		set_cloexec(lockfd);
+	}
+}
+
+int route_active(void){ return nroutes>0; }
+
+static struct route *find(const char *model){
+	for(int i=0;i<nroutes;i++)
+		if(!fnmatch(routes[i].pattern, model? model : "", 0)) return &routes[i];
+	return NULL;
+}
+
+int route_timeout(const char *model){
+	struct route *rt=find(model);
+	return rt? rt->timeout_sec : 0;
+}
+
+void route_open_upstreams(int policy, int hedge){
+	if(cfg->no_network) return;
+	for(int i=0;i<nroutes;i++){
+		struct route *rt=&routes[i];
+		if(rt->kind!=R_OPENAI) continue;
+		rt->ups=upstream_set_new(rt->bases, rt->nbases, policy, hedge);
+		if(rt->nbases>1) upstream_start_probes(rt->ups, UP_PROBE_MS);
+	}
+}
+
+void route_free(void){
+	for(int i=0;i<nroutes;i++){
+		struct route *rt=&routes[i];
+		upstream_set_free(rt->ups);
+		if(rt->bases!=cfg->api_bases) free(rt->bases);
+		if(rt->argv!=cfg->hme_argv) free(rt->argv);
+		free(rt->api_key);
+		free(rt->held);
+	}
+	nroutes=0;
+	if(lockfd>=0) close(lockfd);
+	free(text);
+}
+
+void route_drop_keys(void){
+	for(int i=0;i<nroutes;i++){
+		str_wipe(routes[i].api_key);
+		free(routes[i].api_key);
+		routes[i].api_key=NULL;
+	}
+}
+
+/* ------------------------------- in flight -------------------------------- */
+static int lock_byte(int off, short type){
+	struct flock fl;
+	memset(&fl, 0, sizeof fl);
+	fl.l_type=type; fl.l_whence=SEEK_SET;
+	fl.l_start=(off_t)off; fl.l_len=1;
+	return fcntl(lockfd, F_SETLK, &fl);
+}
+
+static int acquire(struct route *rt){
+	int got=-1;
+	pthread_mutex_lock(&mtx);
+	for(int i=0;i<rt->inflight && got<0;i++)
+		if(!rt->held[i] && !lock_byte(rt->lock0+i, F_WRLCK)){ rt->held[i]=1; got=i; }
+	pthread_mutex_unlock(&mtx);
+	return got;
+}
+
+static void release(struct route *rt, int i){
+	pthread_mutex_lock(&mtx);
+	lock_byte(rt->lock0+i, F_UNLCK);
+	rt->held[i]=0;
+	pthread_mutex_unlock(&mtx);
+}
+
+/* --------------------------------- calls ---------------------------------- */
+int route_complete(const struct llm_req *r, struct llm_resp *out){
+	memset(out, 0, sizeof *out);
+	struct route *rt=find(r->model);
+	struct sbuf e; sb_init(&e);
+	if(!rt){
+		sb_printf(&e, "no route for model %s", r->model? r->model : "");
+		out->status=LLM_EREJECTED; out->http_status=404; out->err=sb_steal(&e);
+		return -1;
+	}
+	int slot=-1;
+	if(rt->inflight && (slot=acquire(rt))<0){
+		sb_printf(&e, "model %s is busy (%d requests in flight)", r->model, rt->inflight);
+		out->status=LLM_ETHROTTLED; out->retry_after_ms=ROUTE_BUSY_RETRY_MS; out->err=sb_steal(&e);
+		return -1;
+	}
+	struct llm_req q=*r;
+	if(rt->kind==R_OPENAI) q.api_base=rt->bases[0];
+	if(rt->api_key) q.api_key=rt->api_key;
+	q.hme_argv = rt->kind==R_HME? rt->argv : NULL;
+	q.hme_argc = rt->kind==R_HME? rt->argc : 0;
+	q.trt_engine_path=rt->engine;
+	if(rt->max_tokens>0 && (q.max_tokens<=0 || q.max_tokens>rt->max_tokens)) q.max_tokens=rt->max_tokens;
+	if(rt->timeout_sec>0){
+		unsigned long long d=now_us()+(uint64_t)rt->timeout_sec*1000000;
+		if(!q.deadline_us || d<q.deadline_us) q.deadline_us=d;
+	}
+	llm_fn fn = rt->kind==R_TRTLLM? llm_trtllm_complete : llm_openai_complete;
+	int rc = rt->ups? upstream_complete(rt->ups, fn, &q, out) : fn(&q, out);
+	if(slot>=0) release(rt, slot);
+	return rc;
+}
@@ -0,0 +1,31 @@
+/*==============================================================================
+ * src/route.h  —  --routes: per-model backends, upstreams and limits
+ * License: BSD3
+ *============================================================================*/
+#ifndef ROUTE_H
+#define ROUTE_H
+#include "httpd.h"
+
+/* Read the routing table; an entry left without base=, cmd= or engine=
+   takes the one given by the flags in cfg. Call before --procs forks:
+   the in-flight limits hold across every process. Dies on error. */
+void route_load(const char *path, const struct server_cfg *cfg);
+int  route_active(void);
+
+/* Replica sets for the openai routes, in each process that makes calls */
+void route_open_upstreams(int policy, int hedge);
+void route_free(void);
+
+/* Wipe the key_file= keys: the --privsep front end, once its workers
+   have their own copies */
+void route_drop_keys(void);
+
+/* timeout= of the first route matching model; 0 when none is set */
+int  route_timeout(const char *model);
+
+/* An llm_fn that dispatches on r->model: no matching route is
+   LLM_EREJECTED (HTTP 404), a route at its inflight= limit
+   LLM_ETHROTTLED; max_tokens is cut to the route's ceiling. */
+int  route_complete(const struct llm_req *r, struct llm_resp *out);
+
+#endif
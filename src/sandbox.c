@@ -10,11 +10,17 @@
 #if defined(__OpenBSD__)
 #include <unistd.h>
 #include <err.h>
-int sandbox_init_web(int allow_outbound){
+int sandbox_init_web(int allow_outbound, int allow_logwrite, int pass_fds){
 	(void)allow_outbound;
 #if 1
-	/* We must keep "inet" to accept(), pledge can't differentiate connect(). */
-	const char *promises = "stdio rpath inet dns";
+	/* We must keep "inet" to accept(), pledge can't differentiate connect();
+	   "unix" for --bind unix:PATH and unix:// upstreams; "flock" for the
+	   --routes and --store locks.
+	   wpath/cpath only when the access log may be reopened on SIGHUP or
+	   --store starts and removes segments. */
+	char promises[96];
+	snprintf(promises, sizeof promises, "stdio rpath inet unix dns flock%s%s",
+	         allow_logwrite? " wpath cpath" : "", pass_fds? " sendfd recvfd" : "");
 	if(pledge(promises, NULL)==-1) err(1,"pledge");
 #endif
 #if 0
@@ -23,6 +29,12 @@ int sandbox_init_web(int allow_outbound){
 #endif
 	return 0;
 }
+int sandbox_init_backend(int allow_outbound){
+	(void)allow_outbound;   /* no inbound socket to tell apart */
+	/* proc exec: the curl fallback and --hme-command */
+	if(pledge("stdio rpath inet unix dns proc exec sendfd recvfd", NULL)==-1) err(1,"pledge");
+	return 0;
+}
 int sandbox_block_connect_linux(void){ return 0; }
 #elif defined(__linux__)
 #include <linux/seccomp.h>
@@ -46,10 +58,14 @@ static int install_seccomp_block_connect(void){
 	return 0;
 }
 int sandbox_block_connect_linux(void){ return install_seccomp_block_connect(); }
-int sandbox_init_web(int allow_outbound){
-	(void)allow_outbound; return 0;
+int sandbox_init_web(int allow_outbound, int allow_logwrite, int pass_fds){
+	(void)allow_outbound; (void)allow_logwrite; (void)pass_fds; return 0;
+}
+int sandbox_init_backend(int allow_outbound){
+	return allow_outbound? 0 : install_seccomp_block_connect();
 }
 #else
-int sandbox_init_web(int allow_outbound){ (void)allow_outbound; return 0; }
+int sandbox_init_web(int allow_outbound, int allow_logwrite, int pass_fds){ (void)allow_outbound; (void)allow_logwrite; (void)pass_fds; return 0; }
+int sandbox_init_backend(int allow_outbound){ (void)allow_outbound; return 0; }
 int sandbox_block_connect_linux(void){ return 0; }
 #endif
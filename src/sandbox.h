@@ -4,6 +4,8 @@
  *============================================================================*/
 #ifndef SANDBOX_H
 #define SANDBOX_H
-int sandbox_init_web(int allow_outbound);
+/* pass_fds: the front end of --privsep, trading descriptors with workers */
+int sandbox_init_web(int allow_outbound, int allow_logwrite, int pass_fds);
+int sandbox_init_backend(int allow_outbound);   /* a --privsep worker */
 int sandbox_block_connect_linux(void); /* best-effort on Linux */
 #endif
@@ -0,0 +1,476 @@
+/*==============================================================================
+ * src/store.c  —  --store: conversations on disk, resumed by id
+ *
+ * Entries are appended to segment files as length-prefixed records, each
+ * pointing back at the one before it in its conversation: a reply adds
+ * records and rewrites none, and a page sent again from further back in the
+ * browser forks a new chain off the old one. The index, one file mmap'd by
+ * every --procs worker, maps an id to its chain's last record by open
+ * addressing, so a resume is one probe and a walk down the chain, and
+ * memory holds only what pages of it the kernel keeps. Appends are synced
+ * in batches: every STORE_SYNC_MS a thread fdatasync()s the newest segment
+ * and only then records the chains as ones to fall back on, so a crash
+ * loses at most that much and no id is left on a torn record. Once there
+ * are more than STORE_SEGMENTS segments, and twice as many as the last
+ * compaction left, the same thread compacts: conversations are copied to
+ * the newest segment, those idle STORE_IDLE_DAYS dropped, and the older
+ * files removed. Writers in all processes take an fcntl(2) lock on the
+ * index; a mutex does the same between a process's threads.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "store.h"
+#include "util.h"
+#include "../config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEP    "\n\n===\n\n"        /* between history entries, as in httpd.c */
+#define MAGIC  "llmstor1"
+#define NFD    (2*STORE_SEGMENTS+2) /* segment fds kept open */
+#define CHUNK  4096                 /* index slots compacted per lock */
+
+/* a record's place: segment number and offset in it; 0 is none */
+#define LOC(seg, off) ((uint64_t)(seg)<<40 | (uint64_t)(off))
+#define SEG(l)        ((uint32_t)((l)>>40))
+#define OFF(l)        ((off_t)((l) & (((uint64_t)1<<40)-1)))
+
+/* all in native byte order: a store belongs to one machine */
+struct head {
+	char magic[8];
+	uint32_t nslots;
+	uint32_t lo, hi;                /* live segments; appends go to hi */
+	uint32_t floor;                 /* how many the last compaction left */
+	uint64_t used;
+};
+
+struct slot {
+	uint64_t id[2];                 /* 0,0: empty */
+	uint64_t last, durable;         /* last record; last one known synced */
+	uint32_t n, ndurable;           /* entries up to each */
+	uint32_t seg0;                  /* oldest segment the chain reaches */
+	uint32_t atime;                 /* last append, seconds since the epoch */
+};
+
+struct rec {
+	uint32_t len, sum;              /* of the entry that follows; FNV-1a */
+	uint64_t prev;                  /* the conversation's record before */
+};
+
+static int dfd=-1, ifd=-1, rnd=-1;
+static struct head *hd;
+static struct slot *tab;
+static size_t maplen;
+static struct { uint32_t seg; int fd; } fds[NFD];
+static uint64_t dirty[STORE_DIRTY][2];  /* ids appended to since the last sync */
+static int ndirty, running, stop;
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thr;
+
+/* --------------------------------- locks ---------------------------------- */
+/* byte 0 of the index: readers and writers; byte 1: the compactor */
+static int lk(int byte, short type, int cmd){
+	struct flock fl;
+	memset(&fl, 0, sizeof fl);
+	fl.l_type=type; fl.l_whence=SEEK_SET;
+	fl.l_start=byte; fl.l_len=1;
+	int r;
+	while((r=fcntl(ifd, cmd, &fl))<0 && errno==EINTR) ;
+	return r;
+}
+
+static void lock(short type){ pthread_mutex_lock(&mtx); lk(0, type, F_SETLKW); }
+static void unlock(void){ lk(0, F_UNLCK, F_SETLK); pthread_mutex_unlock(&mtx); }
+
+/* -------------------------------- records --------------------------------- */
+static uint32_t fnv(uint32_t h, const void *p, size_t n){
+	for(const unsigned char *c=p; n--; c++) h=(h^*c)*16777619u;
+	return h;
+}
+
+static uint32_t rec_sum(uint64_t prev, const char *p, size_t len){
+	return fnv(fnv(2166136261u, &prev, sizeof prev), p, len);
+}
+
+static int seg_fd(uint32_t seg, int create){
+	int i=(int)(seg%NFD);
+	if(fds[i].fd>=0 && fds[i].seg==seg) return fds[i].fd;
+	if(fds[i].fd>=0) close(fds[i].fd);
+	char name[24];
+	snprintf(name, sizeof name, "%08u.seg", (unsigned)seg);
+	fds[i].seg=seg;
+	fds[i].fd=openat(dfd, name, O_RDWR);
+	if(fds[i].fd<0 && errno==ENOENT && create){
+		/* its name must outlive a crash before any chain in it is durable */
+		fds[i].fd=openat(dfd, name, O_RDWR|O_CREAT, 0600);
+		if(fds[i].fd>=0 && fsync(dfd)<0) warnx("store: cannot sync the directory");
+	}
+	if(fds[i].fd>=0) set_cloexec(fds[i].fd);
+	return fds[i].fd;
+}
+
+/* the record at loc: its prev, and its entry appended to b unless NULL */
+static int rec_read(uint64_t loc, uint64_t *prev, struct sbuf *b){
+	struct rec r;
+	int fd=seg_fd(SEG(loc), 0);
+	if(fd<0 || pread(fd, &r, sizeof r, OFF(loc))!=(ssize_t)sizeof r || r.len>STORE_SEGMENT_BYTES) return -1;
+	*prev=r.prev;
+	if(!b) return 0;
+	char *p=sb_reserve(b, r.len);
+	if(pread(fd, p, r.len, OFF(loc)+(off_t)sizeof r)!=(ssize_t)r.len || rec_sum(r.prev, p, r.len)!=r.sum) return -1;
+	sb_commit(b, r.len);
+	return 0;
+}
+
+/* The entries in e as records chained after prev, in one write at the end
+   of the newest segment: the last one's place, or 0 */
+static uint64_t write_entries(uint64_t prev, const char *e, uint32_t *n, uint32_t *seg0){
+	size_t total=0;
+	*n=0;
+	for(const char *p=e, *q; p; p = q? q+strlen(SEP) : NULL){
+		q=strstr(p, SEP);
+		total += sizeof(struct rec) + (q? (size_t)(q-p) : strlen(p));
+		++*n;
+	}
+	int fd=seg_fd(hd->hi, 1);
+	off_t off = fd<0? -1 : lseek(fd, 0, SEEK_END);
+	if(off<0) return 0;
+	if(off>0 && (uint64_t)off+total > STORE_SEGMENT_BYTES){
+		/* only the newest segment may end in a torn record */
+		fdatasync(fd);
+		hd->hi++; off=0;
+		if((fd=seg_fd(hd->hi, 1))<0) return 0;
+	}
+	if(!*seg0) *seg0=hd->hi;
+	struct sbuf b; sb_init(&b);
+	for(const char *p=e, *q; p; p = q? q+strlen(SEP) : NULL){
+		q=strstr(p, SEP);
+		size_t len = q? (size_t)(q-p) : strlen(p);
+		struct rec r={ (uint32_t)len, rec_sum(prev, p, len), prev };
+		prev=LOC(hd->hi, (uint64_t)off+b.len);
+		sb_putn(&b, (const char*)&r, sizeof r);
+		sb_putn(&b, p, len);
+	}
+	if(pwrite(fd, b.s, b.len, off)!=(ssize_t)b.len){
+		if(ftruncate(fd, off)<0) warnx("store: cannot cut segment %u", (unsigned)hd->hi);
+		prev=0;
+	}
+	sb_free(&b);
+	return prev;
+}
+
+/* entries [0, cnt) of s in history format, malloc'd; NULL on a broken chain */
+static char *entries_of(const struct slot *s, uint32_t cnt){
+	uint64_t *loc=xmalloc((cnt? cnt : 1)*sizeof *loc), l=s->last, prev;
+	uint32_t i;
+	for(i=s->n; i>0 && l; i--){
+		if(i<=cnt) loc[i-1]=l;
+		if(rec_read(l, &prev, NULL)<0) break;
+		l=prev;
+	}
+	struct sbuf b; sb_init(&b);
+	uint32_t k=0;
+	if(!i) for(; k<cnt; k++){
+		if(k) sb_puts(&b, SEP);
+		if(rec_read(loc[k], &prev, &b)<0) break;
+	}
+	free(loc);
+	if(i || k<cnt){ sb_free(&b); return NULL; }
+	return b.s? sb_steal(&b) : xstrdup("");
+}
+
+/* ---------------------------------- index --------------------------------- */
+static int empty(const struct slot *s){ return !s->id[0] && !s->id[1]; }
+
+static struct slot *find(const uint64_t k[2]){
+	uint32_t i=(uint32_t)(k[0]%hd->nslots);
+	for(uint32_t m=0; m<hd->nslots && !empty(&tab[i]); m++, i=(i+1)%hd->nslots)
+		if(tab[i].id[0]==k[0] && tab[i].id[1]==k[1]) return &tab[i];
+	return NULL;
+}
+
+static struct slot *insert(const uint64_t k[2]){
+	if(hd->used*4 >= (uint64_t)hd->nslots*3) return NULL;   /* keep probes short */
+	uint32_t i=(uint32_t)(k[0]%hd->nslots);
+	while(!empty(&tab[i])) i=(i+1)%hd->nslots;
+	memset(&tab[i], 0, sizeof *tab);
+	tab[i].id[0]=k[0]; tab[i].id[1]=k[1];
+	hd->used++;
+	return &tab[i];
+}
+
+/* Backward-shift deletion: the slot is refilled by a later one that
+   probed past it, if any, so callers look at it again */
+static void del(struct slot *s){
+	uint32_t i=(uint32_t)(s-tab), j=i, n=hd->nslots;
+	for(;;){
+		j=(j+1)%n;
+		if(empty(&tab[j])) break;
+		uint32_t h=(uint32_t)(tab[j].id[0]%n);
+		if(i<=j? (i<h && h<=j) : (i<h || h<=j)) continue;
+		tab[i]=tab[j]; i=j;
+	}
+	memset(&tab[i], 0, sizeof *tab);
+	hd->used--;
+}
+
+static int parse_id(const char *s, uint64_t k[2]){
+	if(!s || strlen(s)!=STORE_ID_LEN) return -1;
+	k[0]=k[1]=0;
+	for(int i=0;i<STORE_ID_LEN;i++){
+		int c=s[i], v = c>='0' && c<='9'? c-'0' : c>='a' && c<='f'? c-'a'+10 : -1;
+		if(v<0) return -1;
+		k[i/16]=k[i/16]<<4 | (uint64_t)v;
+	}
+	return k[0] || k[1]? 0 : -1;
+}
+
+static int new_id(uint64_t k[2]){
+	do{
+		if(read(rnd, k, 2*sizeof *k)!=(ssize_t)(2*sizeof *k)) return -1;
+	}while((!k[0] && !k[1]) || find(k));
+	return 0;
+}
+
+/* 1 once the list is full: sync before the next append */
+static int mark(const uint64_t k[2]){
+	if(ndirty<STORE_DIRTY){ dirty[ndirty][0]=k[0]; dirty[ndirty][1]=k[1]; ndirty++; }
+	return ndirty==STORE_DIRTY;
+}
+
+/* ----------------------------- sync, compaction ---------------------------- */
+/* Make this process's appends durable: the newest segment up to where it
+   ends now (the ones before were synced when it was started), then the
+   chains marked as ones to fall back on, then the index. */
+static void sync_now(void){
+	uint64_t ids[STORE_DIRTY][2];
+	lock(F_RDLCK);
+	int n=ndirty;
+	memcpy(ids, dirty, (size_t)n*sizeof *ids);
+	ndirty=0;
+	uint32_t seg=hd->hi;
+	int fd=seg_fd(seg, 1);
+	off_t end = fd<0? 0 : lseek(fd, 0, SEEK_END);
+	fd = fd<0? -1 : dup(fd);        /* the request thread may close its copy */
+	for(int i=0;i<NFD;i++)
+		if(fds[i].fd>=0 && fds[i].seg<hd->lo){ close(fds[i].fd); fds[i].fd=-1; }
+	unlock();
+	if(fd<0) return;
+	int ok = !n || !fdatasync(fd);
+	close(fd);
+	if(!n) return;
+	if(!ok){ warnx("store: fdatasync failed"); return; }
+	uint64_t point=LOC(seg, (uint64_t)(end>0? end : 0));
+	lock(F_WRLCK);
+	for(int i=0;i<n;i++){
+		struct slot *s=find(ids[i]);
+		if(s && s->last<point){ s->durable=s->last; s->ndurable=s->n; }
+	}
+	unlock();
+	msync(hd, maplen, MS_SYNC);
+}
+
+/* Past STORE_SEGMENTS segments, and twice as many as the last compaction
+   left, so that live data is copied a bounded number of times */
+static int due(void){
+	uint32_t n=hd->hi-hd->lo+1, f=2*hd->floor;
+	return n > (f>STORE_SEGMENTS? f : STORE_SEGMENTS);
+}
+
+/* Empty every segment before the newest into it, then remove them */
+static void compact(void){
+	lock(F_RDLCK);
+	int go=due();
+	unlock();
+	if(!go || lk(1, F_WRLCK, F_SETLK)<0) return;   /* or another process is at it */
+	lock(F_RDLCK);
+	uint32_t lo=hd->lo, upto=hd->hi, nslots=hd->nslots;
+	go=due();
+	unlock();
+	uint32_t idle=(uint32_t)time(NULL) - STORE_IDLE_DAYS*86400u;
+	/* again until a pass finds no chain reaching before upto: appends and
+	   deletions move conversations behind the scan */
+	for(int again=go; again; ){
+		again=0;
+		for(uint32_t j=0; j<nslots; ){
+			lock(F_WRLCK);
+			for(uint32_t end=j+CHUNK; j<nslots && j<end && ndirty<STORE_DIRTY; j++){
+				struct slot *s=&tab[j];
+				if(empty(s) || s->seg0>=upto) continue;
+				again=1;
+				char *e = s->atime<idle? NULL : entries_of(s, s->n);
+				if(!e){ del(s); j--; continue; }
+				uint32_t n, seg0=0;
+				uint64_t last=write_entries(0, e, &n, &seg0);
+				free(e);
+				if(!last){ unlock(); goto out; }
+				s->last=last; s->seg0=seg0;
+				mark(s->id);
+			}
+			int full = ndirty==STORE_DIRTY;
+			unlock();
+			if(full) sync_now();
+		}
+	}
+	if(go){
+		sync_now();
+		lock(F_WRLCK);
+		/* a chain another process appended to since is not ours to sync */
+		for(uint32_t j=0;j<nslots;j++)
+			if(!empty(&tab[j]) && tab[j].durable && SEG(tab[j].durable)<upto){ tab[j].durable=0; tab[j].ndurable=0; }
+		hd->lo=upto;
+		hd->floor=hd->hi-hd->lo+1;
+		unlock();
+		msync(hd, maplen, MS_SYNC);
+		for(uint32_t seg=lo; seg<upto; seg++){
+			char name[24];
+			snprintf(name, sizeof name, "%08u.seg", (unsigned)seg);
+			unlinkat(dfd, name, 0);
+		}
+		fsync(dfd);
+	}
+out:
+	lk(1, F_UNLCK, F_SETLK);
+}
+
+static void *run(void *arg){
+	(void)arg;
+	struct timespec ts={ STORE_SYNC_MS/1000, (STORE_SYNC_MS%1000)*1000000L };
+	while(!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)){
+		nanosleep(&ts, NULL);
+		sync_now();
+		compact();
+	}
+	return NULL;
+}
+
+/* ----------------------------------- api ---------------------------------- */
+int store_active(void){ return hd!=NULL; }
+
+char *store_history(const char *id, int at, int *n){
+	uint64_t k[2];
+	char *r=NULL;
+	*n=0;
+	if(!hd || parse_id(id, k)<0) return NULL;
+	lock(F_RDLCK);
+	struct slot *s=find(k);
+	if(s){
+		uint32_t cnt = at>0 && (uint32_t)at<s->n? (uint32_t)at : s->n;
+		if((r=entries_of(s, cnt))) *n=(int)cnt;
+	}
+	unlock();
+	return r;
+}
+
+int store_append(char id[STORE_ID_LEN+1], int at, const char *entries){
+	if(!hd || !entries || !*entries) return -1;
+	uint64_t k[2], prev=0;
+	uint32_t n=0, seg0=0, added;
+	int full=0, rc=-1;
+	lock(F_WRLCK);
+	struct slot *s = parse_id(id, k)<0? NULL : find(k);
+	if(s && at>=0 && (uint32_t)at>=s->n){ prev=s->last; n=s->n; seg0=s->seg0; }
+	else{
+		if(s && at>0){
+			/* fork: the new chain goes on from entry at-1 of this one */
+			uint64_t l=s->last;
+			for(uint32_t i=s->n; i>(uint32_t)at && l; i--) if(rec_read(l, &l, NULL)<0) l=0;
+			if(!l) goto out;
+			prev=l; n=(uint32_t)at; seg0=s->seg0;
+		}
+		s=NULL;
+		if(new_id(k)<0) goto out;
+	}
+	uint64_t last=write_entries(prev, entries, &added, &seg0);
+	if(!last) goto out;
+	if(!s && !(s=insert(k))){ warnx("store: the index is full"); goto out; }
+	s->last=last; s->n=n+added; s->seg0=seg0;
+	s->atime=(uint32_t)time(NULL);
+	full=mark(k);
+	snprintf(id, STORE_ID_LEN+1, "%016llx%016llx", (unsigned long long)k[0], (unsigned long long)k[1]);
+	rc=(int)s->n;
+out:
+	unlock();
+	if(full) sync_now();
+	return rc;
+}
+
+/* After a crash: cut the newest segment at its first torn record, and put
+   every conversation back on a record that survived */
+static void recover(void){
+	uint32_t hi=hd->hi;
+	int fd=seg_fd(hi, 1);
+	if(fd<0) die("store: cannot open segment %u", (unsigned)hi);
+	off_t size=lseek(fd, 0, SEEK_END), end=0;
+	uint64_t prev;
+	struct sbuf b; sb_init(&b);
+	for(; end<size && !rec_read(LOC(hi, (uint64_t)end), &prev, &b); b.len=0)
+		end += (off_t)(sizeof(struct rec)+b.len);
+	sb_free(&b);
+	if(end<size){
+		warnx("store: cutting %lld torn bytes off segment %u", (long long)(size-end), (unsigned)hi);
+		if(ftruncate(fd, end)<0) die("store: cannot cut segment %u", (unsigned)hi);
+	}
+	uint64_t lo=LOC(hd->lo, 0), ok=LOC(hi, (uint64_t)end);
+	for(uint32_t i=0;i<hd->nslots;i++){
+		struct slot *s=&tab[i];
+		if(empty(s) || (s->last>=lo && s->last<ok)) continue;
+		if(s->durable>=lo && s->durable<ok){ s->last=s->durable; s->n=s->ndurable; }
+		else{ del(s); i--; }
+	}
+}
+
+void store_open(const char *dir){
+	struct stat st;
+	if(mkdir(dir, 0700)<0 && errno!=EEXIST) die("store: cannot create %s", dir);
+	if((dfd=open(dir, O_RDONLY|O_DIRECTORY))<0) die("store: cannot open %s", dir);
+	if((ifd=openat(dfd, "index", O_RDWR|O_CREAT, 0600))<0 || fstat(ifd, &st)<0)
+		die("store: cannot open %s/index", dir);
+	if((rnd=open("/dev/urandom", O_RDONLY))<0) die("store: cannot open /dev/urandom");
+	set_cloexec(dfd); set_cloexec(ifd); set_cloexec(rnd);
+	for(int i=0;i<NFD;i++) fds[i].fd=-1;
+	/* a server on its way out may still be appending */
+	lock(F_WRLCK);
+	size_t fresh=sizeof *hd + (size_t)STORE_INDEX_SLOTS*sizeof *tab;
+	if(!st.st_size && ftruncate(ifd, (off_t)fresh)<0) die("store: cannot size %s/index", dir);
+	if(!st.st_size && fsync(dfd)<0) die("store: cannot sync %s", dir);
+	maplen = st.st_size? (size_t)st.st_size : fresh;
+	void *m = maplen<sizeof *hd? MAP_FAILED : mmap(NULL, maplen, PROT_READ|PROT_WRITE, MAP_SHARED, ifd, 0);
+	if(m==MAP_FAILED) die("store: cannot map %s/index", dir);
+	hd=m; tab=(struct slot*)(hd+1);
+	if(!st.st_size){
+		memcpy(hd->magic, MAGIC, sizeof hd->magic);
+		hd->nslots=STORE_INDEX_SLOTS; hd->lo=hd->hi=1;
+	}else if(memcmp(hd->magic, MAGIC, sizeof hd->magic) || maplen!=sizeof *hd+(size_t)hd->nslots*sizeof *tab)
+		die("store: %s/index is not a store index", dir);
+	recover();
+	unlock();
+}
+
+void store_start(void){
+	if(!hd) return;
+	if(pthread_create(&thr, NULL, run, NULL)) die("store: cannot start thread");
+	running=1;
+}
+
+void store_close(void){
+	if(!hd) return;
+	if(running){
+		__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+		pthread_join(thr, NULL);
+		running=0;
+	}
+	sync_now();
+	munmap(hd, maplen);
+	hd=NULL;
+	for(int i=0;i<NFD;i++) if(fds[i].fd>=0) close(fds[i].fd);
+	close(ifd); close(dfd); close(rnd);
+}
@@ -0,0 +1,32 @@
+/*==============================================================================
+ * src/store.h  —  --store: conversations on disk, resumed by id
+ * License: BSD3
+ *============================================================================*/
+#ifndef STORE_H
+#define STORE_H
+
+#define STORE_ID_LEN 32           /* hex digits of a conversation id */
+
+/* Open or create the store in dir and repair what a crash left behind.
+   Call before --procs forks: every worker shares the index. Dies on error. */
+void store_open(const char *dir);
+int  store_active(void);
+
+/* The thread that syncs appends in batches and compacts old segments, in
+   each process that serves requests */
+void store_start(void);
+void store_close(void);
+
+/* The first `at` entries of conversation id (all when at is 0 or past the
+   end) in /chat history format, malloc'd, with their number in *n; NULL
+   for an unknown id. */
+char *store_history(const char *id, int at, int *n);
+
+/* Append history-format entries to conversation id after its first `at`.
+   An empty id, or an `at` the conversation has grown past since (another
+   tab, the back button), starts a new conversation, sharing the first
+   `at` entries: id is set to it. The number of entries it now has, or -1
+   when the store is full or failing. */
+int  store_append(char id[STORE_ID_LEN+1], int at, const char *entries);
+
+#endif
@@ -7,23 +7,19 @@
 #include "../config.h"
 
 char *render_page(const char *app_title,
-                  const char *css,
+                  const char *css_href,
                   const char *model,
                   double temperature,
                   const char *transcript_pre,
                   const char *history_raw,
+                  const char *conv, int at,
                   const char *error_html)
 {
 	struct sbuf b; sb_init(&b);
 	sb_printf(&b,
-"HTTP/1.1 200 OK\r\n"
-"Content-Type: text/html; charset=utf-8\r\n"
-CSP_HEADER XFO_HEADER REF_HEADER CACHECTL
-"Connection: close\r\n"
-"\r\n"
 "<!doctype html><html lang=en><meta charset=utf-8>"
-"<title>%s</title><style>%s</style><h1>%s</h1>",
-		app_title, css, app_title);
+"<title>%s</title><link rel=stylesheet href=\"%s\"><h1>%s</h1>",
+		app_title, css_href, app_title);
 
 	if (error_html && *error_html)
 		sb_printf(&b, "<p class=warn>%s</p>", error_html);
@@ -44,19 +40,25 @@ CSP_HEADER XFO_HEADER REF_HEADER CACHECTL
 	sb_puts(&b, "</div>");
 	sb_puts(&b, "</div>");
 
-	/* stateless history */
-	sb_puts(&b, "<textarea name=history style=\"display:none\">");
-	if(history_raw) {
-		/* history_raw is raw (not HTML-escaped). It's inside <textarea> so fine. */
-		sb_puts(&b, history_raw);
+	/* --store keeps the history on the server; else it is all in the page */
+	if(conv)
+		sb_printf(&b, "<input type=hidden name=conv value=%s><input type=hidden name=at value=%d>", conv, at);
+	else{
+		sb_puts(&b, "<textarea name=history hidden>");
+		if(history_raw) {
+			/* history_raw is raw (not HTML-escaped). It's inside <textarea> so fine. */
+			sb_puts(&b, history_raw);
+		}
+		sb_puts(&b, "</textarea>");
 	}
-	sb_puts(&b, "</textarea>");
 
 	sb_puts(&b, "<p><button type=submit>Send</button></p></form>");
 
 	sb_puts(&b, "<h2>Transcript</h2><pre>");
 	if (transcript_pre) sb_puts(&b, transcript_pre);
-	sb_puts(&b, "</pre><p class=footer>"
+	sb_puts(&b, "</pre>");
+	if(conv) sb_printf(&b, "<p class=footer><a href=\"/c/%s\">Link to this conversation</a></p>", conv);
+	sb_puts(&b, "<p class=footer>"
 		"This UI uses no JavaScript. Responses render on full-page reload.</p></html>");
 
 	return sb_steal(&b);
@@ -4,11 +4,13 @@
  *============================================================================*/
 #ifndef TMPL_H
 #define TMPL_H
+/* the HTML document only; the caller sends the head */
 char *render_page(const char *app_title,
-                  const char *css,
+                  const char *css_href,       /* stylesheet URL */
                   const char *model,
                   double temperature,
                   const char *transcript_pre, /* already HTML-escaped */
                   const char *history_raw,    /* raw hidden field */
+                  const char *conv, int at,   /* --store: id and entries, or NULL */
                   const char *error_html);    /* optional */
 #endif
@@ -0,0 +1,133 @@
+/*==============================================================================
+ * src/trace.c  —  per-request span timelines in Chrome trace format
+ *
+ * A span is written into the ring of the thread that took it, with no lock:
+ * a thread claims a ring on its first span and parks it when it exits, and
+ * a later thread takes a parked ring over, so there are never more rings
+ * than threads ever alive at once. Spans outlive their thread until
+ * overwritten, which keeps those of finished upstream attempts around for
+ * trace_flush(), which scans every ring for one request id and appends its
+ * spans to the file with a single write(). The file is a JSON array that
+ * is never closed, which Chrome's about:tracing and Perfetto both accept;
+ * O_APPEND lets --procs workers and --privsep backends share it.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include "util.h"
+#include "../config.h"
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+struct span { const char *name; uint64_t id, ts, dur; };
+
+struct ring {
+	struct ring *next;
+	int tid, live;
+	uint64_t w;                         /* spans written; next at w%TRACE_RING_SPANS */
+	struct span s[TRACE_RING_SPANS];
+};
+
+static int fd=-1;
+static unsigned sample;
+static uint64_t seq, until;             /* until: on-demand window end, now_us() */
+static volatile sig_atomic_t usr1;
+static struct ring *rings;              /* all of them, live or parked */
+static int nrings;
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t key;
+
+static void on_usr1(int sig){ (void)sig; usr1=1; }
+
+static void park(void *p){
+	pthread_mutex_lock(&mtx);
+	((struct ring*)p)->live=0;
+	pthread_mutex_unlock(&mtx);
+}
+
+int trace_open(const char *path, unsigned n){
+	/* the first opener starts the array; later ones (a restart, another
+	   worker) append to it */
+	int first=1;
+	fd=open(path, O_WRONLY|O_APPEND|O_CREAT|O_EXCL, 0644);
+	if(fd<0 && errno==EEXIST){ first=0; fd=open(path, O_WRONLY|O_APPEND); }
+	if(fd<0) return -1;
+	set_cloexec(fd);
+	if(first && write(fd, "[\n", 2)!=2){ close(fd); fd=-1; return -1; }
+	sample=n;
+	pthread_key_create(&key, park);
+	struct sigaction sa; memset(&sa, 0, sizeof sa);
+	sa.sa_handler=on_usr1; sa.sa_flags=SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	return 0;
+}
+
+uint64_t trace_next(void){
+	if(fd<0) return 0;
+	uint64_t n=__atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED);
+	if(usr1){
+		usr1=0;
+		__atomic_store_n(&until, now_us()+(uint64_t)TRACE_ONDEMAND_SEC*1000000, __ATOMIC_RELAXED);
+	}
+	uint64_t u=__atomic_load_n(&until, __ATOMIC_RELAXED);
+	if(!(sample && n%sample==0) && !(u && now_us()<u)) return 0;
+	return (uint64_t)getpid()<<32 | (n & 0xffffffffu);
+}
+
+uint64_t trace_t0(uint64_t id){ return id? now_us() : 0; }
+
+static struct ring *my_ring(void){
+	struct ring *g=pthread_getspecific(key);
+	if(g) return g;
+	pthread_mutex_lock(&mtx);
+	for(g=rings; g && g->live; g=g->next) ;
+	if(!g){
+		g=xmalloc(sizeof *g);
+		memset(g, 0, sizeof *g);
+		g->tid=++nrings;
+		g->next=rings; rings=g;
+	}
+	g->live=1;
+	pthread_mutex_unlock(&mtx);
+	pthread_setspecific(key, g);
+	return g;
+}
+
+void trace_span(uint64_t id, const char *name, uint64_t t0){
+	if(!id) return;
+	uint64_t now=now_us();
+	struct ring *g=my_ring();
+	uint64_t w=g->w;
+	g->s[w%TRACE_RING_SPANS]=(struct span){ name, id, t0, now-t0 };
+	__atomic_store_n(&g->w, w+1, __ATOMIC_RELEASE);
+}
+
+void trace_flush(uint64_t id){
+	if(!id || fd<0) return;
+	struct sbuf b; sb_init(&b);
+	int pid=(int)getpid();
+	pthread_mutex_lock(&mtx);
+	for(struct ring *g=rings; g; g=g->next){
+		uint64_t w=__atomic_load_n(&g->w, __ATOMIC_ACQUIRE);
+		for(uint64_t i = w>TRACE_RING_SPANS? w-TRACE_RING_SPANS : 0; i<w; i++){
+			struct span s=g->s[i%TRACE_RING_SPANS];
+			if(s.id!=id) continue;
+			/* its owner may have lapped the slot while we copied it */
+			if(__atomic_load_n(&g->w, __ATOMIC_ACQUIRE)-i >= TRACE_RING_SPANS) continue;
+			sb_printf(&b, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,"
+			              "\"args\":{\"req\":\"%llx\"}},\n", s.name, (unsigned long long)s.ts,
+			          (unsigned long long)s.dur, pid, g->tid, (unsigned long long)id);
+		}
+	}
+	pthread_mutex_unlock(&mtx);
+	/* one write, so requests from other processes never interleave */
+	ssize_t k=0;
+	while(b.len && (k=write(fd, b.s, b.len))<0 && errno==EINTR) ;
+	if(b.len && k!=(ssize_t)b.len) warnx("trace: write failed");
+	sb_free(&b);
+}
@@ -0,0 +1,29 @@
+/*==============================================================================
+ * src/trace.h  —  per-request span timelines in Chrome trace format
+ * License: BSD3
+ *============================================================================*/
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdint.h>
+
+/* Append traced requests to path as Chrome/Perfetto JSON trace events.
+   sample N traces 1 of N requests; 0 traces only on demand: SIGUSR1
+   traces every request for the next TRACE_ONDEMAND_SEC. Call once per
+   process, before its threads start. 0, or -1 if path cannot be opened. */
+int  trace_open(const char *path, unsigned sample);
+
+/* id for a new request: nonzero if it is to be traced. Pass it on in
+   llm_req.trace_id so spans taken in other threads join its timeline. */
+uint64_t trace_next(void);
+
+/* t0 for trace_span(): now_us() when id is traced, else 0 (no clock read) */
+uint64_t trace_t0(uint64_t id);
+
+/* record [t0, now) as span name (a static string) of request id into this
+   thread's ring; nothing when id is 0 */
+void trace_span(uint64_t id, const char *name, uint64_t t0);
+
+/* write the spans of id still held by this process's rings to the file */
+void trace_flush(uint64_t id);
+
+#endif
@@ -0,0 +1,262 @@
+//=============================================================================
+// src/trt_prompt.cpp  —  chat template and prompt tokens for the TRT-LLM backend
+//
+// No Jinja here: the chat_template in tokenizer_config.json only picks one
+// of the layouts models actually ship (ChatML, Llama 3, Llama 2 / Mistral
+// [INST], Gemma), which are built in. Each turn renders to one segment of
+// text and special-token pieces; specials map straight to their ids from
+// added_tokens_decoder, text goes through the tokenizer. Segments start
+// and end at special tokens (or at a turn's "\n"), where the tokenizer would
+// split anyway, so they encode independently and are cached by content:
+// a follow-up re-encodes only its new turns, and a system prompt shared by
+// many conversations is encoded once for all of them.
+// CPU only; builds and runs without TensorRT or a GPU.
+// License: BSD3
+//=============================================================================
+#include "trt_prompt.h"
+extern "C" {
+#include "util.h"
+#include "json.h"
+}
+#include "../config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+enum Family { CHATML, LLAMA3, LLAMA2, MISTRAL, GEMMA };
+const char *const family_name[] = { "chatml", "llama3", "llama2", "mistral", "gemma" };
+
+struct Piece { bool special; std::string s; };
+typedef std::vector<Piece> Segment;
+
+struct Entry {
+	std::vector<int32_t> ids;
+	std::list<const std::string*>::iterator lru;
+};
+
+}
+
+struct trt_prompt {
+	Family fam = CHATML;
+	std::string bos, eos;                               // "" when unused
+	std::unordered_map<std::string, int32_t> special;   // content -> id
+	trt_encode_fn enc = nullptr; void *arg = nullptr;
+
+	std::mutex mtx;                                     // guards the rest
+	std::unordered_map<std::string, Entry> cache;       // segment key -> ids
+	std::list<const std::string*> lru;                  // keys, most recent first
+	size_t ntok = 0;                                    // ids held
+};
+
+extern "C" void trt_ids_push(struct trt_ids *t, int32_t id){
+	if(t->n==t->cap){ t->cap = t->cap? t->cap*2 : 256; t->v=(int32_t*)xrealloc(t->v, t->cap*sizeof *t->v); }
+	t->v[t->n++]=id;
+}
+extern "C" void trt_ids_free(struct trt_ids *t){ free(t->v); t->v=NULL; t->n=t->cap=0; }
+
+static void ids_append(struct trt_ids *t, const std::vector<int32_t> &v){
+	if(t->n+v.size() > t->cap){
+		while(t->n+v.size() > t->cap) t->cap = t->cap? t->cap*2 : 256;
+		t->v=(int32_t*)xrealloc(t->v, t->cap*sizeof *t->v);
+	}
+	if(!v.empty()) memcpy(t->v+t->n, v.data(), v.size()*sizeof *t->v);
+	t->n+=v.size();
+}
+
+/* ---------------------------- tokenizer_config ---------------------------- */
+static const char *ws(const char *p){ while(*p==' '||*p=='\t'||*p=='\r'||*p=='\n') p++; return p; }
+
+/* a JSON string, or the "content" of an AddedToken object */
+static std::string jtoken(const char *v){
+	if(v && *v=='{') v=json_member(v, "content");
+	char *s = v && *v=='"'? json_string(v) : NULL;
+	std::string r = s? s : "";
+	free(s);
+	return r;
+}
+
+/* added_tokens_decoder: { "128000": { "content": "<|begin_of_text|>", ... }, ... } */
+static void load_special(trt_prompt *p, const char *obj){
+	if(!obj || *(obj=ws(obj))!='{') return;
+	for(const char *q=ws(obj+1); *q=='"'; ){
+		char *id=json_string(q);
+		const char *v=json_skip(q);
+		if(!id || !v || *(v=ws(v))!=':'){ free(id); return; }
+		v=ws(v+1);
+		std::string c=jtoken(v);
+		if(!c.empty()) p->special[c]=(int32_t)atol(id);
+		free(id);
+		if(!(q=json_skip(v))) return;
+		if(*(q=ws(q))==',') q=ws(q+1);
+	}
+}
+
+static Family detect(const std::string &t){
+	if(t.find("<|start_header_id|>")!=std::string::npos) return LLAMA3;
+	if(t.find("<start_of_turn>")!=std::string::npos) return GEMMA;
+	if(t.find("[INST]")!=std::string::npos) return t.find("<<SYS>>")!=std::string::npos? LLAMA2 : MISTRAL;
+	return CHATML;
+}
+
+extern "C" struct trt_prompt *trt_prompt_new(const char *model_dir, trt_encode_fn enc, void *arg){
+	trt_prompt *p = new trt_prompt;
+	p->enc=enc; p->arg=arg;
+	char *cfg=NULL;
+	if(model_dir){
+		std::string d(model_dir);
+		if(!(cfg=read_file((d+"/tokenizer_config.json").c_str(), NULL)))
+			cfg=read_file((d+"/../tokenizer_config.json").c_str(), NULL);
+	}
+	if(cfg){
+		const char *t=json_member(cfg, "chat_template");
+		char *tmpl = t && *t=='"'? json_string(t) : NULL;
+		if(tmpl) p->fam=detect(tmpl);
+		free(tmpl);
+		p->bos=jtoken(json_member(cfg, "bos_token"));
+		p->eos=jtoken(json_member(cfg, "eos_token"));
+		load_special(p, json_member(cfg, "added_tokens_decoder"));
+		free(cfg);
+	}
+	static const char *const dbos[] = { "", "<|begin_of_text|>", "<s>", "<s>", "<bos>" };
+	if(p->bos.empty()) p->bos=dbos[p->fam];
+	if(p->eos.empty() && (p->fam==LLAMA2 || p->fam==MISTRAL)) p->eos="</s>";
+	return p;
+}
+
+extern "C" void trt_prompt_free(struct trt_prompt *p){ delete p; }
+extern "C" const char *trt_prompt_family(const struct trt_prompt *p){ return family_name[p->fam]; }
+
+/* -------------------------------- template -------------------------------- */
+static void put(Segment &s, bool special, const std::string &x){ if(!x.empty()) s.push_back({special, x}); }
+
+static std::string trim(const std::string &s){
+	size_t a=s.find_first_not_of(" \t\r\n"), b=s.find_last_not_of(" \t\r\n");
+	return a==std::string::npos? "" : s.substr(a, b-a+1);
+}
+
+/* One segment per turn, then the generation prompt. Gemma and [INST]
+   have no system role: the system text joins the next user turn. */
+static std::vector<Segment> segments(const trt_prompt *p, const struct llm_msg *m, int n){
+	std::vector<Segment> out;
+	std::string sys;
+	bool first=true;
+	for(int i=0;i<n || !sys.empty();i++){
+		std::string role = i<n && m[i].role? m[i].role : "user";
+		std::string c = i<n && m[i].content? m[i].content : "";
+		if(p->fam!=CHATML && p->fam!=LLAMA3){
+			if(role=="system" && i<n){ sys = sys.empty()? c : sys+"\n\n"+c; continue; }
+			if(role=="user" && !sys.empty()){
+				c = p->fam==LLAMA2? "<<SYS>>\n"+sys+"\n<</SYS>>\n\n"+trim(c) : sys+"\n\n"+c;
+				sys.clear();
+			}
+		}
+		Segment s;
+		if(first && p->fam!=CHATML && p->fam!=LLAMA2) put(s, true, p->bos);
+		first=false;
+		switch(p->fam){
+		case CHATML:
+			put(s, true, "<|im_start|>"); put(s, false, role+"\n"+c); put(s, true, "<|im_end|>"); put(s, false, "\n");
+			break;
+		case LLAMA3:
+			put(s, true, "<|start_header_id|>"); put(s, false, role); put(s, true, "<|end_header_id|>");
+			put(s, false, "\n\n"+trim(c)); put(s, true, "<|eot_id|>");
+			break;
+		case GEMMA:
+			put(s, true, "<start_of_turn>"); put(s, false, (role=="assistant"? "model" : role)+"\n"+trim(c));
+			put(s, true, "<end_of_turn>"); put(s, false, "\n");
+			break;
+		case LLAMA2: case MISTRAL:
+			if(role=="assistant"){ put(s, false, p->fam==LLAMA2? " "+trim(c)+" " : trim(c)); put(s, true, p->eos); }
+			else {
+				if(p->fam==LLAMA2) put(s, true, p->bos);   /* every [INST] opens with it */
+				put(s, false, "[INST] "+(p->fam==LLAMA2? c : trim(c))+" [/INST]");
+			}
+			break;
+		}
+		out.push_back(std::move(s));
+		if(i>=n) break;
+	}
+	Segment g;
+	switch(p->fam){
+	case CHATML: put(g, true, "<|im_start|>"); put(g, false, "assistant\n"); break;
+	case LLAMA3: put(g, true, "<|start_header_id|>"); put(g, false, "assistant"); put(g, true, "<|end_header_id|>"); put(g, false, "\n\n"); break;
+	case GEMMA:  put(g, true, "<start_of_turn>"); put(g, false, "model\n"); break;
+	default: break;   /* [/INST] already asks for the answer */
+	}
+	if(!g.empty()) out.push_back(std::move(g));
+	return out;
+}
+
+extern "C" char *trt_prompt_render(const struct trt_prompt *p, const struct llm_msg *msgs, int n){
+	struct sbuf b; sb_init(&b);
+	for(const Segment &s: segments(p, msgs, n))
+		for(const Piece &x: s) sb_putn(&b, x.s.data(), x.s.size());
+	return sb_steal(&b);
+}
+
+/* ------------------------------- token ids -------------------------------- */
+/* the cache key: the pieces, each tagged special or text and length-prefixed */
+static std::string seg_key(const Segment &s){
+	std::string k;
+	for(const Piece &x: s){
+		size_t n=x.s.size();
+		k+=x.special? 'S' : 'T';
+		k.append((const char*)&n, sizeof n);
+		k+=x.s;
+	}
+	return k;
+}
+
+static int encode(const trt_prompt *p, const Segment &s, struct trt_ids *t){
+	for(const Piece &x: s){
+		auto it = x.special? p->special.find(x.s) : p->special.end();
+		if(it!=p->special.end()) trt_ids_push(t, it->second);
+		else if(p->enc(p->arg, x.s.data(), x.s.size(), t)<0) return -1;
+	}
+	return 0;
+}
+
+extern "C" int trt_prompt_ids(struct trt_prompt *p, const struct llm_msg *msgs, int n,
+                              struct trt_ids *out, size_t *reused){
+	size_t hit=0;
+	for(const Segment &s: segments(p, msgs, n)){
+		std::string k=seg_key(s);
+		{
+			std::lock_guard<std::mutex> g(p->mtx);
+			auto it=p->cache.find(k);
+			if(it!=p->cache.end()){
+				p->lru.splice(p->lru.begin(), p->lru, it->second.lru);
+				ids_append(out, it->second.ids);
+				hit+=it->second.ids.size();
+				continue;
+			}
+		}
+		/* encode outside the lock; a racing twin just loses the insert */
+		struct trt_ids t={NULL, 0, 0};
+		if(encode(p, s, &t)<0){ trt_ids_free(&t); return -1; }
+		std::vector<int32_t> ids(t.v, t.v+t.n);
+		trt_ids_free(&t);
+		ids_append(out, ids);
+		if(ids.size() > TRT_PREFIX_CACHE_TOKENS) continue;
+		std::lock_guard<std::mutex> g(p->mtx);
+		auto ins=p->cache.emplace(std::move(k), Entry{std::move(ids), {}});
+		if(!ins.second) continue;
+		p->lru.push_front(&ins.first->first);
+		ins.first->second.lru=p->lru.begin();
+		p->ntok+=ins.first->second.ids.size();
+		while(p->ntok > TRT_PREFIX_CACHE_TOKENS){
+			auto old=p->cache.find(*p->lru.back());
+			p->ntok-=old->second.ids.size();
+			p->lru.pop_back();
+			p->cache.erase(old);
+		}
+	}
+	if(reused) *reused=hit;
+	return 0;
+}
@@ -0,0 +1,43 @@
+/*==============================================================================
+ * src/trt_prompt.h  —  chat template and prompt tokens for the TRT-LLM backend
+ * License: BSD3
+ *============================================================================*/
+#ifndef TRT_PROMPT_H
+#define TRT_PROMPT_H
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/llm_backend.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct trt_ids { int32_t *v; size_t n, cap; };
+void trt_ids_push(struct trt_ids *t, int32_t id);
+void trt_ids_free(struct trt_ids *t);
+
+/* Tokenizer: append the ids of text[0..n) to out; 0, or -1 on failure. */
+typedef int (*trt_encode_fn)(void *arg, const char *text, size_t n, struct trt_ids *out);
+
+struct trt_prompt;
+
+/* Template family and special-token ids from tokenizer_config.json in
+   model_dir or its parent (ChatML when absent or model_dir is NULL). */
+struct trt_prompt *trt_prompt_new(const char *model_dir, trt_encode_fn enc, void *arg);
+void trt_prompt_free(struct trt_prompt *p);
+const char *trt_prompt_family(const struct trt_prompt *p);
+
+/* msgs rendered through the template, generation prompt included
+   (malloc'd); what trt_prompt_ids() tokenizes, for logs and tests. */
+char *trt_prompt_render(const struct trt_prompt *p, const struct llm_msg *msgs, int n);
+
+/* Token ids of the rendered prompt, appended to out. Every turn is
+   tokenized once and kept (up to TRT_PREFIX_CACHE_TOKENS), so a follow-up
+   only encodes what is new; *reused, if set, gets the ids taken from
+   the cache. 0, or -1 when the tokenizer fails. Thread-safe. */
+int trt_prompt_ids(struct trt_prompt *p, const struct llm_msg *msgs, int n,
+                   struct trt_ids *out, size_t *reused);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
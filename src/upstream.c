@@ -0,0 +1,532 @@
+/*==============================================================================
+ * src/upstream.c  —  load balancing across replicas of one upstream
+ *
+ * Each request picks the replica with the fewest requests in flight or the
+ * lowest peak-EWMA latency times (in flight + 1). Replicas that fail
+ * UP_EJECT_FAILS times in a row are ejected for UP_EJECT_MS, doubling on
+ * repeat ejections; a background prober marks replicas whose port (or unix
+ * socket) stops accepting connections as down. A failed attempt fails over to the
+ * next best replica that this request has not tried yet.
+ *
+ * With hedging on, a request that has seen no reply byte once its replica's
+ * p95 time to first byte has passed is duplicated to the next best replica;
+ * the first good answer wins and the other call is cancelled. At most
+ * UP_HEDGE_PCT percent of requests are hedged so a slow fleet is not
+ * doubled in load.
+ *
+ * Retryable failures (transport errors, garbage, 429, 5xx) are retried up
+ * to UP_RETRIES times, on untried replicas first, then again from the top
+ * after a full-jitter exponential backoff. A 429's Retry-After keeps its
+ * replica out of rotation until it expires. Retries draw on a budget that
+ * grows by UP_RETRY_PCT of a token per request, so under overload they
+ * stay a fixed fraction of traffic instead of multiplying it.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "upstream.h"
+#include "util.h"
+#include "../config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#define UP_MAX 64
+
+struct upstream {
+	const char *base;
+	char host[256], port[16];
+	int inflight;             /* atomic */
+	double ewma_us;           /* peak-EWMA latency; 0 = not measured yet */
+	uint64_t ewma_ms;         /* time of last update */
+	int fails;                /* consecutive failures */
+	int ejections;            /* consecutive ejections */
+	uint64_t ejected_until;   /* now_ms() */
+	uint64_t hold_until;      /* now_ms(); from Retry-After */
+	int down;                 /* last active probe failed */
+	uint32_t ttfb[UP_TTFB_SAMPLES];   /* recent times to first byte, us */
+	unsigned nttfb;
+};
+
+struct upstream_set {
+	struct upstream u[UP_MAX];
+	int n, policy, hedge;
+	unsigned long nreq, nhedge;
+	double retry_tokens;
+	uint32_t rng;
+	unsigned rr;              /* rotates the tie-break start */
+	pthread_mutex_t mtx;
+	pthread_t prober;
+	int probing, stop;
+	int racing;               /* hedge races not yet freed */
+	unsigned probe_ms;
+	uint64_t keyless;         /* replicas that need no key (url_is_local) */
+};
+
+struct upstream_set *upstream_set_new(const char *const *bases, int n, int policy, int hedge){
+	if(n<1) return NULL;
+	if(n>UP_MAX){ warnx("upstream: using the first %d of %d replicas", UP_MAX, n); n=UP_MAX; }
+	struct upstream_set *s = xmalloc(sizeof *s);
+	memset(s, 0, sizeof *s);
+	s->n=n; s->policy=policy; s->hedge=hedge;
+	s->retry_tokens=UP_RETRY_BURST;
+	s->rng=(uint32_t)now_us()|1;
+	pthread_mutex_init(&s->mtx, NULL);
+	for(int i=0;i<n;i++){
+		s->u[i].base=bases[i];
+		if(url_is_local(bases[i])) s->keyless |= 1ULL<<i;
+		url_host_port(bases[i], s->u[i].host, sizeof s->u[i].host, s->u[i].port, sizeof s->u[i].port);
+	}
+	return s;
+}
+
+void upstream_set_free(struct upstream_set *s){
+	if(!s) return;
+	if(s->probing){
+		__atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+		pthread_join(s->prober, NULL);
+	}
+	/* cancelled hedge losers still point at s */
+	while(__atomic_load_n(&s->racing, __ATOMIC_ACQUIRE)){
+		struct timespec ts={ 0, 10*1000000L };
+		nanosleep(&ts, NULL);
+	}
+	pthread_mutex_destroy(&s->mtx);
+	free(s);
+}
+
+/* ------------------------------ selection -------------------------------- */
+static int pick(struct upstream_set *s, uint64_t tried){
+	uint64_t now=now_ms();
+	int best=-1; double bcost=0;
+	pthread_mutex_lock(&s->mtx);
+	unsigned off = s->rr++;
+	for(int k=0;k<s->n;k++){
+		int i=(int)((off+(unsigned)k)%(unsigned)s->n);
+		struct upstream *u=&s->u[i];
+		if((tried>>i)&1 || u->down || u->ejected_until>now || u->hold_until>now) continue;
+		double inflight = __atomic_load_n(&u->inflight, __ATOMIC_RELAXED);
+		double cost = s->policy==UP_EWMA ? u->ewma_us*(inflight+1) : inflight;
+		if(best<0 || cost<bcost){ best=i; bcost=cost; }
+	}
+	if(best<0){
+		/* everything healthy was tried, ejected or held off: take the
+		   replica that becomes available first rather than failing outright */
+		uint64_t bt=0;
+		for(int i=0;i<s->n;i++){
+			if((tried>>i)&1) continue;
+			uint64_t t = s->u[i].ejected_until > s->u[i].hold_until? s->u[i].ejected_until : s->u[i].hold_until;
+			if(best<0 || t<bt){ best=i; bt=t; }
+		}
+	}
+	pthread_mutex_unlock(&s->mtx);
+	return best;
+}
+
+static void record(struct upstream_set *s, struct upstream *u, uint64_t rtt_us,
+                   uint64_t ttfb_us, int failed){
+	uint64_t now=now_ms();
+	pthread_mutex_lock(&s->mtx);
+	if(failed){
+		/* make a failing replica look slow before it is ejected */
+		u->ewma_us = u->ewma_us*2 > 1e6 ? u->ewma_us*2 : 1e6;
+		if(++u->fails >= UP_EJECT_FAILS){
+			int k = u->ejections<6? u->ejections : 6;
+			u->ejected_until = now + ((uint64_t)UP_EJECT_MS<<k);
+			u->ejections++; u->fails=0;
+			warnx("upstream: ejecting %s for %llu ms", u->base, (unsigned long long)UP_EJECT_MS<<k);
+		}
+	}else{
+		u->fails=0; u->ejections=0;
+		double rtt=(double)rtt_us;
+		if(rtt > u->ewma_us) u->ewma_us = rtt;   /* peak: jump up at once */
+		else{
+			double dt=(double)(now - u->ewma_ms);
+			double w = UP_EWMA_TAU_MS/(UP_EWMA_TAU_MS+dt);
+			u->ewma_us = u->ewma_us*w + rtt*(1-w);
+		}
+		u->ewma_ms=now;
+		if(ttfb_us) u->ttfb[u->nttfb++ % UP_TTFB_SAMPLES] = (uint32_t)(ttfb_us<UINT32_MAX? ttfb_us : UINT32_MAX);
+	}
+	pthread_mutex_unlock(&s->mtx);
+}
+
+/* a reply this replica is to blame for */
+static int replica_fault(int rc, const struct llm_resp *out){
+	return rc!=0 && (out->status==LLM_ETRANSPORT || out->status==LLM_EPROTO ||
+	                 out->status==LLM_ETIMEOUT || out->status==LLM_EUPSTREAM);
+}
+
+/* a failure that another attempt may not repeat */
+static int retryable(int rc, const struct llm_resp *out){
+	return rc!=0 && (out->status==LLM_ETRANSPORT || out->status==LLM_EPROTO ||
+	                 out->status==LLM_ETHROTTLED || out->status==LLM_EUPSTREAM);
+}
+
+/* one call against replica u; *fb receives the first-byte time */
+static int attempt_run(struct upstream_set *s, struct upstream *u, llm_fn fn,
+                       struct llm_req *req, struct llm_resp *out, unsigned long long *fb)
+{
+	req->api_base=u->base;
+	req->first_byte_us=fb;
+	__atomic_add_fetch(&u->inflight, 1, __ATOMIC_RELAXED);
+	uint64_t t0=now_us();
+	int rc=fn(req, out);
+	__atomic_sub_fetch(&u->inflight, 1, __ATOMIC_RELAXED);
+	uint64_t rtt=now_us()-t0;
+	if(req->cancel && __atomic_load_n(req->cancel, __ATOMIC_ACQUIRE)){
+		/* lost a hedge: not a failure, but at least this slow */
+		pthread_mutex_lock(&s->mtx);
+		if((double)rtt > u->ewma_us){ u->ewma_us=(double)rtt; u->ewma_ms=now_ms(); }
+		pthread_mutex_unlock(&s->mtx);
+		return rc;
+	}
+	if(rc!=0 && out->status==LLM_ETHROTTLED){
+		/* alive but saturated: no ejection, just honour Retry-After */
+		if(out->retry_after_ms){
+			pthread_mutex_lock(&s->mtx);
+			u->hold_until = now_ms() + (uint64_t)out->retry_after_ms;
+			pthread_mutex_unlock(&s->mtx);
+		}
+		return rc;
+	}
+	unsigned long long f=__atomic_load_n(fb, __ATOMIC_ACQUIRE);
+	record(s, u, rtt, f>t0? f-t0 : 0, replica_fault(rc, out));
+	return rc;
+}
+
+/* ------------------------------- hedging ---------------------------------
+ * A race is shared by the caller and its attempt threads and freed by the
+ * last one out, so the caller returns as soon as it has a winner and the
+ * cancelled loser winds down on its own. */
+struct attempt {
+	struct llm_req req; struct llm_resp resp;
+	struct upstream *u;
+	unsigned long long fb;
+	int rc, cancel, done;
+	struct race *race;
+};
+
+struct race {
+	struct upstream_set *s; llm_fn fn;
+	pthread_mutex_t mtx; pthread_cond_t cv;
+	struct attempt a[2];
+	int na, refs;
+	/* the request, copied: a loser may still be building its body after
+	   the caller has returned and freed its own */
+	struct llm_req req;
+	struct llm_msg *msgs;
+	char *strs;
+};
+
+static char *put_str(char **p, const char *v){
+	if(!v) return NULL;
+	size_t n=strlen(v)+1;
+	char *d=memcpy(*p, v, n);
+	*p+=n;
+	return d;
+}
+
+static void race_copy_req(struct race *x, const struct llm_req *r){
+	size_t n=0;
+	const char *one[]={ r->model, r->api_key, r->trt_engine_path };
+	for(int k=0;k<3;k++) if(one[k]) n+=strlen(one[k])+1;
+	for(int k=0;k<r->nmsgs;k++){
+		if(r->msgs[k].role) n+=strlen(r->msgs[k].role)+1;
+		if(r->msgs[k].content) n+=strlen(r->msgs[k].content)+1;
+	}
+	char *p=x->strs=xmalloc(n? n : 1);
+	x->msgs=xmalloc((size_t)(r->nmsgs? r->nmsgs : 1)*sizeof *x->msgs);
+	for(int k=0;k<r->nmsgs;k++){
+		x->msgs[k].role=put_str(&p, r->msgs[k].role);
+		x->msgs[k].content=put_str(&p, r->msgs[k].content);
+	}
+	x->req=*r;
+	x->req.msgs=x->msgs;
+	x->req.model=put_str(&p, r->model);
+	x->req.api_key=put_str(&p, r->api_key);
+	x->req.trt_engine_path=put_str(&p, r->trt_engine_path);
+}
+
+static void race_unref(struct race *x){
+	pthread_mutex_lock(&x->mtx);
+	int last = --x->refs==0;
+	pthread_mutex_unlock(&x->mtx);
+	if(!last) return;
+	for(int k=0;k<x->na;k++){ free(x->a[k].resp.content); free(x->a[k].resp.err); }
+	free(x->msgs); free(x->strs);
+	__atomic_sub_fetch(&x->s->racing, 1, __ATOMIC_RELEASE);
+	pthread_cond_destroy(&x->cv);
+	pthread_mutex_destroy(&x->mtx);
+	free(x);
+}
+
+static void *attempt_main(void *arg){
+	struct attempt *a=arg;
+	struct race *x=a->race;
+	a->rc=attempt_run(x->s, a->u, x->fn, &a->req, &a->resp, &a->fb);
+	pthread_mutex_lock(&x->mtx);
+	a->done=1;
+	pthread_cond_signal(&x->cv);
+	pthread_mutex_unlock(&x->mtx);
+	race_unref(x);
+	return NULL;
+}
+
+static int attempt_start(struct race *x, int i){
+	struct attempt *a=&x->a[x->na];
+	a->u=&x->s->u[i]; a->race=x;
+	a->req=x->req; a->req.cancel=&a->cancel;
+	pthread_t th;
+	pthread_mutex_lock(&x->mtx);
+	x->refs++;
+	pthread_mutex_unlock(&x->mtx);
+	if(pthread_create(&th, NULL, attempt_main, a)){
+		pthread_mutex_lock(&x->mtx);
+		x->refs--;
+		pthread_mutex_unlock(&x->mtx);
+		return -1;
+	}
+	pthread_detach(th);
+	x->na++;
+	return 0;
+}
+
+static int cmp_u32(const void *a, const void *b){
+	uint32_t x=*(const uint32_t*)a, y=*(const uint32_t*)b;
+	return x<y? -1 : x>y;
+}
+
+/* p95 time to first byte of u in us; 0 while there are too few samples */
+static uint64_t ttfb_p95(struct upstream_set *s, struct upstream *u){
+	uint32_t v[UP_TTFB_SAMPLES];
+	pthread_mutex_lock(&s->mtx);
+	unsigned n = u->nttfb<UP_TTFB_SAMPLES? u->nttfb : UP_TTFB_SAMPLES;
+	memcpy(v, u->ttfb, n*sizeof *v);
+	pthread_mutex_unlock(&s->mtx);
+	if(n<UP_HEDGE_MIN_SAMPLES) return 0;
+	qsort(v, n, sizeof *v, cmp_u32);
+	return v[(n*95)/100];
+}
+
+static int may_hedge(struct upstream_set *s){
+	pthread_mutex_lock(&s->mtx);
+	int ok = s->nhedge*100 < s->nreq*UP_HEDGE_PCT;
+	if(ok) s->nhedge++;
+	pthread_mutex_unlock(&s->mtx);
+	return ok;
+}
+
+/* Run on replica i; if it has sent nothing by its p95 TTFB, race a copy on
+   the next best replica. Returns the winner's rc with its reply in out. */
+static int hedged(struct upstream_set *s, llm_fn fn, const struct llm_req *r,
+                  int i, uint64_t *tried, struct llm_resp *out)
+{
+	unsigned long long fb=0;
+	struct llm_req req=*r;
+	uint64_t delay=ttfb_p95(s, &s->u[i]);
+	if(!delay || r->cancel) return attempt_run(s, &s->u[i], fn, &req, out, &fb);
+
+	struct race *x=xmalloc(sizeof *x);
+	memset(x, 0, sizeof *x);
+	x->s=s; x->fn=fn; x->refs=1;
+	pthread_mutex_init(&x->mtx, NULL);
+	pthread_condattr_t ca;
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&x->cv, &ca);
+	pthread_condattr_destroy(&ca);
+	race_copy_req(x, r);
+	__atomic_add_fetch(&s->racing, 1, __ATOMIC_ACQUIRE);
+	if(attempt_start(x, i)<0){
+		race_unref(x);
+		return attempt_run(s, &s->u[i], fn, &req, out, &fb);
+	}
+
+	uint64_t at=now_us()+delay;
+	if(r->deadline_us && at>r->deadline_us) at=r->deadline_us;
+	struct timespec ts={ (time_t)(at/1000000), (long)(at%1000000)*1000 };
+	pthread_mutex_lock(&x->mtx);
+	while(!x->a[0].done && pthread_cond_timedwait(&x->cv, &x->mtx, &ts)!=ETIMEDOUT) ;
+	int late = !x->a[0].done && !__atomic_load_n(&x->a[0].fb, __ATOMIC_ACQUIRE);
+	pthread_mutex_unlock(&x->mtx);
+
+	int j;
+	if(late && (!r->deadline_us || now_us()<r->deadline_us) &&
+	   (j=pick(s, *tried))>=0 && may_hedge(s)){
+		*tried |= 1ULL<<j;
+		attempt_start(x, j);
+	}
+
+	/* first final answer wins; a retryable failure waits for its sibling */
+	int win=-1;
+	pthread_mutex_lock(&x->mtx);
+	for(;;){
+		int ndone=0;
+		for(int k=0;k<x->na;k++)
+			if(x->a[k].done){ ndone++; if(win<0 && !retryable(x->a[k].rc, &x->a[k].resp)) win=k; }
+		if(win>=0 || ndone==x->na) break;
+		pthread_cond_wait(&x->cv, &x->mtx);
+	}
+	if(win<0) win=0;
+	int rc=x->a[win].rc;
+	*out=x->a[win].resp;
+	memset(&x->a[win].resp, 0, sizeof x->a[win].resp);
+	for(int k=0;k<x->na;k++) if(k!=win) __atomic_store_n(&x->a[k].cancel, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&x->mtx);
+	race_unref(x);
+	return rc;
+}
+
+/* ------------------------------- retrying -------------------------------- */
+/* A streamed delta cannot be taken back, so once one went out the attempt
+   that sent it is the answer: no hedging and no retry after it. */
+struct relay { int (*fn)(void *, const char *, size_t); void *arg; int sent; };
+
+static int relay_delta(void *arg, const char *text, size_t n){
+	struct relay *d=arg;
+	d->sent=1;
+	return d->fn(d->arg, text, n);
+}
+
+static int retry_budget(struct upstream_set *s){
+	pthread_mutex_lock(&s->mtx);
+	int ok = s->retry_tokens>=1;
+	if(ok) s->retry_tokens-=1;
+	pthread_mutex_unlock(&s->mtx);
+	return ok;
+}
+
+/* Wait before attempt k on replica i: full-jitter exponential backoff if i
+   already failed this request, and at least until its Retry-After ends.
+   Returns 0, without waiting, if that would overrun the deadline. */
+static int backoff(struct upstream_set *s, int i, int again, int k, const struct llm_req *r){
+	uint64_t wait=0, now=now_ms();
+	pthread_mutex_lock(&s->mtx);
+	if(again){
+		uint64_t cap=(uint64_t)UP_BACKOFF_MS << (k-1<16? k-1 : 16);
+		if(cap>UP_BACKOFF_MAX_MS) cap=UP_BACKOFF_MAX_MS;
+		s->rng^=s->rng<<13; s->rng^=s->rng>>17; s->rng^=s->rng<<5;
+		wait = s->rng % (cap+1);
+	}
+	if(s->u[i].hold_until > now+wait) wait=s->u[i].hold_until-now;
+	pthread_mutex_unlock(&s->mtx);
+	if(!wait) return 1;
+	if(r->deadline_us && now_us()+wait*1000 >= r->deadline_us) return 0;
+	struct timespec ts={ (time_t)(wait/1000), (long)(wait%1000)*1000000L };
+	while(nanosleep(&ts, &ts) && errno==EINTR) ;
+	return 1;
+}
+
+int upstream_complete(struct upstream_set *s, llm_fn fn,
+                      const struct llm_req *r, struct llm_resp *out)
+{
+	struct llm_req req = *r;
+	uint64_t all = s->n<64? (1ULL<<s->n)-1 : ~0ULL;
+	/* without a key a remote replica can only fail: never pick one, and
+	   with none left let the backend say what is missing */
+	uint64_t skip = r->api_key? 0 : all & ~s->keyless;
+	if(skip==all){ req.api_base=s->u[0].base; return fn(&req, out); }
+	pthread_mutex_lock(&s->mtx);
+	s->nreq++;
+	s->retry_tokens += UP_RETRY_PCT/100.0;
+	if(s->retry_tokens > UP_RETRY_BURST) s->retry_tokens = UP_RETRY_BURST;
+	pthread_mutex_unlock(&s->mtx);
+	struct relay d={ r->on_delta, r->delta_arg, 0 };
+	if(r->on_delta){ req.on_delta=relay_delta; req.delta_arg=&d; }
+	uint64_t tried=skip, used=0;
+	int rc=-1;
+	for(int k=0;; k++){
+		if(k){
+			if(d.sent || !retryable(rc, out) || k>UP_RETRIES || !retry_budget(s)) break;
+			if(r->deadline_us && now_us()>=r->deadline_us) break;
+			if(tried==all) tried=skip;   /* every replica had a go: go round again */
+		}
+		int i=pick(s, tried);
+		if(i<0) break;
+		if(k && !backoff(s, i, (int)((used>>i)&1), k, r)) break;
+		tried |= 1ULL<<i;
+		if(k){ free(out->content); free(out->err); memset(out, 0, sizeof *out); }
+		unsigned long long fb=0;
+		rc = s->hedge && s->n>1 && !r->on_delta ? hedged(s, fn, &req, i, &tried, out)
+		                        : attempt_run(s, &s->u[i], fn, &req, out, &fb);
+		used |= tried;
+	}
+	return rc;
+}
+
+/* ------------------------------- probing --------------------------------- */
+/* a unix:// replica: up while its socket accepts (a full backlog too) */
+static int probe_unix(const char *path){
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family=AF_UNIX;
+	if(strlen(path)>=sizeof sa.sun_path) return -1;
+	memcpy(sa.sun_path, path, strlen(path));
+	int fd=socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd<0) return -1;
+	set_cloexec(fd);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)|O_NONBLOCK);
+	int ok = connect(fd, (struct sockaddr*)&sa, sizeof sa)==0 || errno==EAGAIN? 0 : -1;
+	close(fd);
+	return ok;
+}
+
+static int probe(const struct upstream *u){
+	if(!*u->port) return probe_unix(u->host);
+	struct addrinfo hints, *res=0, *rp;
+	memset(&hints,0,sizeof hints);
+	hints.ai_family=AF_UNSPEC; hints.ai_socktype=SOCK_STREAM;
+	if(getaddrinfo(u->host, u->port, &hints, &res)) return -1;
+	int ok=-1;
+	for(rp=res; rp && ok<0; rp=rp->ai_next){
+		int fd=socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+		if(fd<0) continue;
+		set_cloexec(fd);
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)|O_NONBLOCK);
+		if(connect(fd, rp->ai_addr, rp->ai_addrlen)==0) ok=0;
+		else if(errno==EINPROGRESS){
+			struct pollfd pfd={ fd, POLLOUT, 0 };
+			int err=0; socklen_t el=sizeof err;
+			if(poll(&pfd, 1, UP_PROBE_TIMEOUT_MS)==1 &&
+			   getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &el)==0 && !err) ok=0;
+		}
+		close(fd);
+	}
+	freeaddrinfo(res);
+	return ok;
+}
+
+static void *prober_main(void *arg){
+	struct upstream_set *s=arg;
+	while(!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)){
+		for(int i=0;i<s->n;i++){
+			struct upstream *u=&s->u[i];
+			int down = probe(u)<0;
+			pthread_mutex_lock(&s->mtx);
+			if(down != u->down) warnx("upstream: %s is %s", u->base, down? "down":"up");
+			u->down=down;
+			pthread_mutex_unlock(&s->mtx);
+		}
+		/* sleep in short steps so upstream_set_free() does not wait long */
+		for(unsigned t=0; t<s->probe_ms && !__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE); t+=100){
+			struct timespec ts={ 0, 100*1000000L };
+			nanosleep(&ts, NULL);
+		}
+	}
+	return NULL;
+}
+
+void upstream_start_probes(struct upstream_set *s, unsigned interval_ms){
+	if(!s || !interval_ms || s->probing) return;
+	s->probe_ms=interval_ms;
+	if(pthread_create(&s->prober, NULL, prober_main, s)==0) s->probing=1;
+}
@@ -0,0 +1,28 @@
+/*==============================================================================
+ * src/upstream.h  —  replica set for one OpenAI-compatible model
+ * License: BSD3
+ *============================================================================*/
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+#include "../include/llm_backend.h"
+
+enum { UP_LEAST, UP_EWMA };   /* least outstanding / peak-EWMA latency */
+
+struct upstream_set;
+
+/* hedge: duplicate requests that are slower than the replica's p95 TTFB */
+struct upstream_set *upstream_set_new(const char *const *bases, int n, int policy, int hedge);
+void upstream_set_free(struct upstream_set *s);
+
+/* Background TCP probes every interval_ms; call only when outbound
+   connect() is permitted. */
+void upstream_start_probes(struct upstream_set *s, unsigned interval_ms);
+
+/* Run fn against the best replica, retrying retryable failures on other
+   replicas (with backoff) within the retry budget and r->deadline_us.
+   r->api_base and r->first_byte_us are ignored; r->cancel disables
+   hedging. */
+int upstream_complete(struct upstream_set *s, llm_fn fn,
+                      const struct llm_req *r, struct llm_resp *out);
+
+#endif
@@ -7,11 +7,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 #include <stdarg.h>
 #include <time.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 static void sb_grow(struct sbuf *b, size_t need){
@@ -34,8 +36,15 @@ void warnx(const char *fmt, ...) {
 	fputc('\n', stderr);
 }
 
-void *xmalloc(size_t n){ void *p=malloc(n?n:1); if(!p) die("oom"); return p; }
-void *xrealloc(void *p,size_t n){ void *q=realloc(p, n?n:1); if(!q) die("oom"); return q; }
+#ifdef UTIL_COUNT_ALLOCS
+unsigned long util_nallocs; /* read by tools/microbench */
+#define COUNT_ALLOC() (util_nallocs++)
+#else
+#define COUNT_ALLOC() ((void)0)
+#endif
+
+void *xmalloc(size_t n){ COUNT_ALLOC(); void *p=malloc(n?n:1); if(!p) die("oom"); return p; }
+void *xrealloc(void *p,size_t n){ COUNT_ALLOC(); void *q=realloc(p, n?n:1); if(!q) die("oom"); return q; }
 char *xstrdup(const char *s){ if(!s) return NULL; size_t n=strlen(s)+1; char *p=xmalloc(n); memcpy(p,s,n); return p; }
 
 char *html_escape(const char *s){
@@ -59,6 +68,10 @@ void str_trim(char *s){
 	if(i) memmove(s, s+i, n-i+1);
 }
 
+void str_wipe(char *s){
+	if(s) for(volatile char *p=s; *p; p++) *p=0;
+}
+
 static int hexv(int c){
 	if(c>='0'&&c<='9') return c-'0';
 	if(c>='a'&&c<='f') return c-'a'+10;
@@ -97,9 +110,39 @@ char *form_get(const char *body, const char *key){
 	return NULL;
 }
 
+static const unsigned char form_special[256] = {
+	[0]=1, ['&']=1, ['=']=1, ['+']=1, ['%']=1,
+};
+void form_parse(char *body, const char *const *keys, int nkeys, char **vals){
+	for(int i=0;i<nkeys;i++) vals[i]=NULL;
+	char *r=body;
+	while(r && *r){
+		/* decode one "key=value" pair; w never passes r */
+		char *key=r, *w=r, *val=NULL;
+		for(;;){
+			while(!form_special[(unsigned char)*r]) *w++=*r++;
+			if(!*r || *r=='&') break;
+			if(*r=='=' && !val){ *w++=0; val=w; }
+			else if(*r=='=') *w++='=';
+			else if(*r=='+') *w++=' ';
+			else{
+				int a=hexv(r[1]), b=a>=0? hexv(r[2]) : -1;
+				if(a>=0&&b>=0){ *w++=(char)((a<<4)|b); r+=2; }
+			}
+			r++;
+		}
+		if(*r) r++;
+		*w=0;
+		if(!val) continue;
+		for(int i=0;i<nkeys;i++)
+			if(!vals[i] && !strcmp(key, keys[i])){ vals[i]=val; break; }
+	}
+}
+
 void sb_init(struct sbuf *b){ b->s=NULL; b->len=0; b->cap=0; }
 void sb_free(struct sbuf *b){ free(b->s); b->s=NULL; b->len=b->cap=0; }
 void sb_puts(struct sbuf *b, const char *s){ size_t n=strlen(s); sb_grow(b,n); memcpy(b->s+b->len,s,n); b->len+=n; b->s[b->len]=0; }
+void sb_putn(struct sbuf *b, const char *s, size_t n){ sb_grow(b,n); memcpy(b->s+b->len,s,n); b->len+=n; b->s[b->len]=0; }
 void sb_putc(struct sbuf *b, char c){ sb_grow(b,1); b->s[b->len++]=c; b->s[b->len]=0; }
 void sb_printf(struct sbuf *b, const char *fmt, ...){
 	va_list ap; va_start(ap,fmt);
@@ -113,6 +156,8 @@ void sb_printf(struct sbuf *b, const char *fmt, ...){
 	}else sb_puts(b,tmp);
 }
 char *sb_steal(struct sbuf *b){ char *s=b->s; b->s=NULL; b->len=b->cap=0; return s; }
+char *sb_reserve(struct sbuf *b, size_t n){ sb_grow(b,n); return b->s+b->len; }
+void sb_commit(struct sbuf *b, size_t n){ b->len+=n; b->s[b->len]=0; }
 
 char *read_file(const char *path, size_t *outlen){
 	FILE *f=fopen(path,"rb");
@@ -135,6 +180,30 @@ uint64_t now_ms(void){
 	struct timeval tv; gettimeofday(&tv,NULL);
 	return (uint64_t)tv.tv_sec*1000ULL + tv.tv_usec/1000;
 }
+/* monotonic microseconds, for durations only */
+uint64_t now_us(void){
+	struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000ULL + (uint64_t)ts.tv_nsec/1000;
+}
+
+void set_cloexec(int fd){
+	if(fd>=0) fcntl(fd, F_SETFD, fcntl(fd, F_GETFD)|FD_CLOEXEC);
+}
+
+/* value of header `name` in a CRLF-separated block whose first line is a
+   request or status line, or NULL; stops at the blank line */
+const char *http_header(const char *headers, const char *name){
+	size_t nl=strlen(name);
+	for(const char *p=strstr(headers, "\r\n"); p; p=strstr(p, "\r\n")){
+		p+=2;
+		if(p[0]=='\r' && p[1]=='\n') break;
+		if(!strncasecmp(p, name, nl) && p[nl]==':'){
+			p+=nl+1; while(*p==' '||*p=='\t') p++;
+			return p;
+		}
+	}
+	return NULL;
+}
 
 /* split "host:port" (ipv6: "[::1]:8080") into host/port */
 int split_host_port(const char *hp, char *host, size_t hsz, char *port, size_t psz){
@@ -155,3 +224,62 @@ int split_host_port(const char *hp, char *host, size_t hsz, char *port, size_t p
 		return 0;
 	}
 }
+
+/* host:port from a URL like "https://host[:port][/...]"; the port defaults
+   to 80 for http:// and 443 otherwise */
+void url_host_port(const char *url, char *host, size_t hsz, char *port, size_t psz){
+	const char *defport = (url && !strncmp(url, "http://", 7))? "80" : "443";
+	if(psz){ port[0]=0; strncat(port, defport, psz-1); }
+	if(!url){ if(hsz) host[0]=0; return; }
+	/* unix:///run/llm.sock: the socket path, and no port */
+	if(!strncmp(url, "unix://", 7)){
+		if(hsz){ host[0]=0; strncat(host, url+7, hsz-1); }
+		if(psz) port[0]=0;
+		return;
+	}
+
+	const char *p = strstr(url, "://");
+	const char *h = p? p+3 : url;
+	/* host[:port] until '/', '?' or '#' */
+	const char *end = strpbrk(h, "/?#");
+	size_t n = end? (size_t)(end - h) : strlen(h);
+
+	/* Handle [ipv6]:port */
+	if(n>0 && h[0]=='['){
+		const char *rb = memchr(h, ']', n);
+		if(rb && rb+1 < h+n && rb[1]==':'){
+			size_t hn = (size_t)(rb - (h+1));
+			if(hsz){ size_t c = (hn<hsz-1)? hn : hsz-1; memcpy(host, h+1, c); host[c]=0; }
+			const char *ps = rb+2;
+			size_t pn = (size_t)((h+n)-ps);
+			if(psz){ size_t c = (pn<psz-1)? pn : psz-1; memcpy(port, ps, c); port[c]=0; }
+			return;
+		}
+		/* no port given: copy inside brackets */
+		size_t hn = rb? (size_t)(rb - (h+1)) : (n>2? n-2:0);
+		if(hsz){ size_t c = (hn<hsz-1)? hn : hsz-1; memcpy(host, h+1, c); host[c]=0; }
+		return;
+	}
+
+	/* Find ':' for port if present */
+	const char *col = memchr(h, ':', n);
+	if(col){
+		size_t hn = (size_t)(col - h);
+		if(hsz){ size_t c = (hn<hsz-1)? hn : hsz-1; memcpy(host, h, c); host[c]=0; }
+		const char *ps = col+1; size_t pn = (size_t)((h+n) - ps);
+		if(psz){ size_t c = (pn<psz-1)? pn : psz-1; memcpy(port, ps, c); port[c]=0; }
+	}else{
+		/* no port */
+		if(hsz){ size_t c = (n<hsz-1)? n : hsz-1; memcpy(host, h, c); host[c]=0; }
+		/* port already defaulted */
+	}
+}
+
+int url_is_local(const char *url){
+	if(!url) return 0;
+	if(!strncmp(url, "unix://", 7)) return 1;
+	if(strncmp(url, "http://", 7)) return 0;
+	char host[256];
+	url_host_port(url, host, sizeof host, NULL, 0);
+	return !strcmp(host, "localhost") || !strncmp(host, "127.", 4) || !strcmp(host, "::1");
+}
@@ -16,8 +16,13 @@ char *xstrdup(const char *);
 
 char *html_escape(const char *s);
 void str_trim(char *s);
+void str_wipe(char *s); /* zero a secret in place, not optimized out */
 void urldecode_inplace(char *s);
 char *form_get(const char *body, const char *key); /* malloc'd or NULL */
+/* one pass over an x-www-form-urlencoded body: decodes keys and values in
+   place and points vals[i] into body for keys[i] (first occurrence wins,
+   NULL if absent). No allocation. */
+void  form_parse(char *body, const char *const *keys, int nkeys, char **vals);
 
 struct sbuf {
 	char *s; size_t len, cap;
@@ -25,13 +30,25 @@ struct sbuf {
 void  sb_init(struct sbuf *b);
 void  sb_free(struct sbuf *b);
 void  sb_puts(struct sbuf *b, const char *s);
+void  sb_putn(struct sbuf *b, const char *s, size_t n);
 void  sb_putc(struct sbuf *b, char c);
 void  sb_printf(struct sbuf *b, const char *fmt, ...);
 char *sb_steal(struct sbuf *b); /* return s and reset */
+/* room for n more bytes (and the NUL) at the end; fill some, then
+   sb_commit() them: read(2) straight into the buffer */
+char *sb_reserve(struct sbuf *b, size_t n);
+void  sb_commit(struct sbuf *b, size_t n);
 
 char *read_file(const char *path, size_t *outlen);
 uint64_t now_ms(void);
+uint64_t now_us(void); /* monotonic */
+void  set_cloexec(int fd); /* keep fd out of backend children */
 
+const char *http_header(const char *headers, const char *name);
 int split_host_port(const char *hp, char *host, size_t hsz, char *port, size_t psz);
+void url_host_port(const char *url, char *host, size_t hsz, char *port, size_t psz);
+/* unix:// or plain http:// to loopback: a local server, which may go
+   without an API key */
+int  url_is_local(const char *url);
 
 #endif
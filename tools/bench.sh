@@ -0,0 +1,20 @@
+#!/bin/sh
+# tools/bench.sh — run llmserv on loopback against the mock upstream and
+# drive it with loadgen. Invoked by `make bench`; knobs come from the
+# environment (see Makefile BENCH_* variables).
+# License: BSD3
+set -e
+PORT=${BENCH_PORT:-18080}
+UPORT=${BENCH_UPSTREAM_PORT:-18081}
+
+tools/mockup -l 127.0.0.1:$UPORT ${BENCH_MOCK_ARGS} &
+MOCK=$!
+OPENAI_API_KEY=bench ./llmserv --bind 127.0.0.1:$PORT \
+	--api-base http://127.0.0.1:$UPORT &
+SRV=$!
+trap 'kill $SRV $MOCK 2>/dev/null' EXIT INT TERM
+sleep 1
+
+tools/loadgen -a 127.0.0.1:$PORT \
+	-c "${BENCH_CONC:-8}" -r "${BENCH_RATE:-50}" -d "${BENCH_DUR:-10}" \
+	-t "${BENCH_TURNS:-4}" -p "${BENCH_PROMPT:-256}"
@@ -0,0 +1,84 @@
+#!/bin/sh
+# tools/check.sh — regression checks: llmserv on loopback against stand-in
+# backends, each answer matched against what it must contain. Invoked by
+# `make check`; exits non-zero if any check fails.
+# License: BSD3
+PORT=${CHECK_PORT:-18090}
+CURL=$(command -v curl)   # the client; a stand-in curl serves below
+T=$(mktemp -d)
+unset OPENAI_API_KEY   # set per check
+SRV=
+trap 'kill $SRV 2>/dev/null; rm -rf "$T"' EXIT INT TERM
+fails=0
+
+# serve NAME ARGS...: (re)start llmserv with ARGS
+serve(){
+	name=$1; shift
+	kill $SRV 2>/dev/null; wait $SRV 2>/dev/null
+	./llmserv --bind 127.0.0.1:$PORT "$@" 2>"$T/$name.log" &
+	SRV=$!
+	sleep 0.3
+}
+
+# expect NAME PATTERN TEXT: TEXT must contain the fixed string PATTERN
+expect(){
+	if printf '%s' "$3" | grep -qF -- "$2"; then echo "ok   $1"
+	else echo "FAIL $1: no '$2' in: $3"; fails=$((fails+1)); fi
+}
+
+# a backend that cannot stream still answers a "stream":true request
+cat >"$T/hme" <<'EOF'
+#!/bin/sh
+cat >/dev/null
+printf '{"choices":[{"message":{"role":"assistant","content":"hello world"}}]}\n'
+EOF
+chmod +x "$T/hme"
+serve hme --no-network --hme-command "$T/hme" --
+out=$("$CURL" -sN -d '{"messages":[{"role":"user","content":"hi"}],"stream":true}' \
+	http://127.0.0.1:$PORT/v1/chat/completions)
+expect "non-streaming backend, stream:true" '"content":"hello world"' "$out"
+
+# the curl fallback (https:// without libtls) with an h2 upstream: curl
+# prints its head as "HTTP/2 200"; this stand-in curl answers that way
+mkdir "$T/bin"
+cat >"$T/bin/curl" <<'EOF'
+#!/bin/sh
+cat >/dev/null
+case "$*" in
+*text/event-stream*)
+	printf 'HTTP/2 200\r\ncontent-type: text/event-stream\r\n\r\n'
+	printf 'data: {"choices":[{"delta":{"content":"streamed"}}]}\n\n'
+	printf 'data: [DONE]\n\n' ;;
+*)
+	printf 'HTTP/2 200\r\ncontent-type: application/json\r\n\r\n'
+	printf '{"choices":[{"message":{"role":"assistant","content":"over h2"}}]}\n' ;;
+esac
+EOF
+chmod +x "$T/bin/curl"
+PATH="$T/bin:$PATH" OPENAI_API_KEY=check serve curl --http2 --api-base https://h2.invalid
+out=$("$CURL" -s -d '{"messages":[{"role":"user","content":"hi"}]}' \
+	http://127.0.0.1:$PORT/v1/chat/completions)
+expect "curl path, HTTP/2 head" '"content":"over h2"' "$out"
+out=$("$CURL" -sN -d '{"messages":[{"role":"user","content":"hi"}],"stream":true}' \
+	http://127.0.0.1:$PORT/v1/chat/completions)
+expect "curl path, HTTP/2 head, stream:true" '"content":"streamed"' "$out"
+
+# deltas cross the --privsep socketpair as they are, no terminator
+tools/mockup -l 127.0.0.1:$((PORT+1)) -n 3 &
+MOCK=$!
+trap 'kill $SRV $MOCK 2>/dev/null; rm -rf "$T"' EXIT INT TERM
+OPENAI_API_KEY=check serve privsep --privsep 1 --api-base http://127.0.0.1:$((PORT+1))
+out=$("$CURL" -sN -d '{"messages":[{"role":"user","content":"hi"}],"stream":true}' \
+	http://127.0.0.1:$PORT/v1/chat/completions)
+expect "privsep, stream:true" '"delta":{"content":"bcd "}' "$out"
+
+# no key: a mixed set skips the remote replica for the loopback one
+serve keyless --api-base https://remote.invalid --api-base http://127.0.0.1:$((PORT+1))
+out=
+for i in 1 2 3 4; do
+	out="$out$("$CURL" -s -d '{"messages":[{"role":"user","content":"hi"}]}' \
+		http://127.0.0.1:$PORT/v1/chat/completions | grep -c '"finish_reason"')"
+done
+expect "no key, mixed replica set" 1111 "$out"
+
+[ $fails -eq 0 ]
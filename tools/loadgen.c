@@ -0,0 +1,186 @@
+/*==============================================================================
+ * tools/loadgen.c  —  open-loop HTTP load generator for POST /chat
+ *
+ * Requests are scheduled at a constant rate independent of completions, and
+ * latency is measured from the scheduled send time, so a stalled server shows
+ * up in the tail instead of silently lowering the offered load.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "util.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+static struct {
+	char host[256], port[16];
+	int conc, turns, psize;
+	double rate;            /* req/s; 0 = closed loop */
+	double dur;             /* seconds */
+	const char *model;
+} opt = { "127.0.0.1", "8080", 8, 4, 256, 50.0, 10.0, NULL };
+
+static struct sbuf reqbuf;  /* full HTTP request, shared read-only */
+static uint64_t t_start, t_end;
+static uint64_t next_seq;
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t *lat;       /* latencies in us */
+static size_t nlat, caplat;
+static uint64_t nerr, nbytes;
+
+static void usage(void){
+	fprintf(stderr,
+"usage: loadgen [-a HOST:PORT] [-c CONC] [-r RATE] [-d SECS]\n"
+"               [-t TURNS] [-p PROMPT_BYTES] [-m MODEL]\n"
+"  -r 0 runs closed-loop (each worker sends as fast as it can)\n");
+	exit(2);
+}
+
+static void put_text(struct sbuf *b, int n, char seed){
+	/* form-safe filler: words separated by '+' (encoded space) */
+	for(int i=0;i<n;i++) sb_putc(b, (i%7==6)? '+' : (char)('a' + (seed+i)%26));
+}
+
+static void build_request(void){
+	struct sbuf body; sb_init(&body);
+	sb_puts(&body, "prompt=");
+	put_text(&body, opt.psize, 0);
+	if(opt.model){ sb_puts(&body, "&model="); sb_puts(&body, opt.model); }
+	sb_puts(&body, "&temp=0.5&history=");
+	for(int t=0;t<opt.turns;t++){
+		if(t) sb_puts(&body, "%0A%0A%3D%3D%3D%0A%0A");
+		sb_puts(&body, (t&1)? "A%3A+" : "U%3A+");
+		put_text(&body, opt.psize, (char)t);
+	}
+	sb_init(&reqbuf);
+	sb_printf(&reqbuf,
+"POST /chat HTTP/1.1\r\nHost: %s:%s\r\n"
+"Content-Type: application/x-www-form-urlencoded\r\n"
+"Content-Length: %zu\r\nConnection: close\r\n\r\n", opt.host, opt.port, body.len);
+	sb_puts(&reqbuf, body.s);
+	sb_free(&body);
+}
+
+static int dial(void){
+	struct addrinfo hints, *res=0, *rp;
+	memset(&hints,0,sizeof hints);
+	hints.ai_family=AF_UNSPEC; hints.ai_socktype=SOCK_STREAM;
+	if(getaddrinfo(opt.host, opt.port, &hints, &res)) return -1;
+	int fd=-1;
+	for(rp=res; rp; rp=rp->ai_next){
+		fd=socket(rp->ai_family,rp->ai_socktype,rp->ai_protocol);
+		if(fd<0) continue;
+		if(connect(fd, rp->ai_addr, rp->ai_addrlen)==0) break;
+		close(fd); fd=-1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+/* one request; returns response bytes or -1 */
+static long one_request(void){
+	int fd = dial();
+	if(fd<0) return -1;
+	size_t off=0;
+	while(off<reqbuf.len){
+		ssize_t w=write(fd, reqbuf.s+off, reqbuf.len-off);
+		if(w<0){ if(errno==EINTR) continue; close(fd); return -1; }
+		off+=(size_t)w;
+	}
+	char buf[16384]; long total=0; int ok=-1;
+	for(;;){
+		ssize_t r=read(fd, buf, sizeof buf);
+		if(r<0){ if(errno==EINTR) continue; break; }
+		if(r==0) break;
+		if(ok<0) ok = (r>=12 && !memcmp(buf, "HTTP/1.1 200", 12));
+		total+=r;
+	}
+	close(fd);
+	return ok>0 ? total : -1;
+}
+
+static void sleep_until(uint64_t t_us){
+	uint64_t now=now_us();
+	if(t_us<=now) return;
+	struct timespec ts = { (time_t)((t_us-now)/1000000), (long)((t_us-now)%1000000)*1000 };
+	while(nanosleep(&ts,&ts) && errno==EINTR) ;
+}
+
+static void *worker(void *arg){
+	(void)arg;
+	for(;;){
+		uint64_t sched;
+		if(opt.rate > 0){
+			uint64_t i = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+			sched = t_start + (uint64_t)((double)i * 1e6 / opt.rate);
+			if(sched >= t_end) break;
+			sleep_until(sched);
+		}else{
+			sched = now_us();
+			if(sched >= t_end) break;
+		}
+		long n = one_request();
+		uint32_t us = (uint32_t)(now_us() - sched);
+		pthread_mutex_lock(&mtx);
+		if(n<0) nerr++;
+		else{
+			nbytes += (uint64_t)n;
+			if(nlat==caplat){ caplat = caplat? caplat*2 : 4096; lat = xrealloc(lat, caplat*sizeof *lat); }
+			lat[nlat++] = us;
+		}
+		pthread_mutex_unlock(&mtx);
+	}
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b){
+	uint32_t x=*(const uint32_t*)a, y=*(const uint32_t*)b;
+	return (x>y)-(x<y);
+}
+static double pct(double p){
+	if(!nlat) return 0;
+	size_t i = (size_t)(p * (double)(nlat-1) + 0.5);
+	return lat[i] / 1000.0;
+}
+
+int main(int argc, char **argv){
+	for(int i=1;i<argc;i++){
+		if(i+1>=argc) usage();
+		if(!strcmp(argv[i],"-a")){
+			if(split_host_port(argv[++i], opt.host, sizeof opt.host, opt.port, sizeof opt.port)<0) usage();
+		}
+		else if(!strcmp(argv[i],"-c")) opt.conc=atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-r")) opt.rate=atof(argv[++i]);
+		else if(!strcmp(argv[i],"-d")) opt.dur=atof(argv[++i]);
+		else if(!strcmp(argv[i],"-t")) opt.turns=atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-p")) opt.psize=atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-m")) opt.model=argv[++i];
+		else usage();
+	}
+	if(opt.conc<1 || opt.dur<=0 || opt.turns<0 || opt.psize<1) usage();
+	build_request();
+
+	pthread_t *th = xmalloc(sizeof *th * (size_t)opt.conc);
+	t_start = now_us();
+	t_end = t_start + (uint64_t)(opt.dur*1e6);
+	for(int i=0;i<opt.conc;i++) pthread_create(&th[i], NULL, worker, NULL);
+	for(int i=0;i<opt.conc;i++) pthread_join(th[i], NULL);
+	double elapsed = (now_us() - t_start)/1e6;
+
+	qsort(lat, nlat, sizeof *lat, cmp_u32);
+	printf("target=%s:%s conc=%d rate=%.1f turns=%d prompt=%d req_bytes=%zu\n",
+	       opt.host, opt.port, opt.conc, opt.rate, opt.turns, opt.psize, reqbuf.len);
+	printf("ok=%zu err=%llu elapsed_s=%.2f rps=%.1f resp_bytes=%llu\n",
+	       nlat, (unsigned long long)nerr, elapsed, nlat/elapsed, (unsigned long long)nbytes);
+	printf("p50_ms=%.2f p99_ms=%.2f p999_ms=%.2f max_ms=%.2f\n",
+	       pct(0.50), pct(0.99), pct(0.999), nlat? lat[nlat-1]/1000.0 : 0.0);
+	free(th); free(lat); sb_free(&reqbuf);
+	return nerr ? 1 : 0;
+}
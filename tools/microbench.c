@@ -0,0 +1,233 @@
+/*==============================================================================
+ * tools/microbench.c  —  microbenchmarks for util.c, json.c and trt_prompt.cpp
+ *
+ * Each case runs one function over a generated corpus until at least -t ms
+ * have elapsed and prints one tab-separated line:
+ *   bench  corpus  bytes  iters  ns_per_op  ns_per_byte  allocs_per_op
+ * Lines starting with '#' are comments, so two runs diff or join cleanly.
+ * Built with -DUTIL_COUNT_ALLOCS so xmalloc/xrealloc calls are counted.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "util.h"
+#include "json.h"
+#include "trt_prompt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern unsigned long util_nallocs;
+
+/* ------------------------------- corpora --------------------------------- */
+static uint32_t rng = 2463534242u;
+static uint32_t rnd(void){ rng ^= rng<<13; rng ^= rng>>17; rng ^= rng<<5; return rng; }
+
+static const char *ascii_words[] = {
+	"the", "model", "returns", "a", "short", "answer", "with", "some", "context",
+	"about", "kernel", "policy", "and", "compartments.", "Then", "it", "stops.\n",
+};
+static const char *markup_words[] = {
+	"<p class=\"note\">", "</p>", "a & b", "if (x < y && y > z)", "'quoted'",
+	"<code>", "</code>", "\"", "plain", "text", "&amp;", "<br/>\n",
+};
+static const char *utf8_words[] = {
+	"привет", "мир", "日本語", "のテキスト", "🙂", "😀👍", "café", "naïve",
+	"Straße", "ελληνικά", "中文", "\n",
+};
+
+/* fill exactly n bytes from a word list, never splitting a UTF-8 sequence */
+static char *gen_corpus(const char **words, size_t nwords, size_t n){
+	char *s = xmalloc(n+1); size_t len=0;
+	for(;;){
+		const char *w = words[rnd()%nwords]; size_t wl=strlen(w);
+		if(len+wl+1 > n) break;
+		memcpy(s+len, w, wl); len+=wl;
+		if(w[wl-1] != '\n') s[len++]=' ';
+	}
+	while(len<n) s[len++]=' ';
+	s[n]=0;
+	return s;
+}
+
+static char *url_encode(const char *s){
+	static const char hex[]="0123456789ABCDEF";
+	struct sbuf b; sb_init(&b);
+	for(const unsigned char *p=(const unsigned char*)s; *p; ++p){
+		if((*p>='a'&&*p<='z')||(*p>='A'&&*p<='Z')||(*p>='0'&&*p<='9')||*p=='-'||*p=='.'||*p=='_') sb_putc(&b,(char)*p);
+		else if(*p==' ') sb_putc(&b,'+');
+		else { sb_putc(&b,'%'); sb_putc(&b,hex[*p>>4]); sb_putc(&b,hex[*p&15]); }
+	}
+	return sb_steal(&b);
+}
+
+/* --------------------------- per-case fixtures --------------------------- */
+#define NCHUNK 64
+#define NTURNS 8
+static struct {
+	const char *corpus; size_t n;
+	char *enc;  size_t enclen;     /* url-encoded corpus */
+	char *work;                    /* scratch for in-place decoders */
+	char *form;  size_t formlen;   /* form body with corpus as history */
+	char *resp;                    /* OpenAI reply with corpus as content */
+	char **chunks; size_t nchunks; /* NUL-terminated NCHUNK-byte pieces */
+	char *turns[NTURNS];
+	struct llm_msg msgs[NTURNS];
+	struct trt_prompt *tp;         /* cache already holds msgs */
+} fx;
+
+/* stand-in tokenizer: one id per space-separated word */
+static int toy_encode(void *arg, const char *s, size_t n, struct trt_ids *out){
+	(void)arg;
+	for(size_t i=0;i<n;){
+		uint32_t h=2166136261u;
+		while(i<n && s[i]==' ') i++;
+		if(i==n) break;
+		while(i<n && s[i]!=' '){ h=(h^(unsigned char)s[i++])*16777619u; }
+		trt_ids_push(out, (int32_t)(h%32000));
+	}
+	return 0;
+}
+
+static void fixtures_init(const char *corpus, size_t n){
+	fx.corpus=corpus; fx.n=n;
+	fx.enc=url_encode(corpus); fx.enclen=strlen(fx.enc);
+
+	struct sbuf b; sb_init(&b);
+	sb_puts(&b, "prompt=hello&model=m&temp=0.5&history="); sb_puts(&b, fx.enc);
+	fx.formlen=b.len; fx.form=sb_steal(&b);
+	fx.work=xmalloc(fx.formlen+1);
+
+	sb_init(&b);
+	sb_puts(&b, "{\"id\":\"x\",\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":");
+	json_escape_into(&b, corpus);
+	sb_puts(&b, "},\"finish_reason\":\"stop\"}]}");
+	fx.resp=sb_steal(&b);
+
+	fx.nchunks=(n+NCHUNK-1)/NCHUNK;
+	fx.chunks=xmalloc(fx.nchunks*sizeof *fx.chunks);
+	for(size_t i=0;i<fx.nchunks;i++){
+		size_t off=i*NCHUNK, l = n-off<NCHUNK? n-off : NCHUNK;
+		fx.chunks[i]=xmalloc(l+1); memcpy(fx.chunks[i], corpus+off, l); fx.chunks[i][l]=0;
+	}
+	size_t per=n/NTURNS;
+	for(int i=0;i<NTURNS;i++){
+		size_t off=(size_t)i*per, l = i==NTURNS-1? n-off : per;
+		fx.turns[i]=xmalloc(l+1); memcpy(fx.turns[i], corpus+off, l); fx.turns[i][l]=0;
+		fx.msgs[i]=(struct llm_msg){ (i&1)? "assistant":"user", fx.turns[i] };
+	}
+	fx.tp=trt_prompt_new(NULL, toy_encode, NULL);
+	struct trt_ids t={0};
+	trt_prompt_ids(fx.tp, fx.msgs, NTURNS, &t, NULL);
+	trt_ids_free(&t);
+}
+
+static void fixtures_free(void){
+	free(fx.enc); free(fx.work); free(fx.form); free(fx.resp);
+	for(size_t i=0;i<fx.nchunks;i++) free(fx.chunks[i]);
+	free(fx.chunks);
+	for(int i=0;i<NTURNS;i++) free(fx.turns[i]);
+	trt_prompt_free(fx.tp);
+}
+
+/* -------------------------------- cases ---------------------------------- */
+static void b_html_escape(void){ free(html_escape(fx.corpus)); }
+static void b_urldecode(void){ memcpy(fx.work, fx.enc, fx.enclen+1); urldecode_inplace(fx.work); }
+static void b_form_get(void){ free(form_get(fx.form, "history")); }
+static void b_form_parse(void){
+	static const char *const keys[] = { "prompt", "model", "temp", "history" };
+	char *v[4];
+	memcpy(fx.work, fx.form, fx.formlen+1);
+	form_parse(fx.work, keys, 4, v);
+}
+static void b_sb_putc(void){
+	struct sbuf b; sb_init(&b);
+	for(size_t i=0;i<fx.n;i++) sb_putc(&b, fx.corpus[i]);
+	sb_free(&b);
+}
+static void b_sb_puts(void){
+	struct sbuf b; sb_init(&b);
+	for(size_t i=0;i<fx.nchunks;i++) sb_puts(&b, fx.chunks[i]);
+	sb_free(&b);
+}
+static void b_sb_printf(void){
+	struct sbuf b; sb_init(&b);
+	for(size_t i=0;i<fx.nchunks;i++) sb_printf(&b, "%s", fx.chunks[i]);
+	sb_free(&b);
+}
+static void b_build_json(void){
+	struct llm_req r = { .msgs=fx.msgs, .nmsgs=NTURNS, .model="m", .temperature=0.5, .max_tokens=256 };
+	free(build_openai_json(&r));
+}
+static void b_extract(void){ free(extract_content(fx.resp)); }
+static void b_trt_cold(void){
+	struct trt_prompt *p=trt_prompt_new(NULL, toy_encode, NULL);
+	struct trt_ids t={0};
+	trt_prompt_ids(p, fx.msgs, NTURNS, &t, NULL);
+	trt_ids_free(&t);
+	trt_prompt_free(p);
+}
+static void b_trt_warm(void){
+	struct trt_ids t={0};
+	trt_prompt_ids(fx.tp, fx.msgs, NTURNS, &t, NULL);
+	trt_ids_free(&t);
+}
+
+static const struct { const char *name; void (*fn)(void); } cases[] = {
+	{ "html_escape",       b_html_escape },
+	{ "urldecode_inplace", b_urldecode },
+	{ "form_get",          b_form_get },
+	{ "form_parse",        b_form_parse },
+	{ "sb_putc",           b_sb_putc },
+	{ "sb_puts",           b_sb_puts },
+	{ "sb_printf",         b_sb_printf },
+	{ "build_openai_json", b_build_json },
+	{ "extract_content",   b_extract },
+	{ "trt_prompt_cold",   b_trt_cold },
+	{ "trt_prompt_warm",   b_trt_warm },
+};
+
+static void run_case(const char *name, void (*fn)(void), const char *cname, unsigned min_ms){
+	fn(); /* warm up */
+	uint64_t iters=0, t0=now_us(), el=0;
+	unsigned long a0=util_nallocs;
+	for(uint64_t batch=1;; batch*=2){
+		for(uint64_t i=0;i<batch;i++) fn();
+		iters+=batch; el=now_us()-t0;
+		if(el >= (uint64_t)min_ms*1000) break;
+	}
+	double ns_op = el*1000.0/(double)iters;
+	printf("%s\t%s\t%zu\t%llu\t%.1f\t%.3f\t%.2f\n", name, cname, fx.n,
+	       (unsigned long long)iters, ns_op, ns_op/(double)fx.n,
+	       (double)(util_nallocs-a0)/(double)iters);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv){
+	const char *filter=NULL; unsigned min_ms=200; size_t maxsz=4u<<20;
+	for(int i=1;i<argc;i++){
+		if(!strcmp(argv[i],"-f") && i+1<argc){ filter=argv[++i]; continue; }
+		if(!strcmp(argv[i],"-t") && i+1<argc){ min_ms=(unsigned)atoi(argv[++i]); continue; }
+		if(!strcmp(argv[i],"-m") && i+1<argc){ maxsz=(size_t)atol(argv[++i]); continue; }
+		fprintf(stderr, "usage: microbench [-f NAME] [-t MS_PER_CASE] [-m MAX_BYTES]\n");
+		return 2;
+	}
+	static const size_t sizes[] = { 1u<<10, 16u<<10, 256u<<10, 4u<<20 };
+	static const struct { const char *name; const char **w; size_t nw; } corp[] = {
+		{ "ascii",  ascii_words,  sizeof ascii_words/sizeof *ascii_words },
+		{ "markup", markup_words, sizeof markup_words/sizeof *markup_words },
+		{ "utf8",   utf8_words,   sizeof utf8_words/sizeof *utf8_words },
+	};
+	printf("# bench\tcorpus\tbytes\titers\tns_per_op\tns_per_byte\tallocs_per_op\n");
+	for(size_t c=0;c<sizeof corp/sizeof *corp;c++)
+	for(size_t z=0;z<sizeof sizes/sizeof *sizes;z++){
+		if(sizes[z] > maxsz) continue;
+		char *corpus=gen_corpus(corp[c].w, corp[c].nw, sizes[z]);
+		fixtures_init(corpus, sizes[z]);
+		for(size_t k=0;k<sizeof cases/sizeof *cases;k++)
+			if(!filter || strstr(cases[k].name, filter))
+				run_case(cases[k].name, cases[k].fn, corp[c].name, min_ms);
+		fixtures_free();
+		free(corpus);
+	}
+	return 0;
+}
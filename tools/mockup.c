@@ -0,0 +1,279 @@
+/*==============================================================================
+ * tools/mockup.c  —  mock OpenAI-compatible upstream for offline load tests
+ *
+ * Serves POST /v1/chat/completions (and /chat/completions) as a plain JSON
+ * reply or, when the request body asks for "stream":true, as SSE chunks.
+ * Latency, reply size, error/429 injection and keep-alive are knobs so that
+ * backend changes can be measured reproducibly without a provider.
+ * License: BSD3
+ *============================================================================*/
+#define _POSIX_C_SOURCE 200809L
+#include "util.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+static struct {
+	unsigned ttft_ms;      /* delay before the first token */
+	unsigned itl_ms;       /* delay between tokens */
+	unsigned ntok;         /* tokens per reply */
+	unsigned toklen;       /* bytes per token */
+	unsigned err_pct;      /* % of requests answered with 500 */
+	unsigned r429_pct;     /* % of requests answered with 429 */
+	unsigned retry_after;  /* Retry-After seconds on 429 */
+	int keepalive;         /* honor persistent connections */
+} opt = { 0, 0, 16, 4, 0, 0, 1, 1 };
+
+static uint32_t seed = 88172645u;
+static unsigned roll(void){ /* 0..99 */
+	uint32_t x = __atomic_add_fetch(&seed, 0x9e3779b9u, __ATOMIC_RELAXED);
+	x ^= x>>16; x *= 0x7feb352du; x ^= x>>15; x *= 0x846ca68bu; x ^= x>>16;
+	return x % 100;
+}
+
+static void msleep(unsigned ms){
+	if(!ms) return;
+	struct timespec ts = { ms/1000, (long)(ms%1000)*1000000L };
+	while(nanosleep(&ts,&ts) && errno==EINTR) ;
+}
+
+static int write_all(int fd, const char *p, size_t n){
+	while(n){
+		ssize_t w=write(fd,p,n);
+		if(w<0){ if(errno==EINTR) continue; return -1; }
+		p+=w; n-=(size_t)w;
+	}
+	return 0;
+}
+
+/* -l unix:PATH, for unix:// upstream bases */
+static int open_unix(const char *path){
+	struct sockaddr_un sa;
+	memset(&sa,0,sizeof sa);
+	sa.sun_family=AF_UNIX;
+	if(strlen(path)>=sizeof sa.sun_path) die("bad address: unix:%s", path);
+	memcpy(sa.sun_path, path, strlen(path));
+	unlink(path);
+	int fd=socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd<0 || bind(fd,(struct sockaddr*)&sa,sizeof sa) || listen(fd,128)) die("cannot bind unix:%s", path);
+	return fd;
+}
+
+static int open_listen(const char *hp){
+	if(!strncmp(hp, "unix:", 5)) return open_unix(hp+5);
+	char host[256], port[16];
+	if(split_host_port(hp, host, sizeof host, port, sizeof port)<0) die("bad address: %s", hp);
+	struct addrinfo hints, *res=0, *rp;
+	memset(&hints,0,sizeof hints);
+	hints.ai_family=AF_UNSPEC; hints.ai_socktype=SOCK_STREAM; hints.ai_flags=AI_PASSIVE;
+	if(getaddrinfo(*host?host:NULL, port, &hints, &res)) die("getaddrinfo %s", hp);
+	int fd=-1, on=1;
+	for(rp=res; rp; rp=rp->ai_next){
+		fd=socket(rp->ai_family,rp->ai_socktype,rp->ai_protocol);
+		if(fd<0) continue;
+		setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof on);
+		if(bind(fd,rp->ai_addr,rp->ai_addrlen)==0 && listen(fd,128)==0) break;
+		close(fd); fd=-1;
+	}
+	freeaddrinfo(res);
+	if(fd<0) die("cannot bind %s", hp);
+	return fd;
+}
+
+/* ---------------------------- request reader ----------------------------- */
+struct conn {
+	int fd;
+	struct sbuf in;          /* buffered bytes, may hold a pipelined request */
+};
+struct request {
+	char method[8], path[128];
+	int keepalive, stream;
+};
+
+static const char *hdr_find(const char *h, const char *end, const char *name){
+	size_t nl=strlen(name);
+	for(const char *p=h; p && p<end; ){
+		if(!strncasecmp(p, name, nl) && p[nl]==':'){
+			p+=nl+1; while(*p==' ') p++;
+			return p;
+		}
+		p=strstr(p, "\r\n"); if(p) p+=2;
+	}
+	return NULL;
+}
+
+/* returns 0 with one request consumed from c->in, -1 on EOF/error */
+static int read_request(struct conn *c, struct request *rq){
+	size_t hlen=0, blen=0;
+	for(;;){
+		char *eoh = c->in.s? strstr(c->in.s, "\r\n\r\n") : NULL;
+		if(eoh){
+			hlen=(size_t)(eoh+4-c->in.s);
+			const char *cl=hdr_find(c->in.s, eoh, "Content-Length");
+			blen = cl? (size_t)atol(cl) : 0;
+			if(c->in.len >= hlen+blen) break;
+		}
+		if(c->in.len > (8u<<20)) return -1;
+		char tmp[16384];
+		ssize_t r=read(c->fd, tmp, sizeof tmp-1);
+		if(r<0 && errno==EINTR) continue;
+		if(r<=0) return -1;
+		tmp[r]=0;
+		sb_puts(&c->in, tmp);
+	}
+	char *s=c->in.s;
+	memset(rq,0,sizeof *rq);
+	if(sscanf(s, "%7s %127s", rq->method, rq->path)!=2) return -1;
+	const char *conn = hdr_find(s, s+hlen, "Connection");
+	rq->keepalive = strstr(s, "HTTP/1.1\r\n") && !(conn && !strncasecmp(conn,"close",5));
+	const char *body = s+hlen;
+	rq->stream = blen && (strstr(body, "\"stream\":true") || strstr(body, "\"stream\": true"));
+	/* drop the consumed request, keep any pipelined bytes */
+	size_t used=hlen+blen;
+	memmove(c->in.s, c->in.s+used, c->in.len-used+1);
+	c->in.len-=used;
+	return 0;
+}
+
+/* ----------------------------- responders -------------------------------- */
+static void token_text(struct sbuf *b, unsigned i){
+	for(unsigned k=0;k+1<opt.toklen;k++) sb_putc(b, (char)('a'+(i+k)%26));
+	sb_putc(b, ' ');
+}
+
+static int send_simple(struct conn *c, int keep, const char *status, const char *extra, const char *body){
+	struct sbuf b; sb_init(&b);
+	sb_printf(&b, "HTTP/1.1 %s\r\nContent-Type: application/json\r\n%s"
+	          "Content-Length: %zu\r\nConnection: %s\r\n\r\n%s",
+	          status, extra?extra:"", strlen(body), keep?"keep-alive":"close", body);
+	int rc=write_all(c->fd, b.s, b.len);
+	sb_free(&b);
+	return rc;
+}
+
+static int send_plain(struct conn *c, int keep){
+	msleep(opt.ttft_ms);
+	for(unsigned i=1;i<opt.ntok;i++) msleep(opt.itl_ms);
+	struct sbuf txt; sb_init(&txt);
+	for(unsigned i=0;i<opt.ntok;i++) token_text(&txt, i);
+	struct sbuf body; sb_init(&body);
+	sb_printf(&body,
+"{\"id\":\"chatcmpl-mock\",\"object\":\"chat.completion\",\"model\":\"mock\","
+"\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":\"%s\"},"
+"\"finish_reason\":\"stop\"}],\"usage\":{\"completion_tokens\":%u}}", txt.s?txt.s:"", opt.ntok);
+	int rc=send_simple(c, keep, "200 OK", NULL, body.s);
+	sb_free(&txt); sb_free(&body);
+	return rc;
+}
+
+static int send_chunk(int fd, const char *s, size_t n){
+	char hdr[32]; int hn=snprintf(hdr, sizeof hdr, "%zx\r\n", n);
+	if(write_all(fd, hdr, (size_t)hn)) return -1;
+	if(n && write_all(fd, s, n)) return -1;
+	return write_all(fd, "\r\n", 2);
+}
+
+static int send_sse(struct conn *c, int keep){
+	char hdr[256];
+	int n=snprintf(hdr, sizeof hdr, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+	               "Cache-Control: no-cache\r\nTransfer-Encoding: chunked\r\nConnection: %s\r\n\r\n",
+	               keep?"keep-alive":"close");
+	if(write_all(c->fd, hdr, (size_t)n)) return -1;
+	msleep(opt.ttft_ms);
+	struct sbuf ev; sb_init(&ev);
+	for(unsigned i=0;i<opt.ntok;i++){
+		if(i) msleep(opt.itl_ms);
+		ev.len=0;
+		sb_puts(&ev, "data: {\"id\":\"chatcmpl-mock\",\"object\":\"chat.completion.chunk\","
+		             "\"model\":\"mock\",\"choices\":[{\"index\":0,\"delta\":{\"content\":\"");
+		token_text(&ev, i);
+		sb_puts(&ev, "\"},\"finish_reason\":null}]}\n\n");
+		if(send_chunk(c->fd, ev.s, ev.len)){ sb_free(&ev); return -1; }
+	}
+	sb_free(&ev);
+	static const char done[]="data: [DONE]\n\n";
+	if(send_chunk(c->fd, done, sizeof done-1)) return -1;
+	return send_chunk(c->fd, "", 0);
+}
+
+static int respond(struct conn *c, const struct request *rq){
+	int keep = opt.keepalive && rq->keepalive;
+	if(!strcmp(rq->method,"GET") && (!strcmp(rq->path,"/health") || !strcmp(rq->path,"/v1/models")))
+		return send_simple(c, keep, "200 OK", NULL, "{\"object\":\"list\",\"data\":[{\"id\":\"mock\"}]}");
+	if(strcmp(rq->method,"POST") ||
+	   (strcmp(rq->path,"/v1/chat/completions") && strcmp(rq->path,"/chat/completions")))
+		return send_simple(c, keep, "404 Not Found", NULL, "{\"error\":{\"message\":\"not found\"}}");
+
+	unsigned r=roll();
+	if(r < opt.r429_pct){
+		char ra[64]; snprintf(ra, sizeof ra, "Retry-After: %u\r\n", opt.retry_after);
+		return send_simple(c, keep, "429 Too Many Requests", ra,
+		                   "{\"error\":{\"message\":\"rate limited\",\"type\":\"rate_limit_exceeded\"}}");
+	}
+	if(r < opt.r429_pct + opt.err_pct)
+		return send_simple(c, keep, "500 Internal Server Error", NULL,
+		                   "{\"error\":{\"message\":\"injected failure\",\"type\":\"server_error\"}}");
+	return rq->stream ? send_sse(c, keep) : send_plain(c, keep);
+}
+
+static void *conn_main(void *arg){
+	struct conn c = { (int)(intptr_t)arg, { NULL, 0, 0 } };
+	struct request rq;
+	while(read_request(&c, &rq)==0){
+		if(respond(&c, &rq) || !(opt.keepalive && rq.keepalive)) break;
+	}
+	sb_free(&c.in);
+	close(c.fd);
+	return NULL;
+}
+
+static void usage(void){
+	fprintf(stderr,
+"usage: mockup [-l HOST:PORT|unix:PATH] [-f TTFT_MS] [-i INTER_TOKEN_MS] [-n TOKENS]\n"
+"              [-z TOKEN_BYTES] [-e ERROR_PCT] [-r 429_PCT] [-R RETRY_AFTER_S]\n"
+"              [-k 0|1]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv){
+	const char *addr="127.0.0.1:18081";
+	for(int i=1;i<argc;i++){
+		if(i+1>=argc || argv[i][0]!='-' || !argv[i][1] || argv[i][2]) usage();
+		const char *v=argv[++i];
+		switch(argv[i-1][1]){
+		case 'l': addr=v; break;
+		case 'f': opt.ttft_ms=(unsigned)atoi(v); break;
+		case 'i': opt.itl_ms=(unsigned)atoi(v); break;
+		case 'n': opt.ntok=(unsigned)atoi(v); break;
+		case 'z': opt.toklen=(unsigned)atoi(v); break;
+		case 'e': opt.err_pct=(unsigned)atoi(v); break;
+		case 'r': opt.r429_pct=(unsigned)atoi(v); break;
+		case 'R': opt.retry_after=(unsigned)atoi(v); break;
+		case 'k': opt.keepalive=atoi(v); break;
+		default: usage();
+		}
+	}
+	if(opt.toklen<1) opt.toklen=1;
+	signal(SIGPIPE, SIG_IGN);
+	int lfd=open_listen(addr);
+	pthread_attr_t at; pthread_attr_init(&at);
+	pthread_attr_setdetachstate(&at, PTHREAD_CREATE_DETACHED);
+	for(;;){
+		int cfd=accept(lfd, NULL, NULL);
+		if(cfd<0){ if(errno==EINTR) continue; break; }
+		pthread_t t;
+		if(pthread_create(&t, &at, conn_main, (void*)(intptr_t)cfd)) close(cfd);
+	}
+	close(lfd);
+	return 0;
+}